@@ -0,0 +1,285 @@
+#pragma once
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "./esp_now_midi.h"
+
+// Radio-only latency benchmark over ESP-NOW control frames.
+// The initiator sends PING(seq, t1), the responder answers PONG(seq, t1, t2, t3) with its own
+// esp_timer_get_time() at reception (t2) and transmission (t3), the initiator stamps t4 on arrival.
+//   rtt    = (t4 - t1) - (t3 - t2), responder processing removed
+//   offset = ((t2 - t1) + (t3 - t4)) / 2, taken from the fastest exchange of each window,
+//            as queueing only ever adds delay; re-estimated per window to follow clock drift
+//   one way forward = t2 - t1 - offset, one way return = t4 - t3 + offset
+// Results are printed in the benchmark results format, see scripts/benchmark.py.
+
+#ifndef LATENCY_BENCHMARK_TIMEOUT_US
+#define LATENCY_BENCHMARK_TIMEOUT_US 100000 // a ping without pong after this is counted as lost
+#endif
+#ifndef LATENCY_BENCHMARK_OFFSET_WINDOW
+#define LATENCY_BENCHMARK_OFFSET_WINDOW 32 // exchanges per clock offset estimate
+#endif
+
+// Log-linear histogram: 8 sub-buckets per power of two (<= 12.5% bucket width), 1 µs up to ~16 s
+#define LATENCY_HISTOGRAM_SUB_BITS 3
+#define LATENCY_HISTOGRAM_BUCKETS (22 << LATENCY_HISTOGRAM_SUB_BITS)
+
+struct LatencyHistogram
+{
+    uint32_t counts[LATENCY_HISTOGRAM_BUCKETS];
+    uint32_t total;
+    int64_t min;
+    int64_t max;
+
+    void clear()
+    {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        min = INT64_MAX;
+        max = INT64_MIN;
+    }
+
+    static constexpr uint32_t SUB = 1 << LATENCY_HISTOGRAM_SUB_BITS;
+
+    // Values below SUB get one bucket each, above that SUB buckets per power of two
+    static int bucketOf(uint32_t us)
+    {
+        if (us < SUB)
+            return us;
+        int exponent = 31 - __builtin_clz(us);
+        int shift = exponent - LATENCY_HISTOGRAM_SUB_BITS;
+        int index = (shift + 1) * SUB + ((us >> shift) & (SUB - 1));
+        return index < LATENCY_HISTOGRAM_BUCKETS ? index : LATENCY_HISTOGRAM_BUCKETS - 1;
+    }
+
+    static uint32_t lowerBound(int bucket)
+    {
+        if (bucket < (int)SUB)
+            return bucket;
+        int shift = bucket / SUB - 1;
+        return (SUB + bucket % SUB) << shift;
+    }
+
+    void add(int64_t us)
+    {
+        // one way estimates can come out slightly negative around the offset error
+        counts[bucketOf(us < 0 ? 0 : (uint32_t)us)]++;
+        total++;
+        if (us < min)
+            min = us;
+        if (us > max)
+            max = us;
+    }
+
+    void print(Print &out) const
+    {
+        out.println("histogram");
+        for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+        {
+            if (counts[i])
+                out.printf("%u %u %u\n", lowerBound(i), lowerBound(i + 1), counts[i]);
+        }
+    }
+};
+
+class LatencyBenchmark
+{
+public:
+    // Packed payloads following the control frame header
+    struct Ping
+    {
+        uint32_t sequence;
+        int64_t t1;
+    } __attribute__((packed));
+
+    struct Pong
+    {
+        uint32_t sequence;
+        int64_t t1;
+        int64_t t2;
+        int64_t t3;
+    } __attribute__((packed));
+
+    // Both ends call begin(), only the initiator calls start() and loop()
+    void begin(esp_now_midi &midi)
+    {
+        _midi = &midi;
+        midi.setControlFrameHandler(CONTROL_PING, onPing, this);
+        midi.setControlFrameHandler(CONTROL_PONG, onPong, this);
+        reset();
+    }
+
+    // Measure against one peer, iterations exchanges, one every intervalUs
+    void start(const uint8_t peer[6], uint32_t iterations, uint32_t intervalUs = 10000)
+    {
+        memcpy(_peer, peer, 6);
+        _iterations = iterations;
+        _intervalUs = intervalUs;
+        reset();
+        _running = true;
+    }
+
+    bool isRunning() const
+    {
+        return _running;
+    }
+
+    // Returns true when a run completed in this call
+    bool loop()
+    {
+        if (!_running)
+            return false;
+
+        int64_t now = esp_timer_get_time();
+        if (_waiting && now - _sentUs > LATENCY_BENCHMARK_TIMEOUT_US)
+        {
+            _waiting = false;
+            _lost++;
+            _completed++;
+        }
+        if (_completed >= _iterations)
+        {
+            _running = false;
+            return true;
+        }
+        if (!_waiting && now - _sentUs >= _intervalUs)
+        {
+            Ping ping;
+            ping.sequence = ++_sequence;
+            ping.t1 = esp_timer_get_time();
+            _sentUs = ping.t1;
+            _waiting = true;
+            if (_midi->sendControlFrame(_peer, CONTROL_PING, &ping, sizeof(ping)) != ESP_OK)
+            {
+                _waiting = false;
+                _lost++;
+                _completed++;
+            }
+        }
+        return false;
+    }
+
+    const LatencyHistogram &getRtt() const { return _rtt; }
+    const LatencyHistogram &getForward() const { return _forward; }
+    const LatencyHistogram &getReturn() const { return _return; }
+    uint32_t getLost() const { return _lost; }
+
+    // One results block per metric, board and distance are free text for the report
+    void printResults(Print &out, const char *board = "", const char *distance = "")
+    {
+        printRun(out, board, distance, "rtt", _rtt);
+        printRun(out, board, distance, "one-way-forward", _forward);
+        printRun(out, board, distance, "one-way-return", _return);
+    }
+
+private:
+    esp_now_midi *_midi = nullptr;
+    uint8_t _peer[6];
+    uint32_t _iterations = 0;
+    uint32_t _intervalUs = 10000;
+    bool _running = false;
+
+    volatile bool _waiting = false;
+    volatile uint32_t _completed = 0;
+    uint32_t _sequence = 0;
+    int64_t _sentUs = 0;
+    uint32_t _lost = 0;
+
+    int64_t _offset = 0;
+    bool _hasOffset = false;
+    int64_t _windowBestRtt = INT64_MAX;
+    int64_t _windowBestOffset = 0;
+    uint32_t _windowCount = 0;
+
+    LatencyHistogram _rtt;
+    LatencyHistogram _forward;
+    LatencyHistogram _return;
+
+    void reset()
+    {
+        _waiting = false;
+        _completed = 0;
+        _lost = 0;
+        _sentUs = 0;
+        _hasOffset = false;
+        _windowBestRtt = INT64_MAX;
+        _windowCount = 0;
+        _rtt.clear();
+        _forward.clear();
+        _return.clear();
+    }
+
+    // Responder side, runs in the WiFi task
+    static void onPing(void *context, const uint8_t *mac, const uint8_t *payload, int len)
+    {
+        int64_t t2 = esp_timer_get_time();
+        LatencyBenchmark *self = (LatencyBenchmark *)context;
+        if (len < (int)sizeof(Ping))
+            return;
+
+        Ping ping;
+        memcpy(&ping, payload, sizeof(ping));
+        Pong pong;
+        pong.sequence = ping.sequence;
+        pong.t1 = ping.t1;
+        pong.t2 = t2;
+        pong.t3 = esp_timer_get_time();
+        self->_midi->sendControlFrame(mac, CONTROL_PONG, &pong, sizeof(pong));
+    }
+
+    // Initiator side, runs in the WiFi task
+    static void onPong(void *context, const uint8_t *mac, const uint8_t *payload, int len)
+    {
+        int64_t t4 = esp_timer_get_time();
+        LatencyBenchmark *self = (LatencyBenchmark *)context;
+        if (len < (int)sizeof(Pong))
+            return;
+
+        Pong pong;
+        memcpy(&pong, payload, sizeof(pong));
+        if (!self->_waiting || pong.sequence != self->_sequence)
+            return; // late answer to a ping already counted as lost
+        self->addSample(pong.t1, pong.t2, pong.t3, t4);
+        self->_waiting = false;
+        self->_completed++;
+    }
+
+    void addSample(int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+    {
+        int64_t rtt = (t4 - t1) - (t3 - t2);
+        int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+
+        if (rtt < _windowBestRtt)
+        {
+            _windowBestRtt = rtt;
+            _windowBestOffset = offset;
+        }
+        if (!_hasOffset || ++_windowCount >= LATENCY_BENCHMARK_OFFSET_WINDOW)
+        {
+            _offset = _windowBestOffset;
+            _hasOffset = true;
+            _windowBestRtt = INT64_MAX;
+            _windowCount = 0;
+        }
+
+        _rtt.add(rtt);
+        _forward.add(t2 - t1 - _offset);
+        _return.add(t4 - t3 + _offset);
+    }
+
+    void printRun(Print &out, const char *board, const char *distance, const char *metric, const LatencyHistogram &histogram)
+    {
+        out.println("format: esp-now-midi-benchmark 1");
+        out.printf("board: %s\n", board);
+        out.println("transport: esp-now");
+        out.printf("distance: %s\n", distance);
+        out.printf("version: %s\n", getVersion().c_str());
+        out.printf("metric: %s\n", metric);
+        out.println("path: radio");
+        out.printf("iterations: %u\n", _iterations);
+        out.printf("lost: %u\n", _lost);
+        out.printf("min: %lld\n", histogram.total ? (long long)histogram.min : 0LL);
+        out.printf("max: %lld\n", histogram.total ? (long long)histogram.max : 0LL);
+        histogram.print(out);
+        out.println("end");
+    }
+};
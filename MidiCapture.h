@@ -0,0 +1,191 @@
+#pragma once
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "./midiHelpers.h"
+
+// Always-on binary capture of MIDI traffic.
+// Every frame costs one 8 byte copy into a fixed ring, old records are overwritten when full.
+// drain() streams the ring in bulk as a midi_capture_header followed by raw midi_capture_records,
+// see scripts/midi_capture.py for the host side.
+
+#ifndef MIDI_CAPTURE_SIZE
+#define MIDI_CAPTURE_SIZE 1024 // number of records, must be a power of two
+#endif
+
+#define MIDI_CAPTURE_VERSION 1
+#define MIDI_CAPTURE_PEER_NONE 0x1F // not peer specific, e.g. fan out to all peers or USB
+#define MIDI_CAPTURE_LOST 0xFF      // meta value of a record that was overwritten while draining
+
+static_assert((MIDI_CAPTURE_SIZE & (MIDI_CAPTURE_SIZE - 1)) == 0, "MIDI_CAPTURE_SIZE must be a power of two");
+
+enum MidiCaptureDirection : uint8_t
+{
+    CAPTURE_ESPNOW_IN = 0,
+    CAPTURE_ESPNOW_OUT = 1,
+    CAPTURE_USB_IN = 2,
+    CAPTURE_USB_OUT = 3
+};
+
+struct midi_capture_record
+{
+    uint32_t timestamp; // esp_timer_get_time() in µs, wraps after ~71 minutes
+    byte statusByte;    // status + channel as sent on the wire, 0xF0 for sysex
+    byte data1;         // sysex: length & 0x7F
+    byte data2;         // sysex: (length >> 7) & 0x7F
+    byte meta;          // direction (bits 6-7) | peer index (bits 0-4)
+
+    MidiCaptureDirection getDirection() const
+    {
+        return (MidiCaptureDirection)(meta >> 6);
+    }
+
+    uint8_t getPeer() const
+    {
+        return meta & 0x1F;
+    }
+} __attribute__((packed));
+
+struct midi_capture_header
+{
+    char magic[4]; // "EMCP"
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t count;   // number of records following the header
+    uint32_t dropped; // records overwritten since the last drain
+} __attribute__((packed));
+
+class MidiCapture
+{
+public:
+    void setEnabled(bool enabled)
+    {
+        _enabled = enabled;
+    }
+
+    bool isEnabled() const
+    {
+        return _enabled;
+    }
+
+    inline void record(MidiCaptureDirection direction, uint8_t peer, const uint8_t *data, int len)
+    {
+        if (!_enabled)
+            return;
+
+        midi_capture_record rec;
+        rec.timestamp = (uint32_t)esp_timer_get_time();
+        rec.statusByte = len > 0 ? data[0] : 0;
+        rec.data1 = len > 1 ? data[1] : 0;
+        rec.data2 = len > 2 ? data[2] : 0;
+        rec.meta = (direction << 6) | (peer & 0x1F);
+        push(rec);
+    }
+
+    // Channel voice or system message, e.g. from a USB MIDI handler
+    inline void record(MidiCaptureDirection direction, uint8_t peer, const midi_message &message)
+    {
+        midi_message_packet packet = midi_message_packet::fromMessage(message);
+        record(direction, peer, (const uint8_t *)&packet, packet.getDataSize());
+    }
+
+    inline void recordSysEx(MidiCaptureDirection direction, uint8_t peer, uint16_t length)
+    {
+        if (!_enabled)
+            return;
+
+        midi_capture_record rec;
+        rec.timestamp = (uint32_t)esp_timer_get_time();
+        rec.statusByte = MIDI_SYSEX;
+        rec.data1 = length & 0x7F;
+        rec.data2 = (length >> 7) & 0x7F;
+        rec.meta = (direction << 6) | (peer & 0x1F);
+        push(rec);
+    }
+
+    // Records waiting to be drained (capped at the ring size)
+    size_t available() const
+    {
+        uint32_t pending = _head - _tail;
+        return pending > MIDI_CAPTURE_SIZE ? MIDI_CAPTURE_SIZE : pending;
+    }
+
+    void clear()
+    {
+        portENTER_CRITICAL(&_lock);
+        _tail = _head;
+        _dropped = 0;
+        portEXIT_CRITICAL(&_lock);
+    }
+
+    // Write all pending records to out, returns the number of records written.
+    // Recording continues while draining, records lapped by the writer are sent as MIDI_CAPTURE_LOST.
+    size_t drain(Print &out)
+    {
+        portENTER_CRITICAL(&_lock);
+        uint32_t head = _head;
+        if (head - _tail > MIDI_CAPTURE_SIZE)
+        {
+            _dropped += head - _tail - MIDI_CAPTURE_SIZE;
+            _tail = head - MIDI_CAPTURE_SIZE;
+        }
+        uint32_t tail = _tail;
+        uint32_t dropped = _dropped;
+        _dropped = 0;
+        portEXIT_CRITICAL(&_lock);
+
+        midi_capture_header header;
+        memcpy(header.magic, "EMCP", 4);
+        header.version = MIDI_CAPTURE_VERSION;
+        header.recordSize = sizeof(midi_capture_record);
+        header.count = head - tail;
+        header.dropped = dropped;
+        out.write((const uint8_t *)&header, sizeof(header));
+
+        midi_capture_record chunk[DRAIN_CHUNK];
+        while (tail != head)
+        {
+            uint32_t n = head - tail;
+            if (n > DRAIN_CHUNK)
+                n = DRAIN_CHUNK;
+
+            portENTER_CRITICAL(&_lock);
+            for (uint32_t i = 0; i < n; i++)
+            {
+                uint32_t index = tail + i;
+                if (_head - index > MIDI_CAPTURE_SIZE)
+                {
+                    memset(&chunk[i], 0, sizeof(midi_capture_record));
+                    chunk[i].meta = MIDI_CAPTURE_LOST;
+                }
+                else
+                {
+                    chunk[i] = _records[index & (MIDI_CAPTURE_SIZE - 1)];
+                }
+            }
+            tail += n;
+            _tail = tail;
+            portEXIT_CRITICAL(&_lock);
+
+            out.write((const uint8_t *)chunk, n * sizeof(midi_capture_record));
+        }
+        return header.count;
+    }
+
+private:
+    static constexpr uint32_t DRAIN_CHUNK = 32;
+
+    midi_capture_record _records[MIDI_CAPTURE_SIZE];
+    volatile uint32_t _head = 0; // total records written
+    uint32_t _tail = 0;          // first record not yet drained
+    uint32_t _dropped = 0;
+    bool _enabled = true;
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+
+    inline void push(const midi_capture_record &rec)
+    {
+        portENTER_CRITICAL(&_lock);
+        _records[_head & (MIDI_CAPTURE_SIZE - 1)] = rec;
+        _head = _head + 1;
+        portEXIT_CRITICAL(&_lock);
+    }
+};
@@ -0,0 +1,459 @@
+#pragma once
+#include <Arduino.h>
+#include "./midiHelpers.h"
+#include "./MidiCapture.h"
+#include "./esp_now_midi.h"
+
+// Trace replay load generator.
+// Events come from a recorded capture (see MidiCapture.h) or a synthetic generator and are
+// pushed through esp_now_midi: *_OUT events through the send path, *_IN events through OnDataRecv.
+// Time is passed in by the caller, so the same engine runs on a board (esp_timer_get_time())
+// and on the host against a simulated clock (see extras/host).
+
+#define MIDI_REPLAY_LATENCY_BUCKETS 24 // log2 buckets, [2^i, 2^(i+1)) µs
+
+struct midi_replay_event
+{
+    uint64_t timeUs;
+    MidiCaptureDirection direction;
+    uint8_t peer; // index into the peer table for *_IN events
+    byte statusByte;
+    byte data1;
+    byte data2;
+};
+
+class MidiTraceSource
+{
+public:
+    virtual ~MidiTraceSource() = default;
+
+    // Next event in time order, false when the trace is exhausted
+    virtual bool next(midi_replay_event &event) = 0;
+    virtual void rewind() = 0;
+};
+
+// Replays records of a capture dump, timestamps are unwrapped to 64 bit
+class CaptureTraceSource : public MidiTraceSource
+{
+public:
+    CaptureTraceSource(const midi_capture_record *records, size_t count)
+        : _records(records), _count(count) {}
+
+    bool next(midi_replay_event &event) override
+    {
+        while (_index < _count)
+        {
+            const midi_capture_record &rec = _records[_index++];
+            if (rec.meta == MIDI_CAPTURE_LOST)
+                continue;
+
+            if (_hasLast && rec.timestamp < _last)
+                _wraps++;
+            _last = rec.timestamp;
+            _hasLast = true;
+
+            event.timeUs = ((uint64_t)_wraps << 32) | rec.timestamp;
+            event.direction = rec.getDirection();
+            event.peer = rec.getPeer();
+            event.statusByte = rec.statusByte;
+            event.data1 = rec.data1;
+            event.data2 = rec.data2;
+            return true;
+        }
+        return false;
+    }
+
+    void rewind() override
+    {
+        _index = 0;
+        _wraps = 0;
+        _last = 0;
+        _hasLast = false;
+    }
+
+private:
+    const midi_capture_record *_records;
+    size_t _count;
+    size_t _index = 0;
+    uint32_t _wraps = 0;
+    uint32_t _last = 0;
+    bool _hasLast = false;
+};
+
+// Bursts of notesPerChord simultaneous note ons, released after half the interval
+class ChordBurstGenerator : public MidiTraceSource
+{
+public:
+    ChordBurstGenerator(uint32_t chords, uint32_t intervalUs, uint8_t notesPerChord = 4, byte channel = 1,
+                        MidiCaptureDirection direction = CAPTURE_ESPNOW_OUT)
+        : _chords(chords), _intervalUs(intervalUs), _notesPerChord(notesPerChord),
+          _channel(channel), _direction(direction) {}
+
+    bool next(midi_replay_event &event) override
+    {
+        uint32_t perChord = _notesPerChord * 2;
+        if (_index >= _chords * perChord)
+            return false;
+
+        uint32_t chord = _index / perChord;
+        uint32_t step = _index % perChord;
+        bool release = step >= _notesPerChord;
+        uint8_t voice = release ? step - _notesPerChord : step;
+        byte root = 36 + (chord * 5) % 48;
+
+        event.timeUs = (uint64_t)chord * _intervalUs + (release ? _intervalUs / 2 : 0);
+        event.direction = _direction;
+        event.peer = 0;
+        event.statusByte = (release ? MIDI_NOTE_OFF : MIDI_NOTE_ON) | ((_channel - 1) & 0x0F);
+        event.data1 = (root + voice * 4) & 0x7F;
+        event.data2 = release ? 0 : 100;
+        _index++;
+        return true;
+    }
+
+    void rewind() override
+    {
+        _index = 0;
+    }
+
+private:
+    uint32_t _chords;
+    uint32_t _intervalUs;
+    uint8_t _notesPerChord;
+    byte _channel;
+    MidiCaptureDirection _direction;
+    uint32_t _index = 0;
+};
+
+// Triangle sweep 0..127..0 on a single controller, one message every stepUs
+class CcSweepGenerator : public MidiTraceSource
+{
+public:
+    CcSweepGenerator(uint32_t steps, uint32_t stepUs, byte control = 1, byte channel = 1,
+                     MidiCaptureDirection direction = CAPTURE_ESPNOW_OUT)
+        : _steps(steps), _stepUs(stepUs), _control(control), _channel(channel), _direction(direction) {}
+
+    bool next(midi_replay_event &event) override
+    {
+        if (_index >= _steps)
+            return false;
+
+        uint32_t phase = _index % 254;
+        event.timeUs = (uint64_t)_index * _stepUs;
+        event.direction = _direction;
+        event.peer = 0;
+        event.statusByte = MIDI_CONTROL_CHANGE | ((_channel - 1) & 0x0F);
+        event.data1 = _control & 0x7F;
+        event.data2 = phase < 127 ? phase : 254 - phase;
+        _index++;
+        return true;
+    }
+
+    void rewind() override
+    {
+        _index = 0;
+    }
+
+private:
+    uint32_t _steps;
+    uint32_t _stepUs;
+    byte _control;
+    byte _channel;
+    MidiCaptureDirection _direction;
+    uint32_t _index = 0;
+};
+
+// MIDI clock at 24 ppqn, wrapped in start/stop
+class ClockGenerator : public MidiTraceSource
+{
+public:
+    ClockGenerator(uint32_t ticks, float bpm = 120.0f, MidiCaptureDirection direction = CAPTURE_ESPNOW_OUT)
+        : _ticks(ticks), _tickUs(60000000.0f / (bpm * 24.0f)), _direction(direction) {}
+
+    bool next(midi_replay_event &event) override
+    {
+        if (_index > _ticks + 1)
+            return false;
+
+        event.direction = _direction;
+        event.peer = 0;
+        event.data1 = 0;
+        event.data2 = 0;
+        if (_index == 0)
+        {
+            event.timeUs = 0;
+            event.statusByte = MIDI_START;
+        }
+        else if (_index == _ticks + 1)
+        {
+            event.timeUs = (uint64_t)(_ticks * _tickUs);
+            event.statusByte = MIDI_STOP;
+        }
+        else
+        {
+            event.timeUs = (uint64_t)((_index - 1) * _tickUs);
+            event.statusByte = MIDI_TIME_CLOCK;
+        }
+        _index++;
+        return true;
+    }
+
+    void rewind() override
+    {
+        _index = 0;
+    }
+
+private:
+    uint32_t _ticks;
+    float _tickUs;
+    MidiCaptureDirection _direction;
+    uint32_t _index = 0;
+};
+
+// Merges up to MAX_SOURCES sources into one time ordered stream
+class MergedTraceSource : public MidiTraceSource
+{
+public:
+    static constexpr int MAX_SOURCES = 4;
+
+    bool add(MidiTraceSource *source)
+    {
+        if (_count >= MAX_SOURCES)
+            return false;
+        _sources[_count] = source;
+        _hasPending[_count] = source->next(_pending[_count]);
+        _count++;
+        return true;
+    }
+
+    bool next(midi_replay_event &event) override
+    {
+        int earliest = -1;
+        for (int i = 0; i < _count; i++)
+        {
+            if (_hasPending[i] && (earliest < 0 || _pending[i].timeUs < _pending[earliest].timeUs))
+                earliest = i;
+        }
+        if (earliest < 0)
+            return false;
+
+        event = _pending[earliest];
+        _hasPending[earliest] = _sources[earliest]->next(_pending[earliest]);
+        return true;
+    }
+
+    void rewind() override
+    {
+        for (int i = 0; i < _count; i++)
+        {
+            _sources[i]->rewind();
+            _hasPending[i] = _sources[i]->next(_pending[i]);
+        }
+    }
+
+private:
+    MidiTraceSource *_sources[MAX_SOURCES];
+    midi_replay_event _pending[MAX_SOURCES];
+    bool _hasPending[MAX_SOURCES];
+    int _count = 0;
+};
+
+struct MidiReplayStats
+{
+    uint32_t events = 0;     // events taken from the source
+    uint32_t sent = 0;       // pushed through the send path
+    uint32_t received = 0;   // pushed through the receive path
+    uint32_t sendErrors = 0; // send path returned an error, e.g. ESP-NOW queue full
+    uint32_t skipped = 0;    // USB events or unknown peers
+    uint64_t startUs = 0;
+    uint64_t endUs = 0;
+
+    // Dispatch lateness: actual dispatch time - scheduled time, includes time spent blocked in the send path
+    uint32_t latencyMinUs = UINT32_MAX;
+    uint32_t latencyMaxUs = 0;
+    uint64_t latencySumUs = 0;
+    uint32_t latencyHistogram[MIDI_REPLAY_LATENCY_BUCKETS] = {};
+
+    void addLatency(uint32_t us)
+    {
+        if (us < latencyMinUs)
+            latencyMinUs = us;
+        if (us > latencyMaxUs)
+            latencyMaxUs = us;
+        latencySumUs += us;
+
+        int bucket = 0;
+        while (us > 1 && bucket < MIDI_REPLAY_LATENCY_BUCKETS - 1)
+        {
+            us >>= 1;
+            bucket++;
+        }
+        latencyHistogram[bucket]++;
+    }
+
+    // Upper bound of the histogram bucket holding the given percentile
+    uint32_t latencyPercentileUs(float percentile) const
+    {
+        uint32_t total = sent + received;
+        uint32_t target = (uint32_t)(total * percentile / 100.0f);
+        uint32_t seen = 0;
+        for (int i = 0; i < MIDI_REPLAY_LATENCY_BUCKETS; i++)
+        {
+            seen += latencyHistogram[i];
+            if (seen > target)
+                return (2u << i) - 1;
+        }
+        return latencyMaxUs;
+    }
+};
+
+class MidiReplay
+{
+public:
+    explicit MidiReplay(esp_now_midi &midi) : _midi(midi) {}
+
+    // speed: 1.0 = real time, 100.0 = hundred times faster than recorded
+    void begin(MidiTraceSource *source, float speed, uint64_t nowUs)
+    {
+        _source = source;
+        _speed = speed > 0 ? speed : 1.0f;
+        _stats = MidiReplayStats();
+        _stats.startUs = nowUs;
+        _source->rewind();
+        _hasPending = _source->next(_pending);
+        _firstEventUs = _hasPending ? _pending.timeUs : 0;
+        _running = _hasPending;
+    }
+
+    bool isRunning() const
+    {
+        return _running;
+    }
+
+    // Scheduled time of the next event, UINT64_MAX when done
+    uint64_t nextDueUs() const
+    {
+        return _hasPending ? scheduledUs(_pending) : UINT64_MAX;
+    }
+
+    // Dispatch everything that is due, returns false when the trace is exhausted.
+    // getNow is re-evaluated after each dispatch so lateness includes the send path.
+    template <typename Clock>
+    bool poll(Clock getNow)
+    {
+        uint64_t now = getNow();
+        while (_hasPending && scheduledUs(_pending) <= now)
+        {
+            uint64_t due = scheduledUs(_pending);
+            dispatch(_pending);
+            now = getNow();
+            _stats.addLatency((uint32_t)(now - due));
+            _hasPending = _source->next(_pending);
+        }
+        if (!_hasPending && _running)
+        {
+            _running = false;
+            _stats.endUs = now;
+        }
+        return _running;
+    }
+
+    const MidiReplayStats &getStats() const
+    {
+        return _stats;
+    }
+
+    void printStats(Print &out) const
+    {
+        const MidiReplayStats &s = _stats;
+        uint64_t end = s.endUs ? s.endUs : s.startUs;
+        float seconds = (end - s.startUs) / 1000000.0f;
+        uint32_t dispatched = s.sent + s.received;
+
+        out.println("=== Replay ===");
+        out.printf("speed: %.1fx, duration: %.3f s\n", _speed, seconds);
+        out.printf("events: %u, sent: %u, received: %u, skipped: %u\n", s.events, s.sent, s.received, s.skipped);
+        out.printf("send errors (drops): %u\n", s.sendErrors);
+        if (seconds > 0)
+            out.printf("throughput: %.1f msg/s\n", dispatched / seconds);
+        if (dispatched > 0)
+        {
+            out.printf("dispatch latency us: min %u, avg %.1f, p50 <%u, p99 <%u, max %u\n",
+                       s.latencyMinUs, (float)s.latencySumUs / dispatched,
+                       s.latencyPercentileUs(50), s.latencyPercentileUs(99), s.latencyMaxUs);
+        }
+        out.println("==============");
+    }
+
+private:
+    esp_now_midi &_midi;
+    MidiTraceSource *_source = nullptr;
+    float _speed = 1.0f;
+    MidiReplayStats _stats;
+    midi_replay_event _pending;
+    bool _hasPending = false;
+    bool _running = false;
+    uint64_t _firstEventUs = 0;
+
+    uint64_t scheduledUs(const midi_replay_event &event) const
+    {
+        return _stats.startUs + (uint64_t)((event.timeUs - _firstEventUs) / _speed);
+    }
+
+    void dispatch(const midi_replay_event &event)
+    {
+        _stats.events++;
+        bool outgoing = event.direction == CAPTURE_ESPNOW_OUT;
+        bool incoming = event.direction == CAPTURE_ESPNOW_IN;
+        const uint8_t *mac = nullptr;
+        if (incoming && _midi.getPeersCount() > 0)
+            mac = _midi.getPeerMac(event.peer % _midi.getPeersCount());
+
+        if ((!outgoing && !incoming) || (incoming && !mac))
+        {
+            _stats.skipped++;
+            return;
+        }
+
+        esp_err_t err = ESP_OK;
+        if (event.statusByte == MIDI_SYSEX)
+        {
+            // only the length is captured, replay a dummy message of the same size
+            midi_sysex_message sysex;
+            memset(&sysex, 0, sizeof(sysex));
+            uint16_t length = event.data1 | (event.data2 << 7);
+            length = constrain(length, 2, sizeof(sysex.data));
+            sysex.data[0] = MIDI_SYSEX;
+            sysex.data[length - 1] = SYSEX_END;
+            sysex.length = length;
+
+            if (outgoing)
+                err = _midi.sendSysex(sysex.data, length);
+            else
+                _midi.OnDataRecv(mac, (const uint8_t *)&sysex, sizeof(sysex));
+        }
+        else
+        {
+            midi_message_packet packet;
+            packet.statusByte = event.statusByte;
+            packet.data1 = event.data1;
+            packet.data2 = event.data2;
+
+            if (outgoing)
+                err = _midi.sendMessage(packet.toMessage());
+            else
+                _midi.OnDataRecv(mac, (const uint8_t *)&packet, packet.getDataSize());
+        }
+
+        if (outgoing)
+        {
+            _stats.sent++;
+            if (err != ESP_OK)
+                _stats.sendErrors++;
+        }
+        else
+        {
+            _stats.received++;
+        }
+    }
+};
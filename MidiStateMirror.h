@@ -0,0 +1,184 @@
+#pragma once
+#include <Arduino.h>
+#include "./midiHelpers.h"
+
+// Compact copy of the MIDI state on one side of a link: held notes, controllers, program and pitch bend
+// per channel. Both ends keep one, esp_now_midi compares per channel digests and sends a snapshot of
+// the channels that differ, see esp_now_midi::enableStateSync.
+
+#define MIDI_STATE_UNSET 0x80 // controller or program never received
+
+// Snapshot of one channel: [channel 0-15, program, bend lsb, bend msb, 16 bytes held notes, 128 controllers]
+#define MIDI_STATE_SNAPSHOT_SIZE (4 + 16 + 128)
+
+class MidiStateMirror
+{
+public:
+    MidiStateMirror()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        memset(_notes, 0, sizeof(_notes));
+        memset(_controls, MIDI_STATE_UNSET, sizeof(_controls));
+        memset(_programs, MIDI_STATE_UNSET, sizeof(_programs));
+        for (int i = 0; i < 16; i++)
+            _bends[i] = 8192;
+        _channels = 0;
+        _dirty = 0xFFFF;
+    }
+
+    inline void apply(const midi_message &message)
+    {
+        if (message.status >= 0xF0 || message.channel < 1 || message.channel > 16)
+            return;
+        uint8_t ch = message.channel - 1;
+        uint8_t note = message.firstByte & 0x7F;
+        switch (message.status)
+        {
+        case MIDI_NOTE_ON:
+            if (message.secondByte)
+            {
+                _notes[ch][note >> 3] |= 1 << (note & 7);
+                break;
+            }
+            [[fallthrough]]; // velocity 0 is a note off
+        case MIDI_NOTE_OFF:
+            _notes[ch][note >> 3] &= ~(1 << (note & 7));
+            break;
+        case MIDI_CONTROL_CHANGE:
+            _controls[ch][note] = message.secondByte & 0x7F;
+            break;
+        case MIDI_PROGRAM_CHANGE:
+            _programs[ch] = message.firstByte & 0x7F;
+            break;
+        case MIDI_PITCH_BEND:
+            _bends[ch] = ((message.secondByte & 0x7F) << 7) | (message.firstByte & 0x7F);
+            break;
+        default:
+            return; // aftertouch is transient
+        }
+        _channels |= 1 << ch;
+        _dirty |= 1 << ch;
+    }
+
+    // Channels that have seen any state, bit n = MIDI channel n + 1
+    uint16_t getChannels() const
+    {
+        return _channels;
+    }
+
+    bool isNoteOn(uint8_t channel, uint8_t note) const
+    {
+        return _notes[(channel - 1) & 0x0F][(note & 0x7F) >> 3] & (1 << (note & 7));
+    }
+
+    int heldNotes(uint8_t channel) const
+    {
+        int count = 0;
+        for (int i = 0; i < 16; i++)
+            count += __builtin_popcount(_notes[(channel - 1) & 0x0F][i]);
+        return count;
+    }
+
+    // 0-127, MIDI_STATE_UNSET if never received
+    uint8_t getControl(uint8_t channel, uint8_t control) const
+    {
+        return _controls[(channel - 1) & 0x0F][control & 0x7F];
+    }
+
+    uint8_t getProgram(uint8_t channel) const
+    {
+        return _programs[(channel - 1) & 0x0F];
+    }
+
+    uint16_t getPitchBend(uint8_t channel) const // 0-16383, 8192 = center
+    {
+        return _bends[(channel - 1) & 0x0F];
+    }
+
+    // FNV-1a over the channel's snapshot, cached until the channel changes
+    uint32_t digest(uint8_t channel) const
+    {
+        uint8_t ch = (channel - 1) & 0x0F;
+        if (_dirty & (1 << ch))
+        {
+            uint8_t snapshot[MIDI_STATE_SNAPSHOT_SIZE];
+            encode(channel, snapshot);
+            uint32_t hash = 2166136261u;
+            for (size_t i = 0; i < sizeof(snapshot); i++)
+                hash = (hash ^ snapshot[i]) * 16777619u;
+            _digests[ch] = hash;
+            _dirty &= ~(1 << ch);
+        }
+        return _digests[ch];
+    }
+
+    size_t encode(uint8_t channel, uint8_t *out) const
+    {
+        uint8_t ch = (channel - 1) & 0x0F;
+        out[0] = ch;
+        out[1] = _programs[ch];
+        out[2] = _bends[ch] & 0x7F;
+        out[3] = _bends[ch] >> 7;
+        memcpy(out + 4, _notes[ch], 16);
+        memcpy(out + 20, _controls[ch], 128);
+        return MIDI_STATE_SNAPSHOT_SIZE;
+    }
+
+    // Brings the channel in line with a snapshot from the other end. emit(const midi_message &) gets
+    // a note off for every note held here but not there, and the controllers, program and pitch bend
+    // that differ. Notes held there but not here are only recorded, a late note on would be wrong.
+    // Returns the number of notes turned off, -1 for a malformed snapshot.
+    template <typename Emit>
+    int reconcile(const uint8_t *snapshot, size_t len, Emit emit)
+    {
+        if (len < MIDI_STATE_SNAPSHOT_SIZE || snapshot[0] > 15)
+            return -1;
+        uint8_t ch = snapshot[0];
+        const uint8_t *notes = snapshot + 4;
+        const uint8_t *controls = snapshot + 20;
+        int turnedOff = 0;
+
+        for (int i = 0; i < 16; i++)
+        {
+            uint8_t stuck = _notes[ch][i] & ~notes[i];
+            while (stuck)
+            {
+                int bit = __builtin_ctz(stuck);
+                stuck &= stuck - 1;
+                emit(midi_message{(byte)(ch + 1), MIDI_NOTE_OFF, (byte)(i * 8 + bit), 0});
+                turnedOff++;
+            }
+            _notes[ch][i] = notes[i];
+        }
+        for (int i = 0; i < 128; i++)
+        {
+            if (controls[i] != MIDI_STATE_UNSET && controls[i] != _controls[ch][i])
+                emit(midi_message{(byte)(ch + 1), MIDI_CONTROL_CHANGE, (byte)i, controls[i]});
+            _controls[ch][i] = controls[i];
+        }
+        if (snapshot[1] != MIDI_STATE_UNSET && snapshot[1] != _programs[ch])
+            emit(midi_message{(byte)(ch + 1), MIDI_PROGRAM_CHANGE, snapshot[1], 0});
+        _programs[ch] = snapshot[1];
+        uint16_t bend = (snapshot[3] << 7) | snapshot[2];
+        if (bend != _bends[ch])
+            emit(midi_message{(byte)(ch + 1), MIDI_PITCH_BEND, snapshot[2], snapshot[3]});
+        _bends[ch] = bend;
+
+        _channels |= 1 << ch;
+        _dirty |= 1 << ch;
+        return turnedOff;
+    }
+
+private:
+    uint8_t _notes[16][16];     // bit per note
+    uint8_t _controls[16][128]; // MIDI_STATE_UNSET until received
+    uint8_t _programs[16];
+    uint16_t _bends[16];
+    mutable uint32_t _digests[16];
+    uint16_t _channels;
+    mutable uint16_t _dirty;
+};
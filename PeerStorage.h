@@ -2,6 +2,7 @@
 
 #include <Arduino.h>
 #include "EEPROM.h"
+#include "./utils/log.h"
 
 #define MAC_ADDRESS_SIZE 6
 #define MAX_PEERS 20
@@ -37,16 +38,14 @@ public:
         }
         
         if (!EEPROM.begin(eepromSize)) {
-            Serial.println("PeerStorage: Failed to initialize EEPROM");
+            ENOMIK_LOGE("PeerStorage: Failed to initialize EEPROM");
             return false;
         }
         
         load();
         initialized = true;
         
-        Serial.print("PeerStorage: Loaded ");
-        Serial.print(peerCount);
-        Serial.println(" peers");
+        ENOMIK_LOGI("PeerStorage: Loaded %d peers", peerCount);
         
         return true;
     }
@@ -54,17 +53,17 @@ public:
     // Peer management
     bool add(const uint8_t mac[MAC_ADDRESS_SIZE]) {
         if (!initialized) {
-            Serial.println("PeerStorage: Not initialized");
+            ENOMIK_LOGW("PeerStorage: Not initialized");
             return false;
         }
         
         if (isFull()) {
-            Serial.println("PeerStorage: Maximum peers reached");
+            ENOMIK_LOGW("PeerStorage: Maximum peers reached");
             return false;
         }
         
         if (exists(mac)) {
-            Serial.println("PeerStorage: Peer already exists");
+            ENOMIK_LOGD("PeerStorage: Peer already exists");
             return false;
         }
         
@@ -72,11 +71,9 @@ public:
         peerCount++;
         save();
         
-        Serial.print("PeerStorage: Added peer ");
-        printMac(mac);
-        Serial.print(" (Total: ");
-        Serial.print(peerCount);
-        Serial.println(")");
+        // A MAC takes all log arguments, the total goes on its own line
+        ENOMIK_LOGI("PeerStorage: Added peer " ENOMIK_LOG_MAC_FORMAT, ENOMIK_LOG_MAC_ARGS(mac));
+        ENOMIK_LOGD("PeerStorage: %d peers stored", peerCount);
         
         return true;
     }
@@ -84,7 +81,7 @@ public:
     bool remove(const uint8_t mac[MAC_ADDRESS_SIZE]) {
         int index = findIndex(mac);
         if (index < 0) {
-            Serial.println("PeerStorage: Peer not found");
+            ENOMIK_LOGD("PeerStorage: Peer not found");
             return false;
         }
         
@@ -93,13 +90,11 @@ public:
     
     bool remove(int index) {
         if (index < 0 || index >= peerCount) {
-            Serial.println("PeerStorage: Invalid index");
+            ENOMIK_LOGW("PeerStorage: Invalid index %d", index);
             return false;
         }
         
-        Serial.print("PeerStorage: Removing peer ");
-        printMac(peers[index].mac);
-        Serial.println();
+        ENOMIK_LOGI("PeerStorage: Removing peer " ENOMIK_LOG_MAC_FORMAT, ENOMIK_LOG_MAC_ARGS(peers[index].mac));
         
         // Shift remaining peers down
         for (int i = index; i < peerCount - 1; i++) {
@@ -117,7 +112,7 @@ public:
         peerCount = 0;
         memset(peers, 0, sizeof(peers));
         save();
-        Serial.println("PeerStorage: All peers cleared");
+        ENOMIK_LOGI("PeerStorage: All peers cleared");
     }
     
     // Query methods
@@ -179,7 +174,7 @@ private:
         
         if (storage.validFlag != VALID_FLAG) {
             // First time use - initialize
-            Serial.println("PeerStorage: Initializing fresh storage");
+            ENOMIK_LOGI("PeerStorage: Initializing fresh storage");
             peerCount = 0;
             memset(peers, 0, sizeof(peers));
             save();
@@ -187,7 +182,7 @@ private:
             // Load existing peers
             peerCount = storage.peerCount;
             if (peerCount > MAX_PEERS) {
-                Serial.println("PeerStorage: Corrupt data, resetting");
+                ENOMIK_LOGW("PeerStorage: Corrupt data, resetting");
                 peerCount = 0;
                 save();
             } else {
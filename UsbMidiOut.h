@@ -0,0 +1,321 @@
+#pragma once
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "./midiHelpers.h"
+
+// USB-MIDI output stage.
+// Messages are encoded straight into 4 byte USB-MIDI event packets (cable 0) and written to the USB
+// stack right away, instead of one MIDI library write per byte of every message. TinyUSB's FIFO
+// already sends everything written while a transfer is in flight with the next one, so nothing is held
+// back here while it has room. Only when the FIFO is full do packets wait in a ring, in order, and
+// poll() writes them as room frees up, so a burst larger than the FIFO (a chord) isn't lost.
+// Sysex is encoded and written a few packets at a time; one longer than the ring waits on the calling
+// task for room, up to USB_MIDI_OUT_SYSEX_WAIT_MS, and is cut short with an F7 after that.
+// Port is anything with bool writePacket(const uint8_t packet[4]), e.g. Adafruit_USBD_MIDI.
+// send() may be called from the WiFi task, e.g. from esp_now_midi handlers; one writer at a time keeps
+// the packets in order.
+
+#ifndef USB_MIDI_OUT_QUEUE_SIZE
+#define USB_MIDI_OUT_QUEUE_SIZE 128 // packets, must be a power of two
+#endif
+#ifndef USB_MIDI_OUT_SYSEX_WAIT_MS
+#define USB_MIDI_OUT_SYSEX_WAIT_MS 100 // a sysex longer than the queue waits this long for the USB FIFO
+#endif
+#define USB_MIDI_OUT_SYSEX_CHUNK 8 // packets encoded at a time, on the caller's stack
+
+static_assert((USB_MIDI_OUT_QUEUE_SIZE & (USB_MIDI_OUT_QUEUE_SIZE - 1)) == 0, "USB_MIDI_OUT_QUEUE_SIZE must be a power of two");
+
+struct usb_midi_out_stats
+{
+    uint32_t messages = 0;     // including sysex
+    uint32_t packets = 0;      // written to the USB stack
+    uint32_t direct = 0;       // packets written right away by send()
+    uint32_t deferred = 0;     // packets that waited for room in the USB FIFO
+    uint32_t busy = 0;         // writes refused by a full USB FIFO
+    uint32_t dropped = 0;      // messages lost to a full queue, or sysex cut short
+    uint16_t maxQueued = 0;    // most packets waiting at once
+    uint32_t maxLatencyUs = 0; // deferred packets, from send() until the packet was written
+    uint64_t totalLatencyUs = 0;
+};
+
+template <typename Port>
+class UsbMidiOut
+{
+public:
+    explicit UsbMidiOut(Port &port) : _port(port) {}
+
+    // Returns false if the queue is full
+    bool send(const midi_message &message)
+    {
+        uint8_t packet[4];
+        if (!encode(message, packet))
+            return true; // nothing to send on USB, e.g. a sysex start byte on its own
+        if (write(packet, 1, true))
+            return true;
+        countDropped();
+        return false;
+    }
+
+    // Complete sysex, F0 and F7 are added when data doesn't contain them. Returns false if it was
+    // dropped (queue full before the first packet) or cut short
+    bool sendSysEx(const uint8_t *data, uint16_t length)
+    {
+        bool start = length > 0 && data[0] == MIDI_SYSEX;
+        bool end = length > 0 && data[length - 1] == SYSEX_END;
+        uint16_t total = length + !start + !end;
+        uint16_t count = (total + 2) / 3;
+        uint32_t startUs = esp_timer_get_time();
+
+        uint8_t packets[USB_MIDI_OUT_SYSEX_CHUNK][4];
+        for (uint16_t first = 0; first < count; first += USB_MIDI_OUT_SYSEX_CHUNK)
+        {
+            uint16_t chunk = count - first < USB_MIDI_OUT_SYSEX_CHUNK ? count - first : USB_MIDI_OUT_SYSEX_CHUNK;
+            for (uint16_t i = 0; i < chunk; i++)
+                encodeSysEx(data, start, end, total, first + i, packets[i]);
+            bool last = first + chunk == count;
+            uint16_t done = 0;
+            while (true)
+            {
+                done += write(packets[done], chunk - done, last);
+                if (done == chunk)
+                    break;
+                if (first + done == 0)
+                {
+                    countDropped(); // nothing is out yet, drop it whole like any other message
+                    return false;
+                }
+                if ((uint32_t)esp_timer_get_time() - startUs > USB_MIDI_OUT_SYSEX_WAIT_MS * 1000UL)
+                {
+                    // Part of it is out, end it so the host doesn't wait for the rest
+                    static const uint8_t endPacket[4] = {0x05, SYSEX_END, 0, 0};
+                    write(endPacket, 1, false);
+                    countDropped();
+                    return false;
+                }
+                flush();
+                delay(1); // the USB task empties the FIFO meanwhile
+            }
+        }
+        return true;
+    }
+
+    // Call on every loop pass, writes the packets that waited for room in the USB FIFO
+    inline void poll()
+    {
+        if (_count)
+            flush();
+    }
+
+    // Writes as much of the queue as the USB stack takes, returns the number of packets written
+    size_t flush()
+    {
+        if (!claim(false))
+            return 0; // nothing waiting, or another writer is busy
+        uint16_t count = _count; // sends meanwhile only add behind
+        uint16_t written = 0;
+        uint32_t now = esp_timer_get_time();
+        while (written < count)
+        {
+            uint16_t index = (_head + written) & (USB_MIDI_OUT_QUEUE_SIZE - 1);
+            if (!_port.writePacket(_packets[index]))
+            {
+                _stats.busy++;
+                break;
+            }
+            uint32_t latency = now - _queuedUs[index];
+            _stats.totalLatencyUs += latency;
+            if (latency > _stats.maxLatencyUs)
+                _stats.maxLatencyUs = latency;
+            written++;
+        }
+        _stats.packets += written;
+        _stats.deferred += written;
+        release(written, false);
+        return written;
+    }
+
+    // Drops everything waiting, e.g. while USB is not mounted. Safe against a write on another task,
+    // that writer drops the queue once it is done.
+    void clear()
+    {
+        portENTER_CRITICAL(&_lock);
+        if (_writing)
+        {
+            _clearPending = true;
+        }
+        else
+        {
+            _head = 0;
+            _count = 0;
+        }
+        portEXIT_CRITICAL(&_lock);
+    }
+
+    uint16_t pending() const
+    {
+        return _count;
+    }
+
+    const usb_midi_out_stats &getStats() const
+    {
+        return _stats;
+    }
+
+    void resetStats()
+    {
+        _stats = usb_midi_out_stats();
+    }
+
+    void printStats(Print &out) const
+    {
+        out.println("=== USB MIDI out ===");
+        out.printf("messages %u, packets %u (direct %u, deferred %u), dropped %u\n",
+                   _stats.messages, _stats.packets, _stats.direct, _stats.deferred, _stats.dropped);
+        out.printf("USB FIFO full %u times, at most %u packets queued\n", _stats.busy, _stats.maxQueued);
+        out.printf("deferred latency us: avg %u, max %u\n",
+                   _stats.deferred ? (unsigned)(_stats.totalLatencyUs / _stats.deferred) : 0, _stats.maxLatencyUs);
+        out.println("====================");
+    }
+
+    // USB-MIDI event packet for a channel voice or system common/realtime message
+    static bool encode(const midi_message &message, uint8_t packet[4])
+    {
+        midi_message_packet bytes = midi_message_packet::fromMessage(message);
+        uint8_t size = bytes.getDataSize();
+        uint8_t cin;
+        if (message.status < 0xF0)
+            cin = message.status >> 4;
+        else if (message.status >= MIDI_TIME_CLOCK)
+            cin = 0x0F; // single byte
+        else if (message.status == MIDI_TIME_CODE || message.status == MIDI_SONG_SELECT)
+            cin = 0x02;
+        else if (message.status == MIDI_SONG_POS_POINTER)
+            cin = 0x03;
+        else if (message.status == MIDI_TUNE_REQUEST)
+            cin = 0x05;
+        else
+            return false; // sysex goes through sendSysEx
+        packet[0] = cin;
+        packet[1] = bytes.statusByte;
+        packet[2] = size > 1 ? bytes.data1 : 0;
+        packet[3] = size > 2 ? bytes.data2 : 0;
+        return true;
+    }
+
+private:
+    Port &_port;
+    uint8_t _packets[USB_MIDI_OUT_QUEUE_SIZE][4];
+    uint32_t _queuedUs[USB_MIDI_OUT_QUEUE_SIZE];
+    uint16_t _head = 0;
+    volatile uint16_t _count = 0;
+    bool _writing = false;      // a send() or flush() is writing to the port
+    bool _clearPending = false; // clear() came in meanwhile
+    usb_midi_out_stats _stats;
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+
+    // Packet i of a sysex with total bytes, F0 and F7 added where data lacks them
+    static void encodeSysEx(const uint8_t *data, bool start, bool end, uint16_t total, uint16_t i, uint8_t packet[4])
+    {
+        uint8_t size = total - i * 3 < 3 ? total - i * 3 : 3;
+        for (uint8_t j = 0; j < 3; j++)
+        {
+            uint16_t index = i * 3 + j;
+            if (j >= size)
+                packet[1 + j] = 0;
+            else if (!start && index == 0)
+                packet[1 + j] = MIDI_SYSEX;
+            else if (!end && index == total - 1)
+                packet[1 + j] = SYSEX_END;
+            else
+                packet[1 + j] = data[index - !start];
+        }
+        // CIN 4: sysex continues, 5-7: sysex ends with 1-3 bytes
+        packet[0] = (i + 1) * 3 < total ? 0x04 : 0x04 + size;
+    }
+
+    // Straight to the USB stack when nothing waits, whatever it doesn't take is queued. Returns the
+    // packets written or queued: all of them, or the ones written if the rest didn't fit the queue.
+    // last: they end a message, for the message count
+    uint16_t write(const uint8_t *packets, uint16_t count, bool last)
+    {
+        if (!claim(true))
+            return push(packets, count, last) ? count : 0;
+        uint16_t written = 0;
+        while (written < count && _port.writePacket(packets + written * 4))
+            written++;
+        _stats.packets += written;
+        _stats.direct += written;
+        uint16_t accepted = written;
+        if (written < count)
+        {
+            _stats.busy++;
+            if (push(packets + written * 4, count - written, last)) // before release, keeps the order
+                accepted = count;
+        }
+        release(0, last && written == count);
+        return accepted;
+    }
+
+    void countDropped()
+    {
+        portENTER_CRITICAL(&_lock);
+        _stats.dropped++;
+        portEXIT_CRITICAL(&_lock);
+    }
+
+    // Makes this the only writer. direct: only if nothing is queued, queue: only if something is
+    bool claim(bool direct)
+    {
+        portENTER_CRITICAL(&_lock);
+        bool claimed = !_writing && (direct ? _count == 0 : _count != 0);
+        if (claimed)
+            _writing = true;
+        portEXIT_CRITICAL(&_lock);
+        return claimed;
+    }
+
+    void release(uint16_t written, bool sent)
+    {
+        portENTER_CRITICAL(&_lock);
+        if (_clearPending)
+        {
+            _head = 0;
+            _count = 0;
+            _clearPending = false;
+        }
+        else
+        {
+            _head = (_head + written) & (USB_MIDI_OUT_QUEUE_SIZE - 1);
+            _count -= written;
+        }
+        if (sent)
+            _stats.messages++;
+        _writing = false;
+        portEXIT_CRITICAL(&_lock);
+    }
+
+    // All or nothing, a message is never split across a full queue
+    bool push(const uint8_t *packets, uint16_t count, bool last)
+    {
+        uint32_t now = esp_timer_get_time();
+        bool pushed = false;
+        portENTER_CRITICAL(&_lock);
+        if (_count + count <= USB_MIDI_OUT_QUEUE_SIZE)
+        {
+            for (uint16_t i = 0; i < count; i++)
+            {
+                uint16_t index = (_head + _count + i) & (USB_MIDI_OUT_QUEUE_SIZE - 1);
+                memcpy(_packets[index], packets + i * 4, 4);
+                _queuedUs[index] = now;
+            }
+            _count += count;
+            if (_count > _stats.maxQueued)
+                _stats.maxQueued = _count;
+            if (last)
+                _stats.messages++;
+            pushed = true;
+        }
+        portEXIT_CRITICAL(&_lock);
+        return pushed;
+    }
+};
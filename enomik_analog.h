@@ -0,0 +1,209 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <soc/soc_caps.h>
+#include "./utils/log.h"
+
+// Continuous ADC backend for analog inputs.
+// The ADC driver converts all pins in the background at a fixed rate (DMA, no CPU per conversion),
+// poll() moves each finished frame into small per pin buffers and IO only reads from those, so the pin
+// scan no longer waits on analogRead and the sample rate no longer depends on how fast loop() runs.
+// Only ADC1 pins can be sampled continuously, everything else stays on analogRead.
+
+#ifndef ENOMIK_ANALOG_SAMPLE_HZ
+#define ENOMIK_ANALOG_SAMPLE_HZ 20000 // conversions per second, all pins together
+#endif
+#ifndef ENOMIK_ANALOG_CONVERSIONS
+#define ENOMIK_ANALOG_CONVERSIONS 4 // per pin and frame, averaged by the driver
+#endif
+#ifndef ENOMIK_ANALOG_BUFFER
+#define ENOMIK_ANALOG_BUFFER 8 // frames kept per pin until IO reads them
+#endif
+#define ENOMIK_ANALOG_MAX_PINS SOC_ADC_MAX_CHANNEL_NUM
+
+namespace enomik
+{
+    struct AnalogStats
+    {
+        uint32_t frames = 0;    // finished by the driver, one sample per pin each
+        uint32_t consumed = 0;  // moved into the per pin buffers by poll()
+        uint32_t skipped = 0;   // finished while poll() wasn't looking, replaced by a newer one
+        uint32_t overflows = 0; // samples dropped because IO didn't read a pin in time
+        uint32_t polls = 0;
+        uint64_t pollUs = 0;
+        uint32_t pollMaxUs = 0;
+    };
+
+    class AnalogSampler
+    {
+    public:
+        // Starts sampling the ADC1 pins among pins, returns false if none could be started.
+        // Samples are scaled to bits, the resolution the rest of IO works with
+        bool begin(const uint8_t *pins, size_t count, uint8_t bits)
+        {
+            end();
+            memset(_slotOfPin, -1, sizeof(_slotOfPin));
+            _count = 0;
+            for (size_t i = 0; i < count && _count < ENOMIK_ANALOG_MAX_PINS; i++)
+            {
+                int channel = digitalPinToAnalogChannel(pins[i]);
+                if (channel < 0 || channel >= SOC_ADC_CHANNEL_NUM(0) || pins[i] >= sizeof(_slotOfPin))
+                {
+                    ENOMIK_LOGW("Analog pin %d is not on ADC1, using analogRead", pins[i]);
+                    continue;
+                }
+                _slotOfPin[pins[i]] = _count;
+                _pins[_count++] = pins[i];
+            }
+            if (!_count)
+                return false;
+
+            _shift = bits - SOC_ADC_DIGI_MAX_BITWIDTH;
+            _instance = this;
+            _frames = 0;
+            _seenFrames = 0;
+            memset(_sampleCount, 0, sizeof(_sampleCount));
+            if (!analogContinuous(_pins, _count, ENOMIK_ANALOG_CONVERSIONS, ENOMIK_ANALOG_SAMPLE_HZ, onFrame) ||
+                !analogContinuousStart())
+            {
+                ENOMIK_LOGE("Continuous ADC failed for %d pins", _count);
+                analogContinuousDeinit();
+                memset(_slotOfPin, -1, sizeof(_slotOfPin));
+                _count = 0;
+                return false;
+            }
+            _running = true;
+            resetStats();
+            ENOMIK_LOGI("Continuous ADC: %d pins, %d frames/s", _count, (int)frameRate());
+            return true;
+        }
+
+        void end()
+        {
+            if (!_running)
+                return;
+            analogContinuousStop();
+            analogContinuousDeinit();
+            _running = false;
+            memset(_slotOfPin, -1, sizeof(_slotOfPin));
+            _count = 0;
+        }
+
+        bool isRunning() const
+        {
+            return _running;
+        }
+
+        // True if pin is sampled here, false means analogRead
+        inline bool has(uint8_t pin) const
+        {
+            return _running && pin < sizeof(_slotOfPin) && _slotOfPin[pin] >= 0;
+        }
+
+        // Nominal frames per second, the rate each pin is sampled at
+        float frameRate() const
+        {
+            return _count ? (float)ENOMIK_ANALOG_SAMPLE_HZ / (_count * ENOMIK_ANALOG_CONVERSIONS) : 0;
+        }
+
+        // Call from the pin scan, moves the newest finished frame into the per pin buffers
+        void poll()
+        {
+            uint32_t frames = _frames;
+            if (!_running || frames == _seenFrames)
+                return;
+            int64_t start = esp_timer_get_time();
+            adc_continuous_data_t *results = nullptr;
+            if (analogContinuousRead(&results, 0) && results)
+            {
+                _stats.skipped += frames - _seenFrames - 1;
+                _stats.consumed++;
+                for (uint8_t i = 0; i < _count; i++)
+                    push(i, results[i].avg_read_raw); // results come in the order of _pins
+            }
+            _seenFrames = frames;
+            uint32_t us = esp_timer_get_time() - start;
+            _stats.polls++;
+            _stats.pollUs += us;
+            if (us > _stats.pollMaxUs)
+                _stats.pollMaxUs = us;
+        }
+
+        // Average of the samples since the last read, false if there is no new one
+        inline bool read(uint8_t pin, int &value)
+        {
+            int8_t slot = pin < sizeof(_slotOfPin) ? _slotOfPin[pin] : -1;
+            if (slot < 0 || !_sampleCount[slot])
+                return false;
+            int32_t sum = 0;
+            for (uint8_t i = 0; i < _sampleCount[slot]; i++)
+                sum += _samples[slot][i];
+            value = sum / _sampleCount[slot];
+            _sampleCount[slot] = 0;
+            return true;
+        }
+
+        const AnalogStats &getStats()
+        {
+            _stats.frames = _frames - _framesAtReset;
+            return _stats;
+        }
+
+        void resetStats()
+        {
+            _stats = AnalogStats();
+            _framesAtReset = _frames;
+            _statsSinceUs = esp_timer_get_time();
+        }
+
+        void printStats(Print &out)
+        {
+            const AnalogStats &stats = getStats();
+            float seconds = (esp_timer_get_time() - _statsSinceUs) / 1000000.0f;
+            out.println("=== Analog inputs ===");
+            out.printf("%s | %d pins, %d conversions per sample, nominal %.0f samples/s per pin\n",
+                       _running ? "continuous" : "off", _count, ENOMIK_ANALOG_CONVERSIONS, frameRate());
+            out.printf("measured %.0f samples/s per pin, consumed %.0f/s, skipped %u, overflows %u\n",
+                       seconds > 0 ? stats.frames / seconds : 0.0f, seconds > 0 ? stats.consumed / seconds : 0.0f,
+                       stats.skipped, stats.overflows);
+            out.printf("poll us: avg %u, max %u\n",
+                       stats.polls ? (unsigned)(stats.pollUs / stats.polls) : 0, stats.pollMaxUs);
+            out.println("=====================");
+        }
+
+    private:
+        static AnalogSampler *_instance; // the driver's callback has no argument, there is one ADC anyway
+        uint8_t _pins[ENOMIK_ANALOG_MAX_PINS];
+        uint8_t _count = 0;
+        int8_t _slotOfPin[64];
+        int8_t _shift = 0;
+        bool _running = false;
+        int16_t _samples[ENOMIK_ANALOG_MAX_PINS][ENOMIK_ANALOG_BUFFER];
+        uint8_t _sampleCount[ENOMIK_ANALOG_MAX_PINS] = {};
+        volatile uint32_t _frames = 0;
+        uint32_t _seenFrames = 0;
+        uint32_t _framesAtReset = 0;
+        int64_t _statsSinceUs = 0;
+        AnalogStats _stats;
+
+        // Driver ISR, a frame is ready to be read
+        static void IRAM_ATTR onFrame()
+        {
+            if (_instance)
+                _instance->_frames++;
+        }
+
+        inline void push(uint8_t slot, int raw)
+        {
+            if (_sampleCount[slot] >= ENOMIK_ANALOG_BUFFER)
+            {
+                _stats.overflows++;
+                return;
+            }
+            _samples[slot][_sampleCount[slot]++] = _shift >= 0 ? raw << _shift : raw >> -_shift;
+        }
+    };
+
+    AnalogSampler *AnalogSampler::_instance = nullptr;
+}
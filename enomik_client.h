@@ -3,9 +3,13 @@
 #include <esp_now.h>
 #include <WiFi.h>
 #include "enomik_io.h"
+#include "enomik_routing.h"
+#include "enomik_scheduler.h"
 #include "PeerStorage.h"
+#include "UsbMidiOut.h"
 #include "utils/esp.h"
 #include "utils/mac.h"
+#include "utils/callback.h"
 
 #ifdef HAS_USB_MIDI
 #include <Adafruit_TinyUSB.h>
@@ -16,35 +20,43 @@ Adafruit_USBD_MIDI g_usb_midi;
 MIDI_CREATE_INSTANCE(Adafruit_USBD_MIDI, g_usb_midi, USBMIDI);
 #endif
 
+#ifndef IO_SCAN_PERIOD_US
+#define IO_SCAN_PERIOD_US 1000 // pin scan rate, 1 kHz
+#endif
+
 namespace enomik
 {
     class Client
     {
     private:
         PeerStorage peerStorage;
+        Router _router;
         bool isInitialized;
+#ifdef HAS_USB_MIDI
+        UsbMidiOut<Adafruit_USBD_MIDI> _usbOut{g_usb_midi}; // queued packets are written from pollMIDI
+#endif
 
         // --- Channel Voice ---
-        std::function<void(byte channel, byte note, byte velocity)> _onNoteOnHandler;
-        std::function<void(byte channel, byte note, byte velocity)> _onNoteOffHandler;
-        std::function<void(byte channel, byte control, byte value)> _onControlChangeHandler;
-        std::function<void(byte channel, byte program)> _onProgramChangeHandler;
-        std::function<void(byte channel, byte pressure)> _onAfterTouchChannelHandler;         // Channel aftertouch
-        std::function<void(byte channel, byte note, byte pressure)> _onAfterTouchPolyHandler; // Poly aftertouch
-        std::function<void(byte channel, int value)> _onPitchBendHandler;                     // uint16_t
+        Callback<void(byte channel, byte note, byte velocity)> _onNoteOnHandler;
+        Callback<void(byte channel, byte note, byte velocity)> _onNoteOffHandler;
+        Callback<void(byte channel, byte control, byte value)> _onControlChangeHandler;
+        Callback<void(byte channel, byte program)> _onProgramChangeHandler;
+        Callback<void(byte channel, byte pressure)> _onAfterTouchChannelHandler;         // Channel aftertouch
+        Callback<void(byte channel, byte note, byte pressure)> _onAfterTouchPolyHandler; // Poly aftertouch
+        Callback<void(byte channel, int value)> _onPitchBendHandler;                     // uint16_t
 
         // --- System Real-Time ---
-        std::function<void()> _onStartHandler;
-        std::function<void()> _onStopHandler;
-        std::function<void()> _onContinueHandler;
-        std::function<void()> _onClockHandler;
+        Callback<void()> _onStartHandler;
+        Callback<void()> _onStopHandler;
+        Callback<void()> _onContinueHandler;
+        Callback<void()> _onClockHandler;
 
         // --- System Common ---
-        std::function<void(uint16_t songPosition)> _onSongPositionHandler;
-        std::function<void(byte songNumber)> _onSongSelectHandler;
+        Callback<void(uint16_t songPosition)> _onSongPositionHandler;
+        Callback<void(byte songNumber)> _onSongSelectHandler;
 
         // --- System Exclusive ---
-        std::function<void(uint8_t *data, unsigned int length)> _onSysExHandler;
+        Callback<void(uint8_t *data, unsigned int length)> _onSysExHandler;
 
 #if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION >= ESP_ARDUINO_VERSION_VAL(3, 3, 0)
         static void onDataSent(const wifi_tx_info_t *info, esp_now_send_status_t status)
@@ -65,132 +77,402 @@ namespace enomik
             }
         }
 
-        // --- Static handlers that call both IO and user-defined callbacks ---
-        static void handleNoteOnStatic(byte channel, byte note, byte velocity)
+        // --- Dispatch: routes first (IO, bridge to the other transport), then the user handler ---
+        // ESP-NOW calls these directly with the client as context, USB MIDI only takes plain
+        // function pointers and goes through the static versions below.
+        template <bool FromUSB>
+        static void dispatchNoteOn(void *context, byte channel, byte note, byte velocity)
         {
-            if (Client::instancePtr)
+            Client *client = static_cast<Client *>(context);
+            if (client->receive<FromUSB>(makeMessage(MIDI_NOTE_ON, channel, note, velocity)))
+                client->io.onNoteOn(channel, note, velocity);
+            if (client->_onNoteOnHandler)
+                client->_onNoteOnHandler(channel, note, velocity);
+        }
+
+        template <bool FromUSB>
+        static void dispatchNoteOff(void *context, byte channel, byte note, byte velocity)
+        {
+            Client *client = static_cast<Client *>(context);
+            if (client->receive<FromUSB>(makeMessage(MIDI_NOTE_OFF, channel, note, velocity)))
+                client->io.onNoteOff(channel, note, velocity);
+            if (client->_onNoteOffHandler)
+                client->_onNoteOffHandler(channel, note, velocity);
+        }
+
+        template <bool FromUSB>
+        static void dispatchControlChange(void *context, byte channel, byte control, byte value)
+        {
+            Client *client = static_cast<Client *>(context);
+            if (client->receive<FromUSB>(makeMessage(MIDI_CONTROL_CHANGE, channel, control, value)))
+                client->io.onControlChange(channel, control, value);
+            if (client->_onControlChangeHandler)
+                client->_onControlChangeHandler(channel, control, value);
+        }
+
+        template <bool FromUSB>
+        static void dispatchProgramChange(void *context, byte channel, byte program)
+        {
+            Client *client = static_cast<Client *>(context);
+            if (client->receive<FromUSB>(makeMessage(MIDI_PROGRAM_CHANGE, channel, program)))
+                client->io.onProgramChange(channel, program);
+            if (client->_onProgramChangeHandler)
+                client->_onProgramChangeHandler(channel, program);
+        }
+
+        template <bool FromUSB>
+        static void dispatchAfterTouchChannel(void *context, byte channel, byte pressure)
+        {
+            Client *client = static_cast<Client *>(context);
+            client->receive<FromUSB>(makeMessage(MIDI_AFTERTOUCH, channel, pressure));
+            // client->io.onAfterTouch(channel, pressure);
+            if (client->_onAfterTouchChannelHandler)
+                client->_onAfterTouchChannelHandler(channel, pressure);
+        }
+
+        template <bool FromUSB>
+        static void dispatchAfterTouchPoly(void *context, byte channel, byte note, byte pressure)
+        {
+            Client *client = static_cast<Client *>(context);
+            client->receive<FromUSB>(makeMessage(MIDI_POLY_AFTERTOUCH, channel, note, pressure));
+            // client->io.onAfterTouchPoly(channel, note, pressure);
+            if (client->_onAfterTouchPolyHandler)
+                client->_onAfterTouchPolyHandler(channel, note, pressure);
+        }
+
+        template <bool FromUSB>
+        static void dispatchPitchBend(void *context, byte channel, int value) // signed, -8192..8191
+        {
+            Client *client = static_cast<Client *>(context);
+            int raw = value + 8192;
+            if (client->receive<FromUSB>(makeMessage(MIDI_PITCH_BEND, channel, raw & 0x7F, (raw >> 7) & 0x7F)))
+                client->io.onPitchBend(channel, value);
+            if (client->_onPitchBendHandler)
+                client->_onPitchBendHandler(channel, value);
+        }
+
+        // --- System Real-Time ---
+        template <bool FromUSB>
+        static void dispatchStart(void *context)
+        {
+            Client *client = static_cast<Client *>(context);
+            client->receive<FromUSB>(makeMessage(MIDI_START));
+            if (client->_onStartHandler)
+                client->_onStartHandler();
+        }
+
+        template <bool FromUSB>
+        static void dispatchStop(void *context)
+        {
+            Client *client = static_cast<Client *>(context);
+            client->receive<FromUSB>(makeMessage(MIDI_STOP));
+            if (client->_onStopHandler)
+                client->_onStopHandler();
+        }
+
+        template <bool FromUSB>
+        static void dispatchContinue(void *context)
+        {
+            Client *client = static_cast<Client *>(context);
+            client->receive<FromUSB>(makeMessage(MIDI_CONTINUE));
+            if (client->_onContinueHandler)
+                client->_onContinueHandler();
+        }
+
+        template <bool FromUSB>
+        static void dispatchClock(void *context)
+        {
+            Client *client = static_cast<Client *>(context);
+            client->receive<FromUSB>(makeMessage(MIDI_TIME_CLOCK));
+            if (client->_onClockHandler)
+                client->_onClockHandler();
+        }
+
+        // --- System Common ---
+        template <bool FromUSB>
+        static void dispatchSongPosition(void *context, uint16_t songPosition)
+        {
+            Client *client = static_cast<Client *>(context);
+            client->receive<FromUSB>(makeMessage(MIDI_SONG_POS_POINTER, 0, songPosition & 0x7F, (songPosition >> 7) & 0x7F));
+            if (client->_onSongPositionHandler)
+                client->_onSongPositionHandler(songPosition);
+        }
+
+        template <bool FromUSB>
+        static void dispatchSongSelect(void *context, byte songNumber)
+        {
+            Client *client = static_cast<Client *>(context);
+            client->receive<FromUSB>(makeMessage(MIDI_SONG_SELECT, 0, songNumber));
+            if (client->_onSongSelectHandler)
+                client->_onSongSelectHandler(songNumber);
+        }
+
+        // --- Routing ---
+        enum class SendResult : uint8_t
+        {
+            SENT,
+            PARTIAL, // some ESP-NOW peers got it, the others had no room, counted as sent
+            BUSY,    // destination can't take it right now, worth queueing
+            FAILED   // no peers, USB not mounted
+        };
+
+        static midi_message makeMessage(MidiStatus status, byte channel = 0, byte firstByte = 0, byte secondByte = 0)
+        {
+            midi_message msg;
+            msg.channel = channel;
+            msg.status = status;
+            msg.firstByte = firstByte;
+            msg.secondByte = secondByte;
+            return msg;
+        }
+
+        // Incoming MIDI: bridged to the other transport if routed, returns whether it goes to the IO.
+        // ESP-NOW handlers run in the WiFi task, so ESP-NOW -> USB only queues for loop().
+        template <bool FromUSB>
+        bool receive(const midi_message &msg)
+        {
+            route(FromUSB ? RouteId::USB_TO_ESPNOW : RouteId::ESPNOW_TO_USB, msg, FromUSB);
+
+            RouteId toIO = FromUSB ? RouteId::USB_TO_IO : RouteId::ESPNOW_TO_IO;
+            if (!_router.accepts(toIO, msg))
+                return false;
+            Router::count(_router.stats(toIO).forwarded);
+            return true;
+        }
+
+        // Send now if nothing is waiting on the route, queue otherwise or when the destination is busy.
+        // Returns false if the message could not be delivered or queued.
+        bool route(RouteId route, const midi_message &msg, bool sendNow = true)
+        {
+            if (!_router.accepts(route, msg))
+                return true;
+
+            RouteQueue &queue = _router.queue(route);
+            RouteStats &stats = _router.stats(route);
+            if (sendNow && queue.empty())
             {
-                Client::instancePtr->io.onNoteOn(channel, note, velocity);
-                if (Client::instancePtr->_onNoteOnHandler)
+                SendResult result = sendTo(route, msg);
+                if (result == SendResult::SENT || result == SendResult::PARTIAL)
                 {
-                    Client::instancePtr->_onNoteOnHandler(channel, note, velocity);
+                    Router::count(result == SendResult::SENT ? stats.forwarded : stats.partial);
+                    return true;
                 }
+                if (result == SendResult::FAILED)
+                    return false;
             }
+
+            if (!queue.push(msg))
+            {
+                Router::count(stats.dropped);
+                return false;
+            }
+            Router::count(stats.queued);
+            return true;
         }
 
-        static void handleNoteOffStatic(byte channel, byte note, byte velocity)
+        void drainRoutes()
         {
-            if (Client::instancePtr)
+            for (uint8_t i = 0; i < ROUTE_COUNT; i++)
             {
-                Client::instancePtr->io.onNoteOff(channel, note, velocity);
-                if (Client::instancePtr->_onNoteOffHandler)
-                    Client::instancePtr->_onNoteOffHandler(channel, note, velocity);
+                RouteId route = static_cast<RouteId>(i);
+                RouteQueue &queue = _router.queue(route);
+                midi_message msg;
+                while (queue.peek(msg))
+                {
+                    SendResult result = sendTo(route, msg);
+                    if (result == SendResult::BUSY)
+                        break;
+                    queue.pop();
+                    if (result == SendResult::SENT)
+                        Router::count(_router.stats(route).forwarded);
+                    else if (result == SendResult::PARTIAL)
+                        Router::count(_router.stats(route).partial);
+                }
             }
         }
 
-        static void handleControlChangeStatic(byte channel, byte control, byte value)
+        SendResult sendTo(RouteId route, const midi_message &msg)
         {
-            if (Client::instancePtr)
+            switch (route)
             {
-                Client::instancePtr->io.onControlChange(channel, control, value);
-                if (Client::instancePtr->_onControlChangeHandler)
-                    Client::instancePtr->_onControlChangeHandler(channel, control, value);
+            case RouteId::USB_TO_ESPNOW:
+            case RouteId::IO_TO_ESPNOW:
+                return sendESPNOW(msg);
+            case RouteId::ESPNOW_TO_USB:
+            case RouteId::IO_TO_USB:
+                return sendUSB(msg);
+            default:
+                return SendResult::FAILED; // IO routes never queue
             }
         }
 
-        static void handleProgramChangeStatic(byte channel, byte program)
+        SendResult sendESPNOW(const midi_message &msg)
         {
-            if (Client::instancePtr)
+            int reached = 0;
+            esp_err_t err = espnowMIDI.sendMessage(msg, &reached);
+            if (err == ESP_OK)
+                return SendResult::SENT;
+            if (reached > 0)
+                return SendResult::PARTIAL; // retrying would send it twice to the peers that got it
+            return err == ESP_ERR_ESPNOW_NO_MEM ? SendResult::BUSY : SendResult::FAILED;
+        }
+
+        SendResult sendUSB(const midi_message &msg)
+        {
+#ifdef HAS_USB_MIDI
+            if (!TinyUSBDevice.mounted())
+                return SendResult::FAILED;
+            if (!TinyUSBDevice.ready())
+                return SendResult::BUSY;
+
+            return _usbOut.send(msg) ? SendResult::SENT : SendResult::BUSY;
+#else
+            return SendResult::FAILED;
+#endif
+        }
+
+        // --- Scheduler tasks ---
+        void pollMIDI()
+        {
+#ifdef HAS_USB_MIDI
+            USBMIDI.read();
+#endif
+            drainRoutes();
+#ifdef HAS_USB_MIDI
+            _usbOut.poll();
+#endif
+        }
+
+        // Interrupt driven inputs: button edges and touches, and the matrix when it has velocity keys
+        void pollInputs()
+        {
+            io.pollEdges();
+            io.pollMatrix();
+            io.pollTouch();
+        }
+
+        void scanIO()
+        {
+            io.loop();
+        }
+
+        void updatePeers()
+        {
+            espnowMIDI.updatePeers();
+        }
+
+        void flushLog()
+        {
+            Log::flush(ENOMIK_LOG_FLUSH_PER_LOOP); // the log task only runs when nothing else does
+        }
+
+        void sendRoutes()
+        {
+            bool enabled[ROUTE_COUNT];
+            uint16_t channelMasks[ROUTE_COUNT];
+            for (uint8_t i = 0; i < ROUTE_COUNT; i++)
             {
-                Client::instancePtr->io.onProgramChange(channel, program);
-                if (Client::instancePtr->_onProgramChangeHandler)
-                    Client::instancePtr->_onProgramChangeHandler(channel, program);
+                enabled[i] = _router.get(i).enabled;
+                channelMasks[i] = _router.get(i).channelMask;
             }
+            SysExPacket pkt = SysExEncoder::encodeRoutes(enabled, channelMasks, ROUTE_COUNT);
+            sendSysEx(pkt.data, pkt.length);
+        }
+
+#ifdef HAS_USB_MIDI
+        // --- Static handlers for USB MIDI ---
+        static void handleNoteOnStatic(byte channel, byte note, byte velocity)
+        {
+            if (Client::instancePtr)
+                dispatchNoteOn<true>(Client::instancePtr, channel, note, velocity);
+        }
+
+        static void handleNoteOffStatic(byte channel, byte note, byte velocity)
+        {
+            if (Client::instancePtr)
+                dispatchNoteOff<true>(Client::instancePtr, channel, note, velocity);
+        }
+
+        static void handleControlChangeStatic(byte channel, byte control, byte value)
+        {
+            if (Client::instancePtr)
+                dispatchControlChange<true>(Client::instancePtr, channel, control, value);
+        }
+
+        static void handleProgramChangeStatic(byte channel, byte program)
+        {
+            if (Client::instancePtr)
+                dispatchProgramChange<true>(Client::instancePtr, channel, program);
         }
 
         static void handleAfterTouchChannelStatic(byte channel, byte pressure)
         {
             if (Client::instancePtr)
-            {
-                // Client::instancePtr->io.onAfterTouch(channel, pressure);
-                if (Client::instancePtr->_onAfterTouchChannelHandler)
-                    Client::instancePtr->_onAfterTouchChannelHandler(channel, pressure);
-            }
+                dispatchAfterTouchChannel<true>(Client::instancePtr, channel, pressure);
         }
 
         static void handleAfterTouchPolyStatic(byte channel, byte note, byte pressure)
         {
             if (Client::instancePtr)
-            {
-                // Client::instancePtr->io.onAfterTouchPoly(channel, note, pressure);
-                if (Client::instancePtr->_onAfterTouchPolyHandler)
-                    Client::instancePtr->_onAfterTouchPolyHandler(channel, note, pressure);
-            }
+                dispatchAfterTouchPoly<true>(Client::instancePtr, channel, note, pressure);
         }
 
         static void handlePitchBendStatic(byte channel, int value) // uint16_t
         {
             if (Client::instancePtr)
-            {
-                Client::instancePtr->io.onPitchBend(channel, value);
-                if (Client::instancePtr->_onPitchBendHandler)
-                    Client::instancePtr->_onPitchBendHandler(channel, value);
-            }
+                dispatchPitchBend<true>(Client::instancePtr, channel, value);
         }
 
-        // --- System Real-Time ---
         static void handleStartStatic()
         {
-            if (Client::instancePtr && Client::instancePtr->_onStartHandler)
-                Client::instancePtr->_onStartHandler();
+            if (Client::instancePtr)
+                dispatchStart<true>(Client::instancePtr);
         }
 
         static void handleStopStatic()
         {
-            if (Client::instancePtr && Client::instancePtr->_onStopHandler)
-                Client::instancePtr->_onStopHandler();
+            if (Client::instancePtr)
+                dispatchStop<true>(Client::instancePtr);
         }
 
         static void handleContinueStatic()
         {
-            if (Client::instancePtr && Client::instancePtr->_onContinueHandler)
-                Client::instancePtr->_onContinueHandler();
+            if (Client::instancePtr)
+                dispatchContinue<true>(Client::instancePtr);
         }
 
         static void handleClockStatic()
         {
-            if (Client::instancePtr && Client::instancePtr->_onClockHandler)
-                Client::instancePtr->_onClockHandler();
+            if (Client::instancePtr)
+                dispatchClock<true>(Client::instancePtr);
         }
 
-        // --- System Common ---
-        static void handleSongPositionStatic(uint16_t songPosition)
+        static void handleSongPositionStatic(unsigned songPosition)
         {
-            if (Client::instancePtr && Client::instancePtr->_onSongPositionHandler)
-                Client::instancePtr->_onSongPositionHandler(songPosition);
+            if (Client::instancePtr)
+                dispatchSongPosition<true>(Client::instancePtr, songPosition);
         }
 
         static void handleSongSelectStatic(byte songNumber)
         {
-            if (Client::instancePtr && Client::instancePtr->_onSongSelectHandler)
-                Client::instancePtr->_onSongSelectHandler(songNumber);
+            if (Client::instancePtr)
+                dispatchSongSelect<true>(Client::instancePtr, songNumber);
         }
 
         // --- System Exclusive ---
         static void handleSysExStatic(uint8_t *data, unsigned int length)
         {
             if (Client::instancePtr)
-            {
                 Client::instancePtr->onSystemExclusive(data, length);
-                if (Client::instancePtr->_onSysExHandler)
-                    Client::instancePtr->_onSysExHandler(data, length);
-            }
         }
+#endif
 
     public:
         static Client *instancePtr;
         esp_now_midi espnowMIDI;
         enomik::IO io;
+        // Sketches add their own periodic work here, e.g. scheduler.add("display", updateDisplay, 50000, 5000)
+        Scheduler scheduler;
 
         Client() : isInitialized(false)
         {
@@ -199,67 +481,10 @@ namespace enomik
 
         void begin()
         {
+            _router.begin();
             io.begin();
             io.setOnMIDISendRequest([this](midi_message msg)
-                                    {
-                                //send ESP-NOW MIDI
-                                // this->espnowMIDI.sendToAllPeers((uint8_t *)&msg, sizeof(msg));
-
-                                switch(msg.status) {
-                                    case MIDI_NOTE_ON:
-                                        sendNoteOn(msg.firstByte, msg.secondByte, msg.channel);
-                                        break;
-                                    case MIDI_NOTE_OFF:
-                                        sendNoteOff(msg.firstByte, msg.secondByte, msg.channel);
-                                        break;
-                                    case MIDI_CONTROL_CHANGE:
-                                        sendControlChange(msg.firstByte, msg.secondByte, msg.channel);
-                                        break;
-                                    case MIDI_PROGRAM_CHANGE:
-                                        sendProgramChange(msg.firstByte, msg.channel);
-                                        break;
-                                    case MIDI_PITCH_BEND:
-                                    {
-                                        int value = (msg.secondByte << 7) | msg.firstByte;
-                                        sendPitchBend(value, msg.channel);
-                                        break;
-                                    }
-                                    case MIDI_AFTERTOUCH:
-                                    {
-                                        sendAfterTouch(msg.firstByte, msg.channel);
-                                        break;
-                                    }
-                                    case MIDI_POLY_AFTERTOUCH:
-                                    {
-                                        sendPolyAfterTouch(msg.firstByte, msg.secondByte, msg.channel);
-                                        break;
-                                    }
-                                    case MIDI_START:
-                                        sendStart();
-                                        break;
-                                    case MIDI_STOP:
-                                        sendStop();
-                                        break;
-                                    case MIDI_CONTINUE:
-                                        sendContinue();
-                                        break;
-                                    case MIDI_TIME_CLOCK:
-                                        sendClock();
-                                        break;
-                                    case MIDI_TIME_CODE:
-                                        break;
-                                    case MIDI_SONG_POS_POINTER:
-                                    {
-                                        uint16_t songPos = (msg.secondByte << 7) | msg.firstByte;
-                                        sendSongPosition(songPos);
-                                        break;
-                                    }
-                                    case MIDI_SONG_SELECT:
-                                        sendSongSelect(msg.firstByte);
-                                        break;      
-                                    default:
-                                        Serial.println("Sent other MIDI message");
-                                } });
+                                    { this->send(msg); });
 
             // TODO: this should be part of the other handler
             io.setOnSysExSendRequest([this](midi_sysex_message msg)
@@ -267,43 +492,26 @@ namespace enomik
 
             io.setOnAddPeerRequest([this](uint8_t mac[])
                                    {
-                               Serial.println("IO requested to add peer:");
-                               macPrint(mac);
+                               ENOMIK_LOGD("IO requested to add peer " ENOMIK_LOG_MAC_FORMAT, ENOMIK_LOG_MAC_ARGS(mac));
                                if (this->espnowMIDI.addPeer(mac))
                                {
                                    // Store peer in persistent storage
                                    if (this->peerStorage.add(mac))
                                    {
-                                       Serial.println("Peer added and stored successfully");
+                                       ENOMIK_LOGI("Peer added and stored successfully");
                                    }
                                    else
                                    {
-                                       Serial.println("Failed to store peer");
+                                       ENOMIK_LOGE("Failed to store peer");
                                    }
                                }
                                else
                                {
-                                   Serial.println("Failed to add peer to ESP-NOW");
+                                   ENOMIK_LOGE("Failed to add peer to ESP-NOW");
                                } });
 
             io.setOnGetPeersRequest([this]()
                                     {
-        Serial.println("GET_PEERS request received");
-        
-        // Print peers
-        for (int i = 0; i < this->peerStorage.count(); i++)
-        {
-            const uint8_t *mac = this->peerStorage.get(i);
-            if (mac)
-            {
-                Serial.print("Peer ");
-                Serial.print(i);
-                Serial.print(": ");
-                macPrint(mac);
-                Serial.println();
-            }
-        } 
-        
         midi_sysex_message msg;
         msg.data[0] = 0xF0;
         msg.data[1] = 0x7D; // Manufacturer ID (non-commercial)
@@ -326,8 +534,7 @@ namespace enomik
         
         msg.data[index] = 0xF7;
         msg.length = index + 1;
-        Serial.println("Sending peer list via SysEx");
-        Serial.println("Total peers: " + String(this->peerStorage.count()));
+        ENOMIK_LOGD("Sending peer list via SysEx, %d peers", this->peerStorage.count());
         
         this->sendSysEx(msg.data, msg.length); });
 
@@ -335,12 +542,24 @@ namespace enomik
                                  {
                                      this->peerStorage.clear();
                                      this->espnowMIDI.clearPeers();
+                                     this->_router.reset();
 
                                      //  esp_now_deinit();
                                      //  delay(10);
                                      //  esp_now_init();
                                  });
 
+            io.setOnSetRouteRequest([this](uint8_t route, bool enabled, uint16_t channelMask)
+                                    {
+                                        if (!this->_router.set(route, enabled, channelMask))
+                                        {
+                                            ENOMIK_LOGW("Unknown route %d", route);
+                                        }
+                                        this->sendRoutes(); });
+
+            io.setOnGetRoutesRequest([this]()
+                                     { this->sendRoutes(); });
+
 #ifdef HAS_USB_MIDI
             // Initialize USB MIDI using global instance
             USBMIDI.begin(MIDI_CHANNEL_OMNI);
@@ -357,26 +576,27 @@ namespace enomik
                 TinyUSBDevice.attach();
             }
 
-            Serial.println("USB MIDI initialized");
+            ENOMIK_LOGI("USB MIDI initialized");
 #endif
 
             // Initialize ESP-NOW MIDI
             espnowMIDI.begin();
+            espnowMIDI.enableHeartbeat();
 
             // --- Set handlers for ESP-NOW ---
-            espnowMIDI.setHandleNoteOn(handleNoteOnStatic);
-            espnowMIDI.setHandleNoteOff(handleNoteOffStatic);
-            espnowMIDI.setHandleControlChange(handleControlChangeStatic);
-            espnowMIDI.setHandleProgramChange(handleProgramChangeStatic);
-            espnowMIDI.setHandleAfterTouchChannel(handleAfterTouchChannelStatic);
-            espnowMIDI.setHandleAfterTouchPoly(handleAfterTouchPolyStatic);
-            espnowMIDI.setHandlePitchBend(handlePitchBendStatic);
-            espnowMIDI.setHandleStart(handleStartStatic);
-            espnowMIDI.setHandleStop(handleStopStatic);
-            espnowMIDI.setHandleContinue(handleContinueStatic);
-            espnowMIDI.setHandleClock(handleClockStatic);
-            espnowMIDI.setHandleSongPosition(handleSongPositionStatic);
-            espnowMIDI.setHandleSongSelect(handleSongSelectStatic);
+            espnowMIDI.setHandleNoteOn(dispatchNoteOn<false>, this);
+            espnowMIDI.setHandleNoteOff(dispatchNoteOff<false>, this);
+            espnowMIDI.setHandleControlChange(dispatchControlChange<false>, this);
+            espnowMIDI.setHandleProgramChange(dispatchProgramChange<false>, this);
+            espnowMIDI.setHandleAfterTouchChannel(dispatchAfterTouchChannel<false>, this);
+            espnowMIDI.setHandleAfterTouchPoly(dispatchAfterTouchPoly<false>, this);
+            espnowMIDI.setHandlePitchBend(dispatchPitchBend<false>, this);
+            espnowMIDI.setHandleStart(dispatchStart<false>, this);
+            espnowMIDI.setHandleStop(dispatchStop<false>, this);
+            espnowMIDI.setHandleContinue(dispatchContinue<false>, this);
+            espnowMIDI.setHandleClock(dispatchClock<false>, this);
+            espnowMIDI.setHandleSongPosition(dispatchSongPosition<false>, this);
+            espnowMIDI.setHandleSongSelect(dispatchSongSelect<false>, this);
 
 #ifdef HAS_USB_MIDI
             // --- Set handlers for USB MIDI ---
@@ -392,17 +612,25 @@ namespace enomik
             USBMIDI.setHandleStop(handleStopStatic);
             USBMIDI.setHandleContinue(handleContinueStatic);
             USBMIDI.setHandleClock(handleClockStatic);
+            USBMIDI.setHandleSongPosition(handleSongPositionStatic);
             USBMIDI.setHandleSongSelect(handleSongSelectStatic);
 #endif
 
+            // MIDI I/O on every pass, everything else at a fixed rate
+            scheduler.add("midi", Callback<void()>::bind<Client, &Client::pollMIDI>(this), 0);
+            scheduler.add("inputs", Callback<void()>::bind<Client, &Client::pollInputs>(this), 0);
+            scheduler.add("io", Callback<void()>::bind<Client, &Client::scanIO>(this), IO_SCAN_PERIOD_US, IO_SCAN_PERIOD_US / 2);
+            scheduler.add("peers", Callback<void()>::bind<Client, &Client::updatePeers>(this), 100000, 1000);
+            scheduler.add("log", Callback<void()>::bind<Client, &Client::flushLog>(this), 10000, 1000);
+
             // Initialize peer storage (handles EEPROM internally)
             if (!peerStorage.begin())
             {
-                Serial.println("Failed to initialize peer storage");
+                ENOMIK_LOGE("Failed to initialize peer storage");
                 return;
             }
 
-            Serial.println("Restoring peers from storage...");
+            ENOMIK_LOGI("Restoring peers from storage...");
             int restoredCount = 0;
             int skippedCount = 0;
 
@@ -417,26 +645,23 @@ namespace enomik
                     {
                         if (espnowMIDI.addPeer(mac))
                         {
-                            Serial.print("Restored peer: ");
-                            Serial.println(macToString(mac));
+                            ENOMIK_LOGI("Restored peer: " ENOMIK_LOG_MAC_FORMAT, ENOMIK_LOG_MAC_ARGS(mac));
                             restoredCount++;
                         }
                         else
                         {
-                            Serial.print("Failed to restore peer: ");
-                            Serial.println(macToString(mac));
+                            ENOMIK_LOGE("Failed to restore peer: " ENOMIK_LOG_MAC_FORMAT, ENOMIK_LOG_MAC_ARGS(mac));
                         }
                     }
                     else
                     {
-                        Serial.print("Peer already exists, skipping: ");
-                        Serial.println(macToString(mac));
+                        ENOMIK_LOGD("Peer already exists, skipping: " ENOMIK_LOG_MAC_FORMAT, ENOMIK_LOG_MAC_ARGS(mac));
                         skippedCount++;
                     }
                 }
             }
 
-            Serial.printf("Peer restoration complete: %d restored, %d skipped\n",
+            ENOMIK_LOGI("Peer restoration complete: %d restored, %d skipped",
                           restoredCount, skippedCount);
 
             isInitialized = true;
@@ -445,220 +670,94 @@ namespace enomik
 
         void loop()
         {
-#ifdef HAS_USB_MIDI
-            USBMIDI.read();
-#endif
-            io.loop();
+            scheduler.run();
         }
 
-        bool sendNoteOn(byte note, byte velocity, byte channel)
+        // Local traffic (IO and the send* calls) goes IO -> ESP-NOW and IO -> USB.
+        // Returns false if ESP-NOW failed.
+        bool send(const midi_message &msg)
         {
-            auto err = espnowMIDI.sendNoteOn(note, velocity, channel);
-            espnowMIDI.printPeers();
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
+            bool ok = route(RouteId::IO_TO_ESPNOW, msg);
+            route(RouteId::IO_TO_USB, msg);
+            return ok;
+        }
 
-                USBMIDI.sendNoteOn(note, velocity, channel);
-            }
+        void printRoutes()
+        {
+            _router.printStats(Serial);
+        }
+
+#ifdef HAS_USB_MIDI
+        void printUSBStats()
+        {
+            _usbOut.printStats(Serial);
+        }
 #endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+
+        bool sendNoteOn(byte note, byte velocity, byte channel)
+        {
+            return send(makeMessage(MIDI_NOTE_ON, channel, note, velocity));
         }
 
         bool sendNoteOff(byte note, byte velocity, byte channel)
         {
-            auto err = espnowMIDI.sendNoteOff(note, velocity, channel);
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
-                USBMIDI.sendNoteOff(note, velocity, channel);
-            }
-#endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+            return send(makeMessage(MIDI_NOTE_OFF, channel, note, velocity));
         }
 
         bool sendControlChange(byte control, byte value, byte channel)
         {
-            auto err = espnowMIDI.sendControlChange(control, value, channel);
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
-                USBMIDI.sendControlChange(control, value, channel);
-            }
-#endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+            return send(makeMessage(MIDI_CONTROL_CHANGE, channel, control, value));
         }
 
         bool sendProgramChange(byte program, byte channel)
         {
-            auto err = espnowMIDI.sendProgramChange(program, channel);
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
-                USBMIDI.sendProgramChange(program, channel);
-            }
-#endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+            return send(makeMessage(MIDI_PROGRAM_CHANGE, channel, program));
         }
 
         bool sendAfterTouch(byte pressure, byte channel)
         {
-            auto err = espnowMIDI.sendAfterTouch(pressure, channel);
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
-                USBMIDI.sendAfterTouch(pressure, channel);
-            }
-#endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+            return send(makeMessage(MIDI_AFTERTOUCH, channel, pressure));
         }
 
         bool sendPolyAfterTouch(byte note, byte pressure, byte channel)
         {
-            auto err = espnowMIDI.sendAfterTouchPoly(note, pressure, channel);
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
-                USBMIDI.sendAfterTouch(note, pressure, channel);
-            }
-#endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+            return send(makeMessage(MIDI_POLY_AFTERTOUCH, channel, note, pressure));
         }
 
-        bool sendPitchBend(int value, byte channel) // uint16_t
+        bool sendPitchBend(int value, byte channel) // signed, -8192..8191
         {
-            auto err = espnowMIDI.sendPitchBend(value, channel);
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
-                USBMIDI.sendPitchBend(value, channel);
-            }
-#endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+            value = constrain(value, -8192, 8191) + 8192;
+            return send(makeMessage(MIDI_PITCH_BEND, channel, value & 0x7F, (value >> 7) & 0x7F));
         }
 
         bool sendStart()
         {
-            auto err = espnowMIDI.sendStart();
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
-                USBMIDI.sendStart();
-            }
-#endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+            return send(makeMessage(MIDI_START));
         }
 
         bool sendStop()
         {
-            auto err = espnowMIDI.sendStop();
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
-                USBMIDI.sendStop();
-            }
-#endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+            return send(makeMessage(MIDI_STOP));
         }
 
         bool sendContinue()
         {
-            auto err = espnowMIDI.sendContinue();
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
-                USBMIDI.sendContinue();
-            }
-#endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+            return send(makeMessage(MIDI_CONTINUE));
         }
 
         bool sendClock()
         {
-            auto err = espnowMIDI.sendClock();
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
-                USBMIDI.sendClock();
-            }
-#endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+            return send(makeMessage(MIDI_TIME_CLOCK));
         }
 
         bool sendSongPosition(uint16_t value)
         {
-            auto err = espnowMIDI.sendSongPosition(value);
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
-                USBMIDI.sendSongPosition(value);
-            }
-#endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+            return send(makeMessage(MIDI_SONG_POS_POINTER, 0, value & 0x7F, (value >> 7) & 0x7F));
         }
 
         bool sendSongSelect(uint8_t value)
         {
-            auto err = espnowMIDI.sendSongSelect(value);
-#ifdef HAS_USB_MIDI
-            if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
-            {
-                USBMIDI.sendSongSelect(value);
-            }
-#endif
-            if (err != ESP_OK)
-            {
-                return false; // ESP-NOW failed
-            }
-            return true;
+            return send(makeMessage(MIDI_SONG_SELECT, 0, value));
         }
 
         bool sendSysEx(const uint8_t *data, uint16_t length)
@@ -667,7 +766,7 @@ namespace enomik
 #ifdef HAS_USB_MIDI
             if (TinyUSBDevice.mounted() && TinyUSBDevice.ready())
             {
-                USBMIDI.sendSysEx(length, data);
+                _usbOut.sendSysEx(data, length);
             }
 #endif
             if (err != ESP_OK)
@@ -677,107 +776,179 @@ namespace enomik
             return true;
         }
         // --- Channel Voice ---
-        void setHandleNoteOn(std::function<void(byte channel, byte note, byte velocity)> handler)
+        // Function pointers and captureless lambdas are called directly, handler + context avoids
+        // std::function for stateful handlers, capturing lambdas and std::function still work
+        template <typename Handler>
+        void setHandleNoteOn(Handler &&handler)
+        {
+            _onNoteOnHandler = Callback<void(byte channel, byte note, byte velocity)>(std::forward<Handler>(handler));
+        }
+
+        void setHandleNoteOn(void (*handler)(void *context, byte channel, byte note, byte velocity), void *context)
+        {
+            _onNoteOnHandler = {handler, context};
+        }
+
+        template <typename Handler>
+        void setHandleNoteOff(Handler &&handler)
         {
-            _onNoteOnHandler = handler;
+            _onNoteOffHandler = Callback<void(byte channel, byte note, byte velocity)>(std::forward<Handler>(handler));
         }
 
-        void setHandleNoteOff(std::function<void(byte channel, byte note, byte velocity)> handler)
+        void setHandleNoteOff(void (*handler)(void *context, byte channel, byte note, byte velocity), void *context)
         {
-            _onNoteOffHandler = handler;
+            _onNoteOffHandler = {handler, context};
         }
 
-        void setHandleControlChange(std::function<void(byte channel, byte control, byte value)> handler)
+        template <typename Handler>
+        void setHandleControlChange(Handler &&handler)
         {
-            _onControlChangeHandler = handler;
+            _onControlChangeHandler = Callback<void(byte channel, byte control, byte value)>(std::forward<Handler>(handler));
         }
 
-        void setHandleProgramChange(std::function<void(byte channel, byte program)> handler)
+        void setHandleControlChange(void (*handler)(void *context, byte channel, byte control, byte value), void *context)
         {
-            _onProgramChangeHandler = handler;
+            _onControlChangeHandler = {handler, context};
         }
 
-        void setHandleAfterTouchChannel(std::function<void(byte channel, byte pressure)> handler)
+        template <typename Handler>
+        void setHandleProgramChange(Handler &&handler)
         {
-            _onAfterTouchChannelHandler = handler;
+            _onProgramChangeHandler = Callback<void(byte channel, byte program)>(std::forward<Handler>(handler));
         }
 
-        void setHandleAfterTouchPoly(std::function<void(byte channel, byte note, byte pressure)> handler)
+        void setHandleProgramChange(void (*handler)(void *context, byte channel, byte program), void *context)
         {
-            _onAfterTouchPolyHandler = handler;
+            _onProgramChangeHandler = {handler, context};
         }
 
-        void setHandlePitchBend(std::function<void(byte channel, int value)> handler) // uint16_t
+        template <typename Handler>
+        void setHandleAfterTouchChannel(Handler &&handler)
         {
-            _onPitchBendHandler = handler;
+            _onAfterTouchChannelHandler = Callback<void(byte channel, byte pressure)>(std::forward<Handler>(handler));
+        }
+
+        void setHandleAfterTouchChannel(void (*handler)(void *context, byte channel, byte pressure), void *context)
+        {
+            _onAfterTouchChannelHandler = {handler, context};
+        }
+
+        template <typename Handler>
+        void setHandleAfterTouchPoly(Handler &&handler)
+        {
+            _onAfterTouchPolyHandler = Callback<void(byte channel, byte note, byte pressure)>(std::forward<Handler>(handler));
+        }
+
+        void setHandleAfterTouchPoly(void (*handler)(void *context, byte channel, byte note, byte pressure), void *context)
+        {
+            _onAfterTouchPolyHandler = {handler, context};
+        }
+
+        template <typename Handler>
+        void setHandlePitchBend(Handler &&handler) // uint16_t
+        {
+            _onPitchBendHandler = Callback<void(byte channel, int value)>(std::forward<Handler>(handler));
+        }
+
+        void setHandlePitchBend(void (*handler)(void *context, byte channel, int value), void *context)
+        {
+            _onPitchBendHandler = {handler, context};
         }
 
         // --- System Real-Time ---
-        void setHandleStart(std::function<void()> handler)
+        template <typename Handler>
+        void setHandleStart(Handler &&handler)
+        {
+            _onStartHandler = Callback<void()>(std::forward<Handler>(handler));
+        }
+
+        void setHandleStart(void (*handler)(void *context), void *context)
+        {
+            _onStartHandler = {handler, context};
+        }
+
+        template <typename Handler>
+        void setHandleStop(Handler &&handler)
+        {
+            _onStopHandler = Callback<void()>(std::forward<Handler>(handler));
+        }
+
+        void setHandleStop(void (*handler)(void *context), void *context)
+        {
+            _onStopHandler = {handler, context};
+        }
+
+        template <typename Handler>
+        void setHandleContinue(Handler &&handler)
         {
-            _onStartHandler = handler;
+            _onContinueHandler = Callback<void()>(std::forward<Handler>(handler));
         }
 
-        void setHandleStop(std::function<void()> handler)
+        void setHandleContinue(void (*handler)(void *context), void *context)
         {
-            _onStopHandler = handler;
+            _onContinueHandler = {handler, context};
         }
 
-        void setHandleContinue(std::function<void()> handler)
+        template <typename Handler>
+        void setHandleClock(Handler &&handler)
         {
-            _onContinueHandler = handler;
+            _onClockHandler = Callback<void()>(std::forward<Handler>(handler));
         }
 
-        void setHandleClock(std::function<void()> handler)
+        void setHandleClock(void (*handler)(void *context), void *context)
         {
-            _onClockHandler = handler;
+            _onClockHandler = {handler, context};
         }
 
         // --- System Common ---
-        void setHandleSongPosition(std::function<void(uint16_t songPosition)> handler)
+        template <typename Handler>
+        void setHandleSongPosition(Handler &&handler)
+        {
+            _onSongPositionHandler = Callback<void(uint16_t songPosition)>(std::forward<Handler>(handler));
+        }
+
+        void setHandleSongPosition(void (*handler)(void *context, uint16_t songPosition), void *context)
+        {
+            _onSongPositionHandler = {handler, context};
+        }
+
+        template <typename Handler>
+        void setHandleSongSelect(Handler &&handler)
         {
-            _onSongPositionHandler = handler;
+            _onSongSelectHandler = Callback<void(byte songNumber)>(std::forward<Handler>(handler));
         }
 
-        void setHandleSongSelect(std::function<void(byte songNumber)> handler)
+        void setHandleSongSelect(void (*handler)(void *context, byte songNumber), void *context)
         {
-            _onSongSelectHandler = handler;
+            _onSongSelectHandler = {handler, context};
         }
 
         // --- System Exclusive ---
-        void setHandleSysEx(std::function<void(uint8_t *data, unsigned int length)> handler)
+        template <typename Handler>
+        void setHandleSysEx(Handler &&handler)
         {
-            _onSysExHandler = handler;
+            _onSysExHandler = Callback<void(uint8_t *data, unsigned int length)>(std::forward<Handler>(handler));
+        }
+
+        void setHandleSysEx(void (*handler)(void *context, uint8_t *data, unsigned int length), void *context)
+        {
+            _onSysExHandler = {handler, context};
         }
 
         void sendHandShake()
         {
             if (!isInitialized)
             {
-                Serial.println("Client not initialized. Cannot send handshake.");
+                ENOMIK_LOGW("Client not initialized. Cannot send handshake.");
                 return;
             }
-            // TODO: refactor to use sysex instead of control change
-            // also add a heartbeat mechanism
-
-            byte channel = 16;
-            byte control = 127;
-            byte value = 127;
-
+            // Announce ourselves with a heartbeat, receivers register us through auto discovery
             for (int i = 0; i < peerStorage.count(); i++)
             {
                 const uint8_t *mac = peerStorage.get(i);
-                if (mac)
+                if (mac && espnowMIDI.sendControlFrame(mac, CONTROL_HEARTBEAT, nullptr, 0) != ESP_OK)
                 {
-                    bool ok = espnowMIDI.sendControlChange(control, value, channel);
-                    if (ok)
-                    {
-                    }
-                    else
-                    {
-                        Serial.print("Failed to send handshake to: ");
-                        Serial.println(macToString(mac));
-                    }
+                    ENOMIK_LOGW("Failed to send handshake to: " ENOMIK_LOG_MAC_FORMAT, ENOMIK_LOG_MAC_ARGS(mac));
                 }
             }
         }
@@ -787,7 +958,7 @@ namespace enomik
         {
             if (!isInitialized)
             {
-                Serial.println("Client not initialized. Call begin() first.");
+                ENOMIK_LOGW("Client not initialized. Call begin() first.");
                 return false;
             }
 
@@ -800,7 +971,7 @@ namespace enomik
             // Then add to ESP-NOW
             if (!espnowMIDI.addPeer(mac))
             {
-                Serial.println("Failed to add peer to ESP-NOW");
+                ENOMIK_LOGE("Failed to add peer to ESP-NOW");
                 // Rollback storage change
                 peerStorage.remove(mac);
                 return false;
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <soc/soc.h>
+#include <soc/gpio_reg.h>
+#include "./utils/log.h"
+#include "./utils/ring.h"
+#include "./utils/gpio.h"
+
+// Interrupt driven digital inputs.
+// Every edge on an attached pin is timestamped in the GPIO interrupt and pushed as (pin, level, µs)
+// into a single producer, single consumer ring, poll() drains it on every loop pass. Debouncing is
+// eager: the first edge is reported right away, further edges are ignored for ENOMIK_EDGE_DEBOUNCE_US,
+// then the pin is read once more and a change that happened meanwhile (a press shorter than the
+// window) is reported as well. Idle pins cost nothing, neither in the interrupt nor in poll().
+// Levels are kept as 64 bit masks, one bit per GPIO. scan() reads the GPIO input registers once and
+// XORs them against the reported levels, which catches edges the queue lost, or, with
+// ENOMIK_EDGE_INTERRUPTS 0, replaces the interrupts altogether.
+
+#ifndef ENOMIK_EDGE_QUEUE_SIZE
+#define ENOMIK_EDGE_QUEUE_SIZE 64 // edges, must be a power of two
+#endif
+#ifndef ENOMIK_EDGE_DEBOUNCE_US
+#define ENOMIK_EDGE_DEBOUNCE_US 4000
+#endif
+#ifndef ENOMIK_EDGE_INTERRUPTS
+#define ENOMIK_EDGE_INTERRUPTS 1 // 0: scan() only, no GPIO interrupts
+#endif
+#define ENOMIK_EDGE_MAX_PINS 64
+
+namespace enomik
+{
+    struct Edge
+    {
+        uint8_t pin;
+        uint8_t level;
+        uint32_t us; // esp_timer_get_time() in the interrupt
+    };
+
+    struct EdgeStats
+    {
+        uint32_t edges = 0;        // taken by the interrupt
+        uint32_t reported = 0;     // level changes passed on after debouncing
+        uint32_t bounces = 0;      // edges ignored inside a debounce window
+        uint32_t overflows = 0;    // edges lost to a full queue
+        uint32_t scanned = 0;      // changes found by scan() instead of the interrupt
+        uint32_t maxLatencyUs = 0; // edge until poll() reported it
+        uint64_t totalLatencyUs = 0;
+    };
+
+    class EdgeCapture
+    {
+    public:
+        // Starts watching pin, its current level is reported on the next poll()
+        bool attach(uint8_t pin)
+        {
+            if (pin >= ENOMIK_EDGE_MAX_PINS)
+                return false;
+            _instance = this;
+            uint64_t bit = 1ULL << pin;
+            if (_attached & bit)
+                return true;
+            _settled = readLevel(pin) ? _settled | bit : _settled & ~bit;
+            _lockedUntilUs[pin] = 0;
+            _attached |= bit;
+            _initial |= bit; // the first level always goes out
+#if ENOMIK_EDGE_INTERRUPTS
+            attachInterruptArg(digitalPinToInterrupt(pin), onEdge, (void *)(uintptr_t)pin, CHANGE);
+#endif
+            return true;
+        }
+
+        void detach(uint8_t pin)
+        {
+            if (pin >= ENOMIK_EDGE_MAX_PINS || !(_attached & (1ULL << pin)))
+                return;
+#if ENOMIK_EDGE_INTERRUPTS
+            detachInterrupt(digitalPinToInterrupt(pin));
+#endif
+            _attached &= ~(1ULL << pin);
+            _locked &= ~(1ULL << pin);
+            _initial &= ~(1ULL << pin);
+        }
+
+        inline bool isAttached(uint8_t pin) const
+        {
+            return pin < ENOMIK_EDGE_MAX_PINS && (_attached & (1ULL << pin));
+        }
+
+        uint64_t getAttached() const
+        {
+            return _attached;
+        }
+
+        // Call on every loop pass. report(uint8_t pin, uint8_t level, uint32_t edgeUs) is called for
+        // every debounced level change, edgeUs is when it happened
+        template <typename Report>
+        inline void poll(Report report)
+        {
+            foldInterruptCounts();
+            if (_queue.empty() && !_locked && !_initial)
+                return;
+
+            uint32_t now = esp_timer_get_time();
+            if (_initial)
+            {
+                uint64_t port = readGpioInputs();
+                while (_initial)
+                {
+                    uint8_t pin = __builtin_ctzll(_initial);
+                    _initial &= _initial - 1;
+                    emit(pin, (port >> pin) & 1, now, now, report);
+                }
+            }
+            Edge edge;
+            while (_queue.pop(edge))
+            {
+                uint64_t bit = 1ULL << edge.pin;
+                if (!(_attached & bit))
+                    continue; // detached meanwhile
+                if ((_locked & bit) && (int32_t)(edge.us - _lockedUntilUs[edge.pin]) >= 0)
+                    settle(edge.pin, (_settled >> edge.pin) & 1, now, report); // the window ended before this edge
+                _settled = edge.level ? _settled | bit : _settled & ~bit;
+                if (_locked & bit)
+                {
+                    // Keep when the level first left the reported one, velocity keys time from it
+                    if (edge.level == ((_levels >> edge.pin) & 1))
+                        _held &= ~bit;
+                    else if (!(_held & bit))
+                    {
+                        _held |= bit;
+                        _heldUs[edge.pin] = edge.us;
+                    }
+                    _stats.bounces++;
+                    continue;
+                }
+                if (edge.level == ((_levels >> edge.pin) & 1))
+                    continue; // the other half of a bounce that ended before the window
+                emit(edge.pin, edge.level, edge.us, now, report);
+            }
+
+            // Windows that ran out
+            uint64_t locked = _locked;
+            uint64_t port = locked ? readGpioInputs() : 0;
+            while (locked)
+            {
+                uint8_t pin = __builtin_ctzll(locked);
+                locked &= locked - 1;
+                if ((int32_t)(now - _lockedUntilUs[pin]) >= 0)
+                    settle(pin, (port >> pin) & 1, now, report);
+            }
+        }
+
+        // Call at a fixed rate, after or instead of poll(): one read of the input registers, and only
+        // pins whose level differs from the reported one are touched
+        template <typename Report>
+        inline void scan(Report report)
+        {
+            poll(report);
+            uint64_t changed = (readGpioInputs() ^ _levels) & _attached & ~_locked;
+            if (!changed)
+                return;
+            uint32_t now = esp_timer_get_time();
+            while (changed)
+            {
+                uint8_t pin = __builtin_ctzll(changed);
+                changed &= changed - 1;
+                uint64_t bit = 1ULL << pin;
+                uint8_t level = (_levels & bit) ? 0 : 1;
+                _settled = level ? _settled | bit : _settled & ~bit;
+                _stats.scanned++;
+                emit(pin, level, now, now, report);
+            }
+        }
+
+        const EdgeStats &getStats() const
+        {
+            return _stats;
+        }
+
+        void resetStats()
+        {
+            _stats = EdgeStats();
+            _edgesAtReset = _interruptEdges;
+            _overflowsAtReset = _interruptOverflows;
+        }
+
+        void printStats(Print &out) const
+        {
+            out.println("=== Digital input edges ===");
+            out.printf("pins %d | edges %u, reported %u, bounces %u, overflows %u, scanned %u\n",
+                       __builtin_popcountll(_attached), _stats.edges, _stats.reported, _stats.bounces, _stats.overflows,
+                       _stats.scanned);
+            out.printf("edge to report us: avg %u, max %u\n",
+                       _stats.reported ? (unsigned)(_stats.totalLatencyUs / _stats.reported) : 0, _stats.maxLatencyUs);
+            out.println("===========================");
+        }
+
+    private:
+        static EdgeCapture *_instance; // interrupt argument is the pin, there is one GPIO matrix anyway
+        SpscRing<Edge, ENOMIK_EDGE_QUEUE_SIZE> _queue; // the interrupt pushes, poll() pops
+        uint64_t _attached = 0;
+        uint64_t _locked = 0;  // pins inside a debounce window
+        uint64_t _initial = 0; // attached, current level not reported yet
+        uint64_t _levels = 0;  // as reported
+        uint64_t _settled = 0; // level of the newest edge
+        uint64_t _held = 0;    // locked pins whose level left the reported one, at _heldUs
+        uint32_t _lockedUntilUs[ENOMIK_EDGE_MAX_PINS];
+        uint32_t _heldUs[ENOMIK_EDGE_MAX_PINS];
+        EdgeStats _stats;
+        // Counted by the interrupt only and folded into _stats by poll(), no read-modify-write is shared
+        volatile uint32_t _interruptEdges = 0;
+        volatile uint32_t _interruptOverflows = 0;
+        uint32_t _edgesAtReset = 0;
+        uint32_t _overflowsAtReset = 0;
+
+        inline void foldInterruptCounts()
+        {
+            _stats.edges = _interruptEdges - _edgesAtReset;
+            _stats.overflows = _interruptOverflows - _overflowsAtReset;
+        }
+
+        static inline uint8_t IRAM_ATTR readLevel(uint8_t pin)
+        {
+#if SOC_GPIO_PIN_COUNT > 32
+            if (pin >= 32)
+                return (REG_READ(GPIO_IN1_REG) >> (pin - 32)) & 1;
+#endif
+            return (REG_READ(GPIO_IN_REG) >> pin) & 1;
+        }
+
+        static void IRAM_ATTR onEdge(void *arg)
+        {
+            if (!_instance)
+                return;
+            uint8_t pin = (uint8_t)(uintptr_t)arg;
+            _instance->_interruptEdges++;
+            if (!_instance->_queue.push({pin, readLevel(pin), (uint32_t)esp_timer_get_time()}))
+                _instance->_interruptOverflows++;
+        }
+
+        // End of a debounce window: a press or release that happened inside it goes out now, stamped
+        // with its edge if one was seen
+        template <typename Report>
+        inline void settle(uint8_t pin, uint8_t level, uint32_t now, Report &report)
+        {
+            _locked &= ~(1ULL << pin);
+            if (level != ((_levels >> pin) & 1))
+                emit(pin, level, (_held >> pin) & 1 ? _heldUs[pin] : _lockedUntilUs[pin], now, report);
+        }
+
+        template <typename Report>
+        inline void emit(uint8_t pin, uint8_t level, uint32_t edgeUs, uint32_t now, Report &report)
+        {
+            _levels = level ? _levels | (1ULL << pin) : _levels & ~(1ULL << pin);
+            _held &= ~(1ULL << pin);
+            _locked |= 1ULL << pin;
+            _lockedUntilUs[pin] = now + ENOMIK_EDGE_DEBOUNCE_US; // from the report, a late settle can't shorten it
+            uint32_t latency = now - edgeUs;
+            _stats.reported++;
+            _stats.totalLatencyUs += latency;
+            if (latency > _stats.maxLatencyUs)
+                _stats.maxLatencyUs = latency;
+            report(pin, level, edgeUs);
+        }
+    };
+
+    EdgeCapture *EdgeCapture::_instance = nullptr;
+}
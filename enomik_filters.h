@@ -0,0 +1,151 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Fixed-point smoothing for analog and touch inputs, one Filter per pin, selected by PinConfig::filter.
+// Samples are integers in the sensor's raw units (ADC counts, touch readings), the state is kept with
+// 8 fractional bits. The parameter is 7 bit so it fits a SysEx byte, 0 picks the default.
+
+#ifndef ENOMIK_FILTER_MEDIAN_MAX
+#define ENOMIK_FILTER_MEDIAN_MAX 7
+#endif
+#define ENOMIK_FILTER_ONE_EURO_MIN_ALPHA 8 // of 256, smoothing while the input is still
+
+namespace enomik
+{
+    enum FilterType : uint8_t
+    {
+        FILTER_EWMA = 0,      // param: alpha in 1/128, default 38 (0.3, the previous float smoothing)
+        FILTER_NONE = 1,      // raw samples
+        FILTER_ONE_EURO = 2,  // EWMA that opens up with speed, param: beta, default 20
+        FILTER_MEDIAN = 3,    // median of the last param samples, 3 to ENOMIK_FILTER_MEDIAN_MAX, default 5
+        FILTER_DEADBAND = 4,  // hysteresis, follows only once the input moves more than param counts, default 16
+        FILTER_TYPES
+    };
+
+    class Filter
+    {
+    public:
+        static uint8_t defaultParam(uint8_t type)
+        {
+            switch (type)
+            {
+            case FILTER_EWMA:
+                return 38;
+            case FILTER_ONE_EURO:
+                return 20;
+            case FILTER_MEDIAN:
+                return 5;
+            case FILTER_DEADBAND:
+                return 16;
+            default:
+                return 0;
+            }
+        }
+
+        // Resets the filter when type or param change
+        void configure(uint8_t type, uint8_t param)
+        {
+            type = type < FILTER_TYPES ? type : (uint8_t)FILTER_EWMA;
+            param = param ? param & 0x7F : defaultParam(type);
+            if (type == FILTER_MEDIAN)
+                param = param < 3 ? 3 : param > ENOMIK_FILTER_MEDIAN_MAX ? ENOMIK_FILTER_MEDIAN_MAX : param;
+            if (type == _type && param == _param)
+                return;
+            _type = type;
+            _param = param;
+            reset();
+        }
+
+        void reset()
+        {
+            _primed = false;
+            _count = 0;
+            _head = 0;
+            _speed = 0;
+        }
+
+        uint8_t type() const
+        {
+            return _type;
+        }
+
+        uint8_t param() const
+        {
+            return _param;
+        }
+
+        // Takes a sample, returns the filtered value in the same units
+        inline int32_t update(int32_t x)
+        {
+            if (!_primed && _type != FILTER_MEDIAN)
+            {
+                _y = x << 8;
+                _primed = true;
+                return x;
+            }
+            switch (_type)
+            {
+            case FILTER_NONE:
+                _y = x << 8;
+                break;
+
+            case FILTER_EWMA:
+                _y += (int32_t)(((int64_t)((x << 8) - _y) * _param) >> 7);
+                break;
+
+            case FILTER_ONE_EURO:
+            {
+                // Speed is a slow average of the distance to the output, alpha grows with it
+                int32_t d = (x << 8) - _y;
+                _speed += ((d < 0 ? -d : d) - _speed) >> 3;
+                int32_t alpha = ENOMIK_FILTER_ONE_EURO_MIN_ALPHA + (int32_t)(((int64_t)_speed * _param) >> 12);
+                if (alpha > 256)
+                    alpha = 256;
+                _y += (int32_t)(((int64_t)d * alpha) >> 8);
+                break;
+            }
+
+            case FILTER_MEDIAN:
+            {
+                _window[_head] = x;
+                _head = _head + 1 < _param ? _head + 1 : 0;
+                if (_count < _param)
+                    _count++;
+                int32_t sorted[ENOMIK_FILTER_MEDIAN_MAX];
+                for (uint8_t i = 0; i < _count; i++)
+                {
+                    int32_t value = _window[i];
+                    uint8_t j = i;
+                    for (; j > 0 && sorted[j - 1] > value; j--)
+                        sorted[j] = sorted[j - 1];
+                    sorted[j] = value;
+                }
+                _y = sorted[_count / 2] << 8;
+                break;
+            }
+
+            case FILTER_DEADBAND:
+            {
+                int32_t y = _y >> 8;
+                if (x > y + _param)
+                    _y = (x - _param) << 8;
+                else if (x < y - _param)
+                    _y = (x + _param) << 8;
+                break;
+            }
+            }
+            return (_y + 128) >> 8;
+        }
+
+    private:
+        uint8_t _type = FILTER_EWMA;
+        uint8_t _param = 38;
+        bool _primed = false;
+        uint8_t _count = 0;
+        uint8_t _head = 0;
+        int32_t _y = 0;     // output, 8 fractional bits
+        int32_t _speed = 0; // one-euro
+        int32_t _window[ENOMIK_FILTER_MEDIAN_MAX];
+    };
+}
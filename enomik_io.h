@@ -1,11 +1,19 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
-#include <Preferences.h>
 #include "esp_now_midi.h"
 #include "utils/mac.h"
 #include "enomik_sysex.h"
 #include "./enomik_pinconfig.h"
+#include "./enomik_analog.h"
+#include "./enomik_filters.h"
+#include "./enomik_edges.h"
+#include "./enomik_touch.h"
+#include "./enomik_pinstore.h"
+#include "./enomik_outputs.h"
+#include "./enomik_velocity.h"
+#include "./enomik_scanner.h"
 
 // Detect ESP32 variant and set ADC resolution
 #if defined(CONFIG_IDF_TARGET_ESP32S2) || defined(CONFIG_IDF_TARGET_ESP32S3)
@@ -31,14 +39,21 @@ namespace enomik
     static constexpr uint8_t ENOMIK_ANALOG_INPUT = 0x03;
     static constexpr uint8_t ENOMIK_ANALOG_OUTPUT = 0x04;
     static constexpr uint8_t ENOMIK_INPUT_TOUCH = 0x05;
+    static constexpr uint8_t ENOMIK_INPUT_VELOCITY = 0x06; // two contacts, pin and contact_pin, pulled up
+    // Scanned inputs, pin is the channel on the bus, see enomik_scanner.h
+    static constexpr uint8_t ENOMIK_INPUT_MUX = 0x07;
+    static constexpr uint8_t ENOMIK_INPUT_SHIFT = 0x08;
+    static constexpr uint8_t ENOMIK_INPUT_MATRIX = 0x09;
+    static constexpr uint8_t ENOMIK_INPUT_MATRIX_VELOCITY = 0x0A; // two contacts, matrix channels pin and contact_pin
 
     struct PinState
     {
         int lastValue = -1;
         unsigned long lastChangeTime = 0;
         unsigned long lastSendTime = 0;
-        float smoothedValue = 0;
+        Filter filter; // configured from PinConfig::filter
         bool touched = false;
+        uint32_t contactUs = 0; // velocity keys: when the first contact closed, 0 while open
     };
 
     class IO
@@ -47,12 +62,11 @@ namespace enomik
         static constexpr unsigned long DEBOUNCE_MS = 4;
         static constexpr int ANALOG_THRESHOLD = 2;
         static constexpr unsigned long ANALOG_MIN_INTERVAL = 5;
-        static constexpr float SMOOTHING_FACTOR = 0.3f;
 
         void begin()
         {
             analogReadResolution(ADC_RESOLUTION);
-            _pinConfigs = loadPinConfigsFromPrefs();
+            _pinConfigs = _store.load();
             _pinStates.clear();
 
             for (const auto &config : _pinConfigs)
@@ -60,110 +74,171 @@ namespace enomik
                 initializePinHardware(config);
                 _pinStates.push_back(PinState());
             }
+            pinConfigsChanged();
 
             setupSysExHandlers();
         }
 
+        // The pin scan: digital inputs with one read of the GPIO input registers, then only the pins that
+        // have to be polled, grouped by mode. Outputs and interrupt driven touch pins aren't visited
         void loop()
         {
             unsigned long now = millis();
-
-            for (size_t i = 0; i < _pinConfigs.size(); i++)
+            _analog.poll();
+            _edges.scan([this](uint8_t pin, uint8_t level, uint32_t edgeUs)
+                        { sendEdge(pin, level, edgeUs); });
+            _scanner.scan([this, now](uint8_t bus, uint8_t channel, int value, uint32_t us)
+                          { sendScanned(bus, channel, value, us, now); });
+
+            int value;
+            for (uint8_t i : _analogInputs)
+            {
+                if (processAnalogInput(_pinConfigs[i], _pinStates[i], now, value))
+                    send(i, value, now);
+            }
+            for (uint8_t i : _touchInputs)
             {
-                auto &config = _pinConfigs[i];
-                auto &state = _pinStates[i];
+                if (processTouchInput(_pinConfigs[i], _pinStates[i], now, value))
+                    send(i, value, now);
+            }
+            for (uint8_t i : _digitalInputs)
+            {
+                if (processDigitalInput(_pinConfigs[i], _pinStates[i], now, value))
+                    send(i, value, now);
+            }
 
-                if (config.mode == ENOMIK_OUTPUT || config.mode == ENOMIK_ANALOG_OUTPUT)
-                    continue;
+            _outputs.loop();
+            _store.loop(_pinConfigs); // commits SysEx changes once they stop coming
+        }
 
-                processPinInput(config, state, now);
-            }
+        // Writes pending config changes now instead of after ENOMIK_PINSTORE_COMMIT_DELAY_MS, e.g. before a restart
+        void flushPinConfigs()
+        {
+            _store.flush(_pinConfigs);
+        }
+
+        PinConfigStore &getPinConfigStore()
+        {
+            return _store;
+        }
+
+        AnalogOutputs &getAnalogOutputs()
+        {
+            return _outputs;
+        }
+
+        // Muxes, shift registers and matrices. Set them up before begin(): with a mux, analog inputs
+        // stay on analogRead, as the mux channels are converted with it too
+        InputScanner &getScanner()
+        {
+            return _scanner;
+        }
+
+        // Digital inputs, call on every loop pass: sends what the pin interrupts captured since the last call
+        // Matrix with velocity keys, on every loop pass like the edges
+        inline void pollMatrix()
+        {
+            _scanner.pollMatrix([this](uint8_t bus, uint8_t channel, int value, uint32_t us)
+                                { sendScanned(bus, channel, value, us, millis()); });
+        }
+
+        inline void pollEdges()
+        {
+            _edges.poll([this](uint8_t pin, uint8_t level, uint32_t edgeUs)
+                        { sendEdge(pin, level, edgeUs); });
+        }
+
+        EdgeCapture &getEdgeCapture()
+        {
+            return _edges;
+        }
+
+        // Touch pins with a threshold, call on every loop pass: sends the touches and releases the touch
+        // interrupt reported since the last call
+        inline void pollTouch()
+        {
+            _touch.poll([this](uint8_t pin, bool touched, uint32_t us)
+                        {
+                int8_t index = _configOfPin[pin];
+                if (index < 0)
+                    return;
+                const auto &config = _pinConfigs[index];
+                auto &state = _pinStates[index];
+                int value = touched ? config.max_midi_value : config.min_midi_value;
+                state.touched = touched;
+                state.lastValue = value;
+                state.lastChangeTime = millis();
+                state.lastSendTime = state.lastChangeTime;
+                sendMidiMessage(config, value); });
+        }
+
+        TouchSensor &getTouchSensor()
+        {
+            return _touch;
         }
 
-        // MIDI Input Handlers
+        // MIDI Input Handlers, output pins are looked up in the output index instead of scanning all configs
         void onNoteOn(byte channel, byte note, byte velocity)
         {
-            for (auto &config : _pinConfigs)
-            {
-                if (config.midi_type == MidiStatus::MIDI_NOTE_ON &&
-                    config.midi_channel == channel &&
-                    config.midi_note == note)
+            forEachOutput(MidiStatus::MIDI_NOTE_ON, channel, note, [&](const PinConfig &config)
+                          {
+                if (config.mode == ENOMIK_OUTPUT)
                 {
-                    if (config.mode == ENOMIK_OUTPUT)
-                    {
-                        digitalWrite(config.pin, velocity > 0 ? HIGH : LOW);
-                    }
-                    else if (config.mode == ENOMIK_ANALOG_OUTPUT)
-                    {
-                        int mappedValue = map(velocity, config.min_midi_value, config.max_midi_value,
-                                              0, ADC_MAX_VALUE);
-                        analogWrite(config.pin, constrain(mappedValue, 0, ADC_MAX_VALUE));
-                    }
+                    digitalWrite(config.pin, velocity > 0 ? HIGH : LOW);
                 }
-            }
+                else
+                {
+                    int mappedValue = map(velocity, config.min_midi_value, config.max_midi_value,
+                                          0, ENOMIK_OUTPUT_MAX);
+                    writeAnalogOutput(config, constrain(mappedValue, 0, ENOMIK_OUTPUT_MAX));
+                } });
         }
 
         void onNoteOff(byte channel, byte note, byte velocity)
         {
-            for (auto &config : _pinConfigs)
+            auto release = [this](const PinConfig &config)
             {
-                if ((
-                        config.midi_type == MidiStatus::MIDI_NOTE_OFF ||
-                        config.midi_type == MidiStatus::MIDI_NOTE_ON) &&
-                    config.midi_channel == channel &&
-                    config.midi_note == note)
+                if (config.mode == ENOMIK_OUTPUT)
                 {
-                    if (config.mode == ENOMIK_OUTPUT)
-                    {
-                        digitalWrite(config.pin, LOW);
-                    }
-                    else if (config.mode == ENOMIK_ANALOG_OUTPUT)
-                    {
-                        analogWrite(config.pin, 0);
-                    }
+                    digitalWrite(config.pin, LOW);
                 }
-            }
+                else
+                {
+                    writeAnalogOutput(config, 0);
+                }
+            };
+            forEachOutput(MidiStatus::MIDI_NOTE_OFF, channel, note, release);
+            forEachOutput(MidiStatus::MIDI_NOTE_ON, channel, note, release);
         }
 
         void onPitchBend(byte channel, int bend)
         {
-            for (auto &config : _pinConfigs)
-            {
-                if (config.midi_type == MidiStatus::MIDI_PITCH_BEND &&
-                    config.midi_channel == channel)
+            forEachOutput(MidiStatus::MIDI_PITCH_BEND, channel, 0, [&](const PinConfig &config)
+                          {
+                if (config.mode == ENOMIK_OUTPUT)
                 {
-                    if (config.mode == ENOMIK_OUTPUT)
-                    {
-                        digitalWrite(config.pin, bend >= 8192 ? HIGH : LOW);
-                    }
-                    else if (config.mode == ENOMIK_ANALOG_OUTPUT)
-                    {
-                        int mappedValue = map(bend, 0, 16383, 0, ADC_MAX_VALUE);
-                        analogWrite(config.pin, constrain(mappedValue, 0, ADC_MAX_VALUE));
-                    }
+                    digitalWrite(config.pin, bend >= 8192 ? HIGH : LOW);
                 }
-            }
+                else
+                {
+                    int mappedValue = map(bend, 0, 16383, 0, ENOMIK_OUTPUT_MAX);
+                    writeAnalogOutput(config, constrain(mappedValue, 0, ENOMIK_OUTPUT_MAX));
+                } });
         }
 
         void onControlChange(byte channel, byte control, byte value)
         {
-            for (auto &config : _pinConfigs)
-            {
-                if (config.midi_type == MidiStatus::MIDI_CONTROL_CHANGE &&
-                    config.midi_channel == channel &&
-                    config.midi_cc == control)
+            forEachOutput(MidiStatus::MIDI_CONTROL_CHANGE, channel, control, [&](const PinConfig &config)
+                          {
+                if (config.mode == ENOMIK_OUTPUT)
                 {
-                    if (config.mode == ENOMIK_OUTPUT)
-                    {
-                        digitalWrite(config.pin, value > 63 ? HIGH : LOW);
-                    }
-                    else if (config.mode == ENOMIK_ANALOG_OUTPUT)
-                    {
-                        int mappedValue = map(value, config.min_midi_value, config.max_midi_value, 0, ADC_MAX_VALUE);
-                        analogWrite(config.pin, constrain(mappedValue, 0, ADC_MAX_VALUE));
-                    }
+                    digitalWrite(config.pin, value > 63 ? HIGH : LOW);
                 }
-            }
+                else
+                {
+                    int mappedValue = map(value, config.min_midi_value, config.max_midi_value, 0, ENOMIK_OUTPUT_MAX);
+                    writeAnalogOutput(config, constrain(mappedValue, 0, ENOMIK_OUTPUT_MAX));
+                } });
         }
 
         void onProgramChange(byte channel, byte program)
@@ -201,6 +276,22 @@ namespace enomik
             _onSysExSendRequest = callback;
         }
 
+        void setOnSetRouteRequest(std::function<void(uint8_t route, bool enabled, uint16_t channelMask)> callback)
+        {
+            _sysexHandler.setOnSetRoute(callback);
+        }
+
+        void setOnGetRoutesRequest(std::function<void()> callback)
+        {
+            _sysexHandler.setOnGetRoutes(callback);
+        }
+
+        // Continuous sampling of the analog inputs, see enomik_analog.h
+        AnalogSampler &getAnalogSampler()
+        {
+            return _analog;
+        }
+
         void printPinConfigs()
         {
             Serial.println("=== Pin Configurations ===");
@@ -230,8 +321,40 @@ namespace enomik
     private:
         std::vector<PinConfig> _pinConfigs;
         std::vector<PinState> _pinStates;
+
+        // Output index: (type, channel, note/cc) -> output pins, an open addressing table of slots that
+        // each point at a run of configs in outputs. The MIDI handlers run on the WiFi task while SysEx
+        // changes the configs on the loop task, so the index holds copies of the output configs and is
+        // rebuilt off to the side, then swapped in. The old one is freed once no handler uses it anymore
+        struct OutputSlot
+        {
+            uint16_t key = OUTPUT_KEY_EMPTY;
+            uint8_t first = 0;
+            uint8_t count = 0;
+        };
+        static constexpr uint16_t OUTPUT_KEY_EMPTY = 0xFFFF;
+        struct OutputIndex
+        {
+            std::vector<OutputSlot> slots; // power of two, at most half full
+            std::vector<PinConfig> outputs;
+            uint32_t users = 0; // handlers walking it, under _outputIndexLock
+        };
+        OutputIndex *_outputIndex = nullptr;
+        portMUX_TYPE _outputIndexLock = portMUX_INITIALIZER_UNLOCKED;
+
+        AnalogSampler _analog;
+        EdgeCapture _edges;
+        TouchSensor _touch;
+        AnalogOutputs _outputs;
+        InputScanner _scanner;
+        int8_t _configOfChannel[SCAN_BUSES][ENOMIK_SCAN_MAX_CHANNELS]; // _pinConfigs index of a scanned input
+        int8_t _configOfPin[ENOMIK_EDGE_MAX_PINS]; // _pinConfigs index of an interrupt driven pin, edge or touch
+        // Polled inputs by mode, _pinConfigs indices. Digital inputs are here only if EdgeCapture couldn't take them
+        std::vector<uint8_t> _analogInputs;
+        std::vector<uint8_t> _touchInputs;
+        std::vector<uint8_t> _digitalInputs;
         SysExHandler _sysexHandler;
-        Preferences _preferences;
+        PinConfigStore _store;
 
         // External callbacks
         std::function<void(midi_message)> _onMIDISendRequest;
@@ -239,52 +362,283 @@ namespace enomik
         std::function<void()> _onGetPeersRequest;
         std::function<void()> _onResetRequest;
 
+        // [type 3 bits][channel 5 bits][note/cc 7 bits], pitch bend uses number 0
+        static inline uint16_t outputKey(MidiStatus type, uint8_t channel, uint8_t number)
+        {
+            return ((type >> 4) & 0x07) << 12 | (channel & 0x1F) << 7 | (number & 0x7F);
+        }
+
+        static inline const OutputSlot *findOutputSlot(const OutputIndex &index, uint16_t key)
+        {
+            if (index.slots.empty())
+                return nullptr;
+            size_t mask = index.slots.size() - 1;
+            for (size_t i = (key ^ (key >> 7)) & mask;; i = (i + 1) & mask)
+            {
+                const OutputSlot &slot = index.slots[i];
+                if (slot.key == key)
+                    return &slot;
+                if (slot.key == OUTPUT_KEY_EMPTY)
+                    return nullptr;
+            }
+        }
+
+        template <typename Apply>
+        inline void forEachOutput(MidiStatus type, byte channel, byte number, Apply apply)
+        {
+            portENTER_CRITICAL(&_outputIndexLock);
+            OutputIndex *index = _outputIndex;
+            if (index)
+                index->users++;
+            portEXIT_CRITICAL(&_outputIndexLock);
+            if (!index)
+                return;
+
+            const OutputSlot *slot = findOutputSlot(*index, outputKey(type, channel, number));
+            for (uint8_t i = 0; slot && i < slot->count; i++)
+                apply(index->outputs[slot->first + i]);
+
+            portENTER_CRITICAL(&_outputIndexLock);
+            index->users--;
+            portEXIT_CRITICAL(&_outputIndexLock);
+        }
+
+        void rebuildOutputIndex()
+        {
+            std::vector<std::pair<uint16_t, uint8_t>> entries;
+            for (size_t i = 0; i < _pinConfigs.size() && i < 256; i++)
+            {
+                const auto &config = _pinConfigs[i];
+                if (config.mode != ENOMIK_OUTPUT && config.mode != ENOMIK_ANALOG_OUTPUT)
+                    continue;
+                uint8_t number = 0;
+                if (config.midi_type == MidiStatus::MIDI_NOTE_ON || config.midi_type == MidiStatus::MIDI_NOTE_OFF)
+                    number = config.midi_note;
+                else if (config.midi_type == MidiStatus::MIDI_CONTROL_CHANGE)
+                    number = config.midi_cc;
+                else if (config.midi_type != MidiStatus::MIDI_PITCH_BEND)
+                    continue; // no handler drives it
+                entries.push_back({outputKey(config.midi_type, config.midi_channel, number), (uint8_t)i});
+            }
+            std::sort(entries.begin(), entries.end()); // same key next to each other, config order kept
+
+            OutputIndex *index = new OutputIndex();
+            size_t slots = 4;
+            while (slots < entries.size() * 2)
+                slots <<= 1;
+            index->slots.assign(entries.empty() ? 0 : slots, OutputSlot());
+            index->outputs.reserve(entries.size());
+            size_t slot = 0;
+            int keys = 0;
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                uint16_t key = entries[i].first;
+                index->outputs.push_back(_pinConfigs[entries[i].second]);
+                if (i > 0 && entries[i - 1].first == key)
+                {
+                    index->slots[slot].count++;
+                    continue;
+                }
+                size_t mask = index->slots.size() - 1;
+                slot = (key ^ (key >> 7)) & mask;
+                while (index->slots[slot].key != OUTPUT_KEY_EMPTY)
+                    slot = (slot + 1) & mask;
+                index->slots[slot].key = key;
+                index->slots[slot].first = i;
+                index->slots[slot].count = 1;
+                keys++;
+            }
+
+            portENTER_CRITICAL(&_outputIndexLock);
+            OutputIndex *old = _outputIndex;
+            _outputIndex = index;
+            portEXIT_CRITICAL(&_outputIndexLock);
+            // Handlers that picked up the old index finish with it first, they only write pins
+            while (old)
+            {
+                portENTER_CRITICAL(&_outputIndexLock);
+                bool used = old->users;
+                portEXIT_CRITICAL(&_outputIndexLock);
+                if (!used)
+                    break;
+                delay(1);
+            }
+            delete old;
+            ENOMIK_LOGD("Output index: %d pins, %d keys", (int)index->outputs.size(), keys);
+        }
+
+        // Everything derived from _pinConfigs
+        void pinConfigsChanged()
+        {
+            rebuildOutputIndex();
+            for (size_t i = 0; i < _pinConfigs.size(); i++)
+                _pinStates[i].filter.configure(_pinConfigs[i].filter, _pinConfigs[i].filter_param);
+
+            uint8_t analogPins[ENOMIK_ANALOG_MAX_PINS];
+            size_t count = 0;
+            for (const auto &config : _pinConfigs)
+            {
+                if (config.mode == ENOMIK_ANALOG_INPUT && count < ENOMIK_ANALOG_MAX_PINS)
+                    analogPins[count++] = config.pin;
+            }
+            if (count && !_scanner.channels(SCAN_MUX))
+                _analog.begin(analogPins, count, ADC_RESOLUTION);
+            else
+                _analog.end();
+
+            // Digital inputs move to edge interrupts, pins that aren't digital inputs anymore are released
+            uint64_t digital = 0;
+            memset(_configOfPin, -1, sizeof(_configOfPin));
+            for (size_t i = 0; i < _pinConfigs.size(); i++)
+            {
+                const auto &config = _pinConfigs[i];
+                if ((config.mode == ENOMIK_INPUT || config.mode == ENOMIK_INPUT_PULLUP) &&
+                    config.pin < ENOMIK_EDGE_MAX_PINS && i < 128 && _edges.attach(config.pin))
+                {
+                    digital |= 1ULL << config.pin;
+                    _configOfPin[config.pin] = i;
+                }
+                // Velocity keys need both contacts timestamped, there is no polled fallback
+                else if (config.mode == ENOMIK_INPUT_VELOCITY && i < 128 && attachVelocityKey(config))
+                {
+                    digital |= 1ULL << config.pin | 1ULL << config.contact_pin;
+                    _configOfPin[config.pin] = i;
+                    _configOfPin[config.contact_pin] = i;
+                    _pinStates[i].contactUs = 0;
+                }
+                else if (config.mode == ENOMIK_INPUT_VELOCITY)
+                {
+                    ENOMIK_LOGW("Velocity key on pins %d and %d can't be attached (contact pin %d = not set)", config.pin,
+                                config.contact_pin, PIN_CONFIG_NO_PIN);
+                }
+#if !ENOMIK_EDGE_INTERRUPTS
+                if (config.mode == ENOMIK_INPUT_VELOCITY)
+                    ENOMIK_LOGW("Velocity key on pin %d timed by the 1 kHz scan, needs ENOMIK_EDGE_INTERRUPTS 1",
+                                config.pin);
+#endif
+            }
+            uint64_t released = _edges.getAttached() & ~digital;
+            while (released)
+            {
+                _edges.detach(__builtin_ctzll(released));
+                released &= released - 1;
+            }
+
+            // Touch pins with a threshold move to touch interrupts, the threshold is the change in
+            // percent of the baseline calibrated now. Touch values (threshold 0) are still read in loop()
+            uint64_t touch = 0;
+            for (size_t i = 0; i < _pinConfigs.size(); i++)
+            {
+                const auto &config = _pinConfigs[i];
+                if (config.mode == ENOMIK_INPUT_TOUCH && config.threshold && config.pin < ENOMIK_TOUCH_MAX_PINS &&
+                    i < 128 && _touch.attach(config.pin, config.threshold))
+                {
+                    touch |= 1ULL << config.pin;
+                    _configOfPin[config.pin] = i;
+                }
+            }
+            released = _touch.getAttached() & ~touch;
+            while (released)
+            {
+                _touch.detach(__builtin_ctzll(released));
+                released &= released - 1;
+            }
+
+            // Analog outputs on LEDC channels, released ones give theirs back
+            uint64_t outputs = 0;
+            for (const auto &config : _pinConfigs)
+            {
+                if (config.mode == ENOMIK_ANALOG_OUTPUT && _outputs.attach(config.pin))
+                    outputs |= 1ULL << config.pin;
+            }
+            released = _outputs.getAttached() & ~outputs;
+            while (released)
+            {
+                _outputs.detach(__builtin_ctzll(released));
+                released &= released - 1;
+            }
+
+            // Velocity keys on the matrix need both contacts timed, the matrix moves to pollMatrix()
+            bool matrixVelocity = false;
+            memset(_configOfChannel, -1, sizeof(_configOfChannel));
+            for (size_t i = 0; i < _pinConfigs.size() && i < 128; i++)
+            {
+                const auto &config = _pinConfigs[i];
+                uint8_t bus = scanBus(config.mode);
+                if (bus >= SCAN_BUSES || config.pin >= ENOMIK_SCAN_MAX_CHANNELS)
+                    continue;
+                if (config.mode == ENOMIK_INPUT_MATRIX_VELOCITY)
+                {
+                    if (config.contact_pin == PIN_CONFIG_NO_PIN || config.contact_pin >= ENOMIK_SCAN_MAX_CHANNELS ||
+                        config.contact_pin == config.pin)
+                    {
+                        ENOMIK_LOGW("Matrix velocity key on channel %d needs a contact channel", config.pin);
+                        continue;
+                    }
+                    _configOfChannel[bus][config.contact_pin] = i;
+                    _pinStates[i].contactUs = 0;
+                    matrixVelocity = true;
+                }
+                _configOfChannel[bus][config.pin] = i;
+            }
+            _scanner.setMatrixPeriod(matrixVelocity ? ENOMIK_SCAN_VELOCITY_PERIOD_US : 0);
+
+            _analogInputs.clear();
+            _touchInputs.clear();
+            _digitalInputs.clear();
+            for (size_t i = 0; i < _pinConfigs.size() && i < 256; i++)
+            {
+                const auto &config = _pinConfigs[i];
+                if (config.mode == ENOMIK_ANALOG_INPUT)
+                    _analogInputs.push_back(i);
+                else if (config.mode == ENOMIK_INPUT_TOUCH && !_touch.isAttached(config.pin))
+                    _touchInputs.push_back(i);
+                else if ((config.mode == ENOMIK_INPUT || config.mode == ENOMIK_INPUT_PULLUP) &&
+                         !_edges.isAttached(config.pin))
+                    _digitalInputs.push_back(i);
+            }
+        }
+
         void setupSysExHandlers()
         {
             // Handler for setting pin configuration
             _sysexHandler.setOnSetPinConfig([this](const PinConfig &cfg)
                                             {
-                Serial.println("SysEx: Setting pin config");
                 upsertPinConfig(cfg);
                 _sysexHandler.sendPinConfigResponse(cfg); });
 
             // Handler for getting single pin configuration
-            _sysexHandler.setOnGetPinConfig([this](uint8_t pin)
+            _sysexHandler.setOnGetPinConfig([this](uint8_t pin, uint8_t mode)
                                             {
-                Serial.print("SysEx: Getting config for pin ");
-                Serial.println(pin);
                 for (const auto &cfg : _pinConfigs)
                 {
-                    if (cfg.pin == pin)
+                    if (samePin(cfg, pin, mode))
                     {
                         _sysexHandler.sendPinConfigResponse(cfg);
                         return;
                     }
                 }
-                Serial.println("SysEx: Pin config not found"); });
+                ENOMIK_LOGW("SysEx: Pin config %d (mode 0x%02X) not found", pin, mode); });
 
             // Handler for getting all pin configurations
             _sysexHandler.setOnGetAllPinConfigs([this]()
                                                 {
-                Serial.println("SysEx: Getting all pin configs");
                 for (const auto &cfg : _pinConfigs)
                 {
                     _sysexHandler.sendPinConfigResponse(cfg);
                 } });
 
             // Handler for deleting pin configuration
-            _sysexHandler.setOnDeletePinConfig([this](uint8_t pin)
+            _sysexHandler.setOnDeletePinConfig([this](uint8_t pin, uint8_t mode)
                                                {
-                Serial.print("SysEx: Deleting config for pin ");
-                Serial.println(pin);
-                
                 for (size_t i = 0; i < _pinConfigs.size(); i++)
                 {
-                    if (_pinConfigs[i].pin == pin)
+                    if (samePin(_pinConfigs[i], pin, mode))
                     {
                         _pinConfigs.erase(_pinConfigs.begin() + i);
                         _pinStates.erase(_pinStates.begin() + i);
-                        savePinConfigsToPrefs(_pinConfigs);
+                        pinConfigsChanged();
+                        _store.save();
                         _sysexHandler.sendDeleteResponse(pin);
                         return;
                     }
@@ -293,16 +647,15 @@ namespace enomik
             // Handler for clearing all pin configurations
             _sysexHandler.setOnClearPinConfigs([this]()
                                                {
-                Serial.println("SysEx: Clearing all pin configs");
                 _pinConfigs.clear();
                 _pinStates.clear();
-                savePinConfigsToPrefs(_pinConfigs);
+                pinConfigsChanged();
+                _store.save();
                 _sysexHandler.sendSimpleResponse(SysExCommand::CLEAR_PIN_CONFIGS); });
 
             // Handler for getting MAC address
             _sysexHandler.setOnGetMAC([this]()
                                       {
-                Serial.println("SysEx: Getting MAC address");
                 uint8_t mac[6];
                 esp_read_mac(mac, ESP_MAC_WIFI_STA);
                 _sysexHandler.sendMACResponse(mac); });
@@ -310,14 +663,6 @@ namespace enomik
             // Handler for adding peer
             _sysexHandler.setOnAddPeer([this](const uint8_t mac[6])
                                        {
-                Serial.print("SysEx: Adding peer ");
-                for (int i = 0; i < 6; i++)
-                {
-                    Serial.print(mac[i], HEX);
-                    if (i < 5) Serial.print(":");
-                }
-                Serial.println();
-                
                 if (_onAddPeerRequest)
                 {
                     // Need to cast away const for the callback
@@ -329,7 +674,6 @@ namespace enomik
             // Handler for getting peers
             _sysexHandler.setOnGetPeers([this]()
                                         {
-                Serial.println("SysEx: Getting peers list");
                 if (_onGetPeersRequest)
                 {
                     _onGetPeersRequest();
@@ -338,23 +682,20 @@ namespace enomik
             // Handler for system reset
             _sysexHandler.setOnReset([this]()
                                      {
-                Serial.println("SysEx: Performing system reset");
-                
                 // Clear in-memory configurations
                 _pinConfigs.clear();
                 _pinStates.clear();
+                pinConfigsChanged();
 
-                // Clear stored preferences
-                _preferences.begin("pinconfigs", false);
-                _preferences.clear();
-                _preferences.end();
+                // Clear stored configs
+                _store.clear();
 
                 if (_onResetRequest)
                 {
                     _onResetRequest();
                 }
                 
-                Serial.println("System reset complete"); });
+                ENOMIK_LOGI("System reset complete"); });
 
             // Handler for sending SysEx messages back out
             _sysexHandler.setOnSend([this](const midi_sysex_message &msg)
@@ -366,33 +707,84 @@ namespace enomik
                 } });
         }
 
-        void processPinInput(const PinConfig &config, PinState &state, unsigned long now)
+        void send(uint8_t index, int value, unsigned long now)
         {
-            int currentValue = 0;
-            bool shouldSend = false;
+            auto &state = _pinStates[index];
+            state.lastValue = value;
+            state.lastSendTime = now;
+            sendMidiMessage(_pinConfigs[index], value);
+        }
 
-            switch (config.mode)
+        static inline uint8_t scanBus(uint8_t mode)
+        {
+            switch (mode)
             {
-            case ENOMIK_INPUT:
-            case ENOMIK_INPUT_PULLUP:
-                shouldSend = processDigitalInput(config, state, now, currentValue);
-                break;
+            case ENOMIK_INPUT_MUX:
+                return SCAN_MUX;
+            case ENOMIK_INPUT_SHIFT:
+                return SCAN_SHIFT;
+            case ENOMIK_INPUT_MATRIX:
+            case ENOMIK_INPUT_MATRIX_VELOCITY:
+                return SCAN_MATRIX;
+            default:
+                return SCAN_BUSES;
+            }
+        }
 
-            case ENOMIK_ANALOG_INPUT:
-                shouldSend = processAnalogInput(config, state, now, currentValue);
-                break;
+        // A GPIO and a channel on a scanned bus share pin numbers, the mode tells them apart
+        static inline bool samePin(const PinConfig &config, uint8_t pin, uint8_t mode)
+        {
+            return config.pin == pin && scanBus(config.mode) == scanBus(mode);
+        }
 
-            case ENOMIK_INPUT_TOUCH:
-                shouldSend = processTouchInput(config, state, now, currentValue);
-                break;
+        // Inputs that send min/max for a level, 1 = open (pulled up)
+        static inline bool isSwitch(uint8_t mode)
+        {
+            return mode == ENOMIK_INPUT || mode == ENOMIK_INPUT_PULLUP || mode == ENOMIK_INPUT_SHIFT ||
+                   mode == ENOMIK_INPUT_MATRIX;
+        }
+
+        void sendScanned(uint8_t bus, uint8_t channel, int value, uint32_t us, unsigned long now)
+        {
+            int8_t index = _configOfChannel[bus][channel];
+            if (index < 0)
+                return;
+            if (_pinConfigs[index].mode == ENOMIK_INPUT_MATRIX_VELOCITY)
+            {
+                sendVelocityContact(index, channel, value == 0, us);
+                return;
+            }
+            if (bus == SCAN_MUX)
+            {
+                int currentValue;
+                if (processAnalogValue(_pinConfigs[index], _pinStates[index], now, value, currentValue))
+                    send(index, currentValue, now);
+                return;
             }
+            _pinStates[index].lastChangeTime = now;
+            send(index, value, now);
+        }
+
+        inline void writeAnalogOutput(const PinConfig &config, uint32_t duty)
+        {
+            _outputs.write(config.pin, duty, config.slew * ENOMIK_OUTPUT_SLEW_STEP_MS);
+        }
 
-            if (shouldSend)
+        void sendEdge(uint8_t pin, uint8_t level, uint32_t edgeUs)
+        {
+            int8_t index = _configOfPin[pin];
+            if (index < 0)
+                return;
+            if (_pinConfigs[index].mode == ENOMIK_INPUT_VELOCITY)
             {
-                state.lastValue = currentValue;
-                state.lastSendTime = now;
-                sendMidiMessage(config, currentValue);
+                sendVelocityContact(index, pin, level == LOW, edgeUs);
+                return;
             }
+            auto &state = _pinStates[index];
+            state.lastValue = level;
+            state.lastChangeTime = millis();
+            state.lastSendTime = state.lastChangeTime;
+            sendMidiMessage(_pinConfigs[index], level);
         }
 
         bool processDigitalInput(const PinConfig &config, PinState &state,
@@ -412,20 +804,26 @@ namespace enomik
         bool processAnalogInput(const PinConfig &config, PinState &state,
                                 unsigned long now, int &currentValue)
         {
-            int rawValue = analogRead(config.pin);
+            int rawValue;
+            if (!_analog.has(config.pin))
+                rawValue = analogRead(config.pin);
+            else if (!_analog.read(config.pin, rawValue))
+                return false; // no new sample since the last scan
 
-            // Initialize smoothed value on first read
-            if (state.lastValue == -1)
-                state.smoothedValue = rawValue;
-            else
-                state.smoothedValue = (SMOOTHING_FACTOR * rawValue) +
-                                      (1.0f - SMOOTHING_FACTOR) * state.smoothedValue;
+            return processAnalogValue(config, state, now, rawValue, currentValue);
+        }
+
+        // Analog pins and mux channels
+        bool processAnalogValue(const PinConfig &config, PinState &state,
+                                unsigned long now, int rawValue, int &currentValue)
+        {
+            int smoothedValue = state.filter.update(rawValue);
 
             // For pitch bend, preserve full ADC resolution
             if (config.midi_type == MidiStatus::MIDI_PITCH_BEND)
             {
                 // Map directly to 14-bit pitch bend range (0-16383)
-                currentValue = map((int)state.smoothedValue, 0, ADC_MAX_VALUE, 0, 16383);
+                currentValue = map(smoothedValue, 0, ADC_MAX_VALUE, 0, 16383);
                 currentValue = constrain(currentValue, 0, 16383);
 
                 // Use higher threshold for pitch bend since we have more resolution
@@ -435,7 +833,7 @@ namespace enomik
             else
             {
                 // For other MIDI types, use standard 7-bit range
-                int mappedValue = map((int)state.smoothedValue, 0, ADC_MAX_VALUE,
+                int mappedValue = map(smoothedValue, 0, ADC_MAX_VALUE,
                                       config.min_midi_value, config.max_midi_value);
                 currentValue = constrain(mappedValue, 0, 127);
 
@@ -452,51 +850,74 @@ namespace enomik
         bool processTouchInput(const PinConfig &config, PinState &state,
                                unsigned long now, int &currentValue)
         {
+            // Threshold mode is interrupt driven (pollTouch()), pins get here only if calibration failed
+            if (config.threshold != 0)
+                return false;
+
+            // No threshold set, send scaled touch values with smoothing. The touch FSM measures
+            // continuously, touchRead only fetches its last result
             int touchValue = touchRead(config.pin);
+            int smoothedValue = state.filter.update(touchValue);
 
-            if (config.threshold == 0)
-            {
-                // No threshold set, send scaled touch values with smoothing
-                if (state.lastValue == -1)
-                    state.smoothedValue = touchValue;
-                else
-                    state.smoothedValue = (SMOOTHING_FACTOR * touchValue) +
-                                          (1.0f - SMOOTHING_FACTOR) * state.smoothedValue;
+            // Invert mapping: lower touch value (stronger touch) = higher MIDI value
+            int mappedValue = map(smoothedValue, 0, 100, 127, 0);
+            mappedValue = constrain(mappedValue, 0, 127);
 
-                // Invert mapping: lower touch value (stronger touch) = higher MIDI value
-                int mappedValue = map((int)state.smoothedValue, 0, 100, 127, 0);
-                mappedValue = constrain(mappedValue, 0, 127);
+            // Apply user's min/max range
+            currentValue = map(mappedValue, 0, 127,
+                               config.min_midi_value, config.max_midi_value);
+            currentValue = constrain(currentValue, config.min_midi_value, config.max_midi_value);
 
-                // Apply user's min/max range
-                currentValue = map(mappedValue, 0, 127,
-                                   config.min_midi_value, config.max_midi_value);
-                currentValue = constrain(currentValue, config.min_midi_value, config.max_midi_value);
+            if (state.lastValue != -1 && abs(currentValue - state.lastValue) < ANALOG_THRESHOLD)
+                return false;
 
-                if (state.lastValue != -1 && abs(currentValue - state.lastValue) < ANALOG_THRESHOLD)
-                    return false;
+            if (now - state.lastSendTime < ANALOG_MIN_INTERVAL)
+                return false;
 
-                if (now - state.lastSendTime < ANALOG_MIN_INTERVAL)
-                    return false;
+            return true;
+        }
 
-                return true;
+        // Note on when the second contact closes, with the time since the first one closed as velocity,
+        // note off (velocity 0) when the first contact opens again. pin is the GPIO or the matrix channel
+        void sendVelocityContact(uint8_t index, uint8_t pin, bool closed, uint32_t edgeUs)
+        {
+            const auto &config = _pinConfigs[index];
+            auto &state = _pinStates[index];
+            bool playing = state.lastValue > 0;
+            if (pin == config.pin)
+            {
+                state.contactUs = closed ? (edgeUs ? edgeUs : 1) : 0;
+                if (closed || !playing)
+                    return;
+                state.lastValue = 0;
             }
             else
             {
-                // Threshold mode: binary on/off
-                bool isTouched = touchValue < config.threshold;
-
-                if (isTouched != state.touched)
-                {
-                    if (now - state.lastChangeTime < DEBOUNCE_MS)
-                        return false;
-
-                    state.lastChangeTime = now;
-                    state.touched = isTouched;
-                    currentValue = isTouched ? config.max_midi_value : config.min_midi_value;
-                    return true;
-                }
+                if (!closed || playing)
+                    return;
+                // Second contact without the first one (missed or broken): as fast as it gets
+                uint32_t us = state.contactUs ? edgeUs - state.contactUs : 0;
+                state.lastValue = VelocityCurve::velocity(us, config.velocity_curve, config.min_midi_value,
+                                                          config.max_midi_value);
+                ENOMIK_LOGD("Velocity key %d: %u us, velocity %d", config.pin, us, state.lastValue);
             }
+            state.lastChangeTime = millis();
+            state.lastSendTime = state.lastChangeTime;
+            sendMidiMessage(config, state.lastValue);
+        }
 
+        // Both contacts or neither. Without a contact_pin the mode is refused, a default would be GPIO0
+        bool attachVelocityKey(const PinConfig &config)
+        {
+            if (config.contact_pin == PIN_CONFIG_NO_PIN || config.contact_pin == config.pin)
+                return false;
+            bool attached = _edges.isAttached(config.pin);
+            if (!_edges.attach(config.pin))
+                return false;
+            if (_edges.attach(config.contact_pin))
+                return true;
+            if (!attached)
+                _edges.detach(config.pin);
             return false;
         }
 
@@ -514,9 +935,11 @@ namespace enomik
             {
                 pinMode(c.pin, INPUT_PULLUP);
             }
-            else if (c.mode == ENOMIK_INPUT_TOUCH)
+            else if (c.mode == ENOMIK_INPUT_VELOCITY)
             {
-                touchAttachInterrupt(c.pin, nullptr, 40);
+                pinMode(c.pin, INPUT_PULLUP);
+                if (c.contact_pin != PIN_CONFIG_NO_PIN)
+                    pinMode(c.contact_pin, INPUT_PULLUP);
             }
         }
 
@@ -534,7 +957,7 @@ namespace enomik
             case MidiStatus::MIDI_NOTE_ON:
             case MidiStatus::MIDI_NOTE_OFF:
                 msg.firstByte = config.midi_note;
-                if (config.mode == ENOMIK_INPUT || config.mode == ENOMIK_INPUT_PULLUP)
+                if (isSwitch(config.mode))
                 {
                     msg.secondByte = value > 0 ? config.min_midi_value : config.max_midi_value;
                 }
@@ -546,7 +969,7 @@ namespace enomik
 
             case MidiStatus::MIDI_CONTROL_CHANGE:
                 msg.firstByte = config.midi_cc;
-                if (config.mode == ENOMIK_INPUT || config.mode == ENOMIK_INPUT_PULLUP)
+                if (isSwitch(config.mode))
                 {
                     msg.secondByte = value > 0 ? config.min_midi_value : config.max_midi_value;
                 }
@@ -570,17 +993,11 @@ namespace enomik
 
         void upsertPinConfig(const PinConfig &config)
         {
-            Serial.println("=== UPSERT START ===");
-            Serial.print("Upserting pin: ");
-            Serial.println(config.pin);
-
-            // Remove existing config for this pin
+            // Remove existing config for this pin, or this channel of the bus
             for (size_t i = 0; i < _pinConfigs.size(); i++)
             {
-                if (_pinConfigs[i].pin == config.pin)
+                if (samePin(_pinConfigs[i], config.pin, config.mode))
                 {
-                    Serial.print("Removing existing config at index: ");
-                    Serial.println(i);
                     _pinConfigs.erase(_pinConfigs.begin() + i);
                     _pinStates.erase(_pinStates.begin() + i);
                     break;
@@ -588,68 +1005,13 @@ namespace enomik
             }
 
             // Add new config
-            Serial.print("Adding new config for pin: ");
-            Serial.println(config.pin);
             _pinConfigs.push_back(config);
             _pinStates.push_back(PinState());
             initializePinHardware(config);
+            pinConfigsChanged();
 
-            Serial.print("Config count after: ");
-            Serial.println(_pinConfigs.size());
-            savePinConfigsToPrefs(_pinConfigs);
-            Serial.println("=== UPSERT END ===");
-        }
-
-        void savePinConfigsToPrefs(const std::vector<PinConfig> &configs)
-        {
-            _preferences.begin("pinconfigs", false);
-
-            for (size_t i = 0; i < configs.size(); i++)
-            {
-                String key = "cfg" + String(i);
-                uint8_t buf[8] = {
-                    configs[i].pin,
-                    configs[i].mode,
-                    configs[i].midi_channel,
-                    static_cast<uint8_t>(configs[i].midi_type),
-                    configs[i].midi_cc,
-                    configs[i].midi_note,
-                    configs[i].min_midi_value,
-                    configs[i].max_midi_value};
-                _preferences.putBytes(key.c_str(), buf, sizeof(buf));
-            }
-
-            _preferences.putUInt("count", configs.size());
-            _preferences.end();
-        }
-
-        std::vector<PinConfig> loadPinConfigsFromPrefs()
-        {
-            std::vector<PinConfig> out;
-
-            _preferences.begin("pinconfigs", true);
-            size_t count = _preferences.getUInt("count", 0);
-
-            for (size_t i = 0; i < count; i++)
-            {
-                String key = "cfg" + String(i);
-                uint8_t buf[8];
-
-                if (_preferences.getBytes(key.c_str(), buf, 8) == 8)
-                {
-                    PinConfig cfg(buf[0], buf[1]);
-                    cfg.midi_channel = buf[2];
-                    cfg.midi_type = static_cast<MidiStatus>(buf[3]);
-                    cfg.midi_cc = buf[4];
-                    cfg.midi_note = buf[5];
-                    cfg.min_midi_value = buf[6];
-                    cfg.max_midi_value = buf[7];
-                    out.push_back(cfg);
-                }
-            }
-
-            _preferences.end();
-            return out;
+            _store.save();
+            ENOMIK_LOGD("Upserted pin %d, %d configs", config.pin, (int)_pinConfigs.size());
         }
 
         // Note: This is only used internally by SysExHandler now
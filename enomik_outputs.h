@@ -0,0 +1,192 @@
+#pragma once
+
+#include <Arduino.h>
+#include "./utils/log.h"
+
+// PWM outputs on the LEDC peripheral, with optional glide.
+// A glide hands the move from the current duty to the new one to the LEDC fade engine, which steps
+// the duty in hardware, so no CPU time is spent per step. A fade can't be retargeted while it runs:
+// values that arrive meanwhile are kept (the newest wins) and loop() starts the next fade once the
+// fade done interrupt came in. write() runs on whichever task received the MIDI (WiFi, midi) and loop()
+// on the io task, a critical section guards the per pin state and only one of them starts a pin at a time.
+
+#ifndef ENOMIK_OUTPUT_PWM_HZ
+#define ENOMIK_OUTPUT_PWM_HZ 5000
+#endif
+#ifndef ENOMIK_OUTPUT_PWM_BITS
+#define ENOMIK_OUTPUT_PWM_BITS 12
+#endif
+#define ENOMIK_OUTPUT_MAX ((1 << ENOMIK_OUTPUT_PWM_BITS) - 1)
+#define ENOMIK_OUTPUT_SLEW_STEP_MS 10 // unit of PinConfig::slew
+#define ENOMIK_OUTPUT_MAX_PINS 64
+
+namespace enomik
+{
+    struct OutputStats
+    {
+        uint32_t writes = 0;     // values set
+        uint32_t fades = 0;      // handed to the fade engine
+        uint32_t queued = 0;     // arrived during a fade, started after it
+        uint32_t superseded = 0; // replaced by a newer value while queued
+    };
+
+    class AnalogOutputs
+    {
+    public:
+        bool attach(uint8_t pin)
+        {
+            if (pin >= ENOMIK_OUTPUT_MAX_PINS)
+                return false;
+            _instance = this;
+            uint64_t bit = 1ULL << pin;
+            if (_attached & bit)
+                return true;
+            if (!ledcAttach(pin, ENOMIK_OUTPUT_PWM_HZ, ENOMIK_OUTPUT_PWM_BITS))
+            {
+                ENOMIK_LOGW("No LEDC channel for pin %d", pin);
+                return false;
+            }
+            _fading[pin] = false;
+            portENTER_CRITICAL(&_lock);
+            _pending &= ~bit;
+            portEXIT_CRITICAL(&_lock);
+            _attached |= bit;
+            return true;
+        }
+
+        void detach(uint8_t pin)
+        {
+            if (!isAttached(pin))
+                return;
+            ledcDetach(pin);
+            _attached &= ~(1ULL << pin);
+            portENTER_CRITICAL(&_lock);
+            _pending &= ~(1ULL << pin);
+            portEXIT_CRITICAL(&_lock);
+        }
+
+        inline bool isAttached(uint8_t pin) const
+        {
+            return pin < ENOMIK_OUTPUT_MAX_PINS && (_attached & (1ULL << pin));
+        }
+
+        uint64_t getAttached() const
+        {
+            return _attached;
+        }
+
+        // duty 0 to ENOMIK_OUTPUT_MAX, reached after glideMs (0 = right away)
+        inline void write(uint8_t pin, uint32_t duty, uint16_t glideMs)
+        {
+            if (!isAttached(pin))
+                return;
+            uint64_t bit = 1ULL << pin;
+            portENTER_CRITICAL(&_lock);
+            _stats.writes++;
+            bool wait = _fading[pin] || (_starting & bit); // a fade runs, or another task is starting one
+            if (wait)
+            {
+                if (_pending & bit)
+                    _stats.superseded++;
+                else
+                    _stats.queued++;
+                _target[pin] = duty;
+                _glideMs[pin] = glideMs;
+                _pending |= bit;
+            }
+            else
+            {
+                _starting |= bit;
+            }
+            portEXIT_CRITICAL(&_lock);
+            if (!wait)
+                started(pin, start(pin, duty, glideMs));
+        }
+
+        // Starts the values that waited for a fade, call regularly
+        inline void loop()
+        {
+            uint64_t pending = _pending;
+            while (pending)
+            {
+                uint8_t pin = __builtin_ctzll(pending);
+                pending &= pending - 1;
+                uint64_t bit = 1ULL << pin;
+                portENTER_CRITICAL(&_lock);
+                bool ready = (_pending & bit) && !_fading[pin] && !(_starting & bit);
+                uint32_t duty = _target[pin];
+                uint16_t glideMs = _glideMs[pin];
+                if (ready)
+                {
+                    _pending &= ~bit;
+                    _starting |= bit;
+                }
+                portEXIT_CRITICAL(&_lock);
+                if (ready)
+                    started(pin, start(pin, duty, glideMs));
+            }
+        }
+
+        const OutputStats &getStats() const
+        {
+            return _stats;
+        }
+
+        void printStats(Print &out) const
+        {
+            out.println("=== Analog outputs ===");
+            out.printf("pins %d | writes %u, fades %u, queued %u, superseded %u\n", __builtin_popcountll(_attached),
+                       _stats.writes, _stats.fades, _stats.queued, _stats.superseded);
+            out.println("======================");
+        }
+
+    private:
+        static AnalogOutputs *_instance; // fade callback argument is the pin
+        uint64_t _attached = 0;
+        uint64_t _pending = 0;  // a value waits for the running fade
+        uint64_t _starting = 0; // a task is in start() for the pin
+        portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+        volatile bool _fading[ENOMIK_OUTPUT_MAX_PINS]; // one flag per pin, cleared by the fade interrupt
+        uint32_t _target[ENOMIK_OUTPUT_MAX_PINS];
+        uint16_t _glideMs[ENOMIK_OUTPUT_MAX_PINS];
+        OutputStats _stats;
+
+        // Outside the lock, the LEDC calls take their own. Returns whether a fade was started
+        bool start(uint8_t pin, uint32_t duty, uint16_t glideMs)
+        {
+            if (!glideMs)
+            {
+                ledcWrite(pin, duty);
+                return false;
+            }
+            uint32_t from = ledcRead(pin);
+            if (from == duty)
+                return false;
+            _fading[pin] = true;
+            if (!ledcFadeWithInterruptArg(pin, from, duty, glideMs, onFadeDone, (void *)(uintptr_t)pin))
+            {
+                _fading[pin] = false;
+                ledcWrite(pin, duty);
+                return false;
+            }
+            return true;
+        }
+
+        void started(uint8_t pin, bool fade)
+        {
+            portENTER_CRITICAL(&_lock);
+            _starting &= ~(1ULL << pin);
+            if (fade)
+                _stats.fades++;
+            portEXIT_CRITICAL(&_lock);
+        }
+
+        static void IRAM_ATTR onFadeDone(void *arg)
+        {
+            if (_instance)
+                _instance->_fading[(uintptr_t)arg] = false;
+        }
+    };
+
+    AnalogOutputs *AnalogOutputs::_instance = nullptr;
+}
@@ -1,5 +1,8 @@
 #pragma once
 #include "./midiHelpers.h"
+
+#define PIN_CONFIG_NO_PIN 0x7F // contact_pin not set, fits a SysEx data byte
+
 struct PinConfig
 {
     uint8_t pin;
@@ -11,6 +14,11 @@ struct PinConfig
     uint8_t midi_note = 0;
     uint8_t min_midi_value = 0;
     uint8_t max_midi_value = 127;
+    uint8_t filter = 0;       // analog and touch smoothing, enomik::FilterType, 0 = EWMA
+    uint8_t filter_param = 0; // 0 = the filter's default
+    uint8_t slew = 0;         // analog outputs, glide to a new value in 10 ms steps, 0 = jump
+    uint8_t contact_pin = PIN_CONFIG_NO_PIN; // velocity keys: the contact that closes second, pin is the first
+    uint8_t velocity_curve = 0; // velocity keys, see enomik_velocity.h, 0 = default
 
     PinConfig(uint8_t p, uint8_t m)
         : pin(p), mode(m) {}
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+#include <vector>
+#include "./enomik_pinconfig.h"
+#include "./utils/log.h"
+
+// Pin configs in NVS as one blob:
+//   [version][record size][count]  count records  [crc32 of everything before it, 4 bytes LE]
+// A record is every PinConfig field, one byte each (see RECORD_SIZE). Loaders take records that are
+// longer than they know and default the fields a shorter record lacks, so fields can be appended
+// without a new version.
+// save() only marks the configs dirty, they are written once nothing changed for
+// ENOMIK_PINSTORE_COMMIT_DELAY_MS (at most ENOMIK_PINSTORE_COMMIT_MAX_MS after the first change), so an
+// upload of many configs costs one flash write. The per pin "cfgN" keys of older versions are migrated
+// on the first load.
+
+#ifndef ENOMIK_PINSTORE_COMMIT_DELAY_MS
+#define ENOMIK_PINSTORE_COMMIT_DELAY_MS 500
+#endif
+#ifndef ENOMIK_PINSTORE_COMMIT_MAX_MS
+#define ENOMIK_PINSTORE_COMMIT_MAX_MS 3000
+#endif
+
+namespace enomik
+{
+    struct PinStoreStats
+    {
+        uint32_t saves = 0;         // save() calls, one per SysEx change
+        uint32_t commits = 0;       // blob writes
+        uint32_t bytesWritten = 0;  // blob bytes over all commits
+        uint32_t lastCommitUs = 0;  // duration of the last NVS write
+        uint32_t maxCommitUs = 0;
+        uint32_t lastUploadMs = 0;  // first change until it was committed
+        uint8_t lastUploadSaves = 0; // changes in that commit
+    };
+
+    class PinConfigStore
+    {
+    public:
+        static constexpr uint8_t VERSION = 1;
+        static constexpr uint8_t RECORD_SIZE = 14;
+        static constexpr uint8_t MIN_RECORD_SIZE = 11; // first version, without slew
+        static constexpr size_t HEADER_SIZE = 3;
+        static constexpr size_t CRC_SIZE = 4;
+
+        std::vector<PinConfig> load()
+        {
+            std::vector<PinConfig> out;
+            _preferences.begin(NAMESPACE, true);
+            size_t length = _preferences.getBytesLength(BLOB_KEY);
+            if (length)
+            {
+                std::vector<uint8_t> blob(length);
+                _preferences.getBytes(BLOB_KEY, blob.data(), length);
+                _preferences.end();
+                if (!decode(blob, out))
+                    ENOMIK_LOGW("Pin configs: stored blob is invalid (%d bytes), starting empty", (int)length);
+                return out;
+            }
+
+            // Older versions: "count" and one "cfgN" key per config, 8 or 10 bytes
+            uint32_t count = _preferences.getUInt("count", 0);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                char key[12];
+                snprintf(key, sizeof(key), "cfg%u", (unsigned)i);
+                uint8_t buf[10];
+                size_t size = _preferences.getBytes(key, buf, sizeof(buf));
+                if (size < 8)
+                    continue;
+                PinConfig cfg(buf[0], buf[1]);
+                cfg.midi_channel = buf[2];
+                cfg.midi_type = static_cast<MidiStatus>(buf[3]);
+                cfg.midi_cc = buf[4];
+                cfg.midi_note = buf[5];
+                cfg.min_midi_value = buf[6];
+                cfg.max_midi_value = buf[7];
+                if (size >= 10)
+                {
+                    cfg.filter = buf[8];
+                    cfg.filter_param = buf[9];
+                }
+                out.push_back(cfg);
+            }
+            _preferences.end();
+
+            if (count)
+            {
+                ENOMIK_LOGI("Pin configs: migrating %d legacy keys", (int)count);
+                write(out, count);
+            }
+            return out;
+        }
+
+        // Marks configs as changed, loop() writes them once the changes stop
+        void save()
+        {
+            uint32_t now = millis();
+            if (!_dirty)
+            {
+                _dirty = true;
+                _firstChangeMs = now;
+                _pendingSaves = 0;
+            }
+            _lastChangeMs = now;
+            _pendingSaves++;
+            _stats.saves++;
+        }
+
+        inline bool pending() const
+        {
+            return _dirty;
+        }
+
+        // Call regularly with the current configs
+        inline void loop(const std::vector<PinConfig> &configs)
+        {
+            if (!_dirty)
+                return;
+            uint32_t now = millis();
+            if (now - _lastChangeMs < ENOMIK_PINSTORE_COMMIT_DELAY_MS &&
+                now - _firstChangeMs < ENOMIK_PINSTORE_COMMIT_MAX_MS)
+                return;
+            flush(configs);
+        }
+
+        // Writes pending changes right away, e.g. before a restart
+        void flush(const std::vector<PinConfig> &configs)
+        {
+            if (!_dirty)
+                return;
+            if (!write(configs, 0))
+            {
+                _lastChangeMs = millis(); // try again after the commit delay
+                return;
+            }
+            _stats.lastUploadMs = millis() - _firstChangeMs;
+            _stats.lastUploadSaves = _pendingSaves > 255 ? 255 : _pendingSaves;
+        }
+
+        // Removes everything stored, pending changes included
+        void clear()
+        {
+            _preferences.begin(NAMESPACE, false);
+            _preferences.clear();
+            _preferences.end();
+            _dirty = false;
+        }
+
+        const PinStoreStats &getStats() const
+        {
+            return _stats;
+        }
+
+        void printStats(Print &out) const
+        {
+            out.println("=== Pin config store ===");
+            out.printf("saves %u, commits %u, bytes written %u%s\n", _stats.saves, _stats.commits,
+                       _stats.bytesWritten, _dirty ? ", pending" : "");
+            out.printf("commit us: last %u, max %u\n", _stats.lastCommitUs, _stats.maxCommitUs);
+            out.printf("last upload: %u changes, %u ms until committed\n", _stats.lastUploadSaves, _stats.lastUploadMs);
+            out.println("========================");
+        }
+
+        // Blob layout, public for tools that read or write it
+        static void encode(const std::vector<PinConfig> &configs, std::vector<uint8_t> &blob)
+        {
+            size_t count = configs.size() < 255 ? configs.size() : 255;
+            blob.assign(HEADER_SIZE + count * RECORD_SIZE + CRC_SIZE, 0);
+            blob[0] = VERSION;
+            blob[1] = RECORD_SIZE;
+            blob[2] = count;
+            uint8_t *record = &blob[HEADER_SIZE];
+            for (size_t i = 0; i < count; i++, record += RECORD_SIZE)
+            {
+                const PinConfig &cfg = configs[i];
+                record[0] = cfg.pin;
+                record[1] = cfg.mode;
+                record[2] = cfg.threshold;
+                record[3] = cfg.midi_channel;
+                record[4] = static_cast<uint8_t>(cfg.midi_type);
+                record[5] = cfg.midi_cc;
+                record[6] = cfg.midi_note;
+                record[7] = cfg.min_midi_value;
+                record[8] = cfg.max_midi_value;
+                record[9] = cfg.filter;
+                record[10] = cfg.filter_param;
+                record[11] = cfg.slew;
+                record[12] = cfg.contact_pin;
+                record[13] = cfg.velocity_curve;
+            }
+            uint32_t crc = esp_rom_crc32_le(0, blob.data(), blob.size() - CRC_SIZE);
+            for (size_t i = 0; i < CRC_SIZE; i++)
+                blob[blob.size() - CRC_SIZE + i] = crc >> (8 * i);
+        }
+
+        static bool decode(const std::vector<uint8_t> &blob, std::vector<PinConfig> &configs)
+        {
+            if (blob.size() < HEADER_SIZE + CRC_SIZE || blob[0] != VERSION || blob[1] < MIN_RECORD_SIZE)
+                return false;
+            size_t recordSize = blob[1];
+            size_t count = blob[2];
+            if (blob.size() != HEADER_SIZE + count * recordSize + CRC_SIZE)
+                return false;
+            uint32_t crc = 0;
+            for (size_t i = 0; i < CRC_SIZE; i++)
+                crc |= (uint32_t)blob[blob.size() - CRC_SIZE + i] << (8 * i);
+            if (crc != esp_rom_crc32_le(0, blob.data(), blob.size() - CRC_SIZE))
+                return false;
+
+            const uint8_t *record = &blob[HEADER_SIZE];
+            for (size_t i = 0; i < count; i++, record += recordSize)
+            {
+                PinConfig cfg(record[0], record[1]);
+                cfg.threshold = record[2];
+                cfg.midi_channel = record[3];
+                cfg.midi_type = static_cast<MidiStatus>(record[4]);
+                cfg.midi_cc = record[5];
+                cfg.midi_note = record[6];
+                cfg.min_midi_value = record[7];
+                cfg.max_midi_value = record[8];
+                cfg.filter = record[9];
+                cfg.filter_param = record[10];
+                if (recordSize > 11)
+                    cfg.slew = record[11];
+                if (recordSize > 13)
+                {
+                    cfg.contact_pin = record[12];
+                    cfg.velocity_curve = record[13];
+                }
+                configs.push_back(cfg);
+            }
+            return true;
+        }
+
+    private:
+        static constexpr const char *NAMESPACE = "pinconfigs";
+        static constexpr const char *BLOB_KEY = "blob";
+        Preferences _preferences;
+        PinStoreStats _stats;
+        bool _dirty = false;
+        uint32_t _firstChangeMs = 0;
+        uint32_t _lastChangeMs = 0;
+        uint32_t _pendingSaves = 0;
+
+        // One putBytes, legacy keys (if any) removed in the same session
+        bool write(const std::vector<PinConfig> &configs, uint32_t legacyCount)
+        {
+            std::vector<uint8_t> blob;
+            encode(configs, blob);
+            uint32_t start = esp_timer_get_time();
+            _preferences.begin(NAMESPACE, false);
+            size_t written = _preferences.putBytes(BLOB_KEY, blob.data(), blob.size());
+            if (written == blob.size())
+            {
+                for (uint32_t i = 0; i < legacyCount; i++)
+                {
+                    char key[12];
+                    snprintf(key, sizeof(key), "cfg%u", (unsigned)i);
+                    _preferences.remove(key);
+                }
+                if (legacyCount)
+                    _preferences.remove("count");
+            }
+            _preferences.end();
+            uint32_t us = esp_timer_get_time() - start;
+
+            if (written != blob.size())
+            {
+                ENOMIK_LOGE("Pin configs: writing %d bytes failed", (int)blob.size());
+                return false;
+            }
+            _dirty = false;
+            _stats.commits++;
+            _stats.bytesWritten += blob.size();
+            _stats.lastCommitUs = us;
+            if (us > _stats.maxCommitUs)
+                _stats.maxCommitUs = us;
+            ENOMIK_LOGD("Pin configs: %d committed, %d bytes, %u us", (int)configs.size(), (int)blob.size(), us);
+            return true;
+        }
+    };
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <Preferences.h>
+#include "./midiHelpers.h"
+
+#ifndef ROUTE_QUEUE_SIZE
+#define ROUTE_QUEUE_SIZE 32 // messages per route waiting for a busy destination
+#endif
+
+namespace enomik
+{
+    // Sources and destinations of enomik::Client traffic.
+    // IO covers the configured pins and everything the sketch sends through Client::send*.
+    enum class RouteId : uint8_t
+    {
+        ESPNOW_TO_USB = 0,
+        USB_TO_ESPNOW = 1,
+        IO_TO_ESPNOW = 2,
+        IO_TO_USB = 3,
+        ESPNOW_TO_IO = 4,
+        USB_TO_IO = 5,
+        COUNT = 6
+    };
+
+    static constexpr uint8_t ROUTE_COUNT = static_cast<uint8_t>(RouteId::COUNT);
+    static constexpr uint16_t ROUTE_ALL_CHANNELS = 0xFFFF;
+
+    struct RouteConfig
+    {
+        bool enabled;
+        uint16_t channelMask; // bit n = MIDI channel n + 1, system messages pass any mask
+    };
+
+    struct RouteStats
+    {
+        uint32_t forwarded = 0;
+        uint32_t partial = 0;  // reached only some ESP-NOW peers, not resent
+        uint32_t filtered = 0; // route disabled or channel masked out
+        uint32_t queued = 0;
+        uint32_t dropped = 0; // queue full
+    };
+
+    // Bounded FIFO, ESP-NOW routes are filled from the WiFi task and drained in Client::loop
+    class RouteQueue
+    {
+    public:
+        bool push(const midi_message &msg)
+        {
+            bool pushed = false;
+            portENTER_CRITICAL(&_lock);
+            if (_count < ROUTE_QUEUE_SIZE)
+            {
+                _items[(_head + _count) % ROUTE_QUEUE_SIZE] = msg;
+                _count++;
+                pushed = true;
+            }
+            portEXIT_CRITICAL(&_lock);
+            return pushed;
+        }
+
+        bool peek(midi_message &msg)
+        {
+            bool available = false;
+            portENTER_CRITICAL(&_lock);
+            if (_count > 0)
+            {
+                msg = _items[_head];
+                available = true;
+            }
+            portEXIT_CRITICAL(&_lock);
+            return available;
+        }
+
+        void pop()
+        {
+            portENTER_CRITICAL(&_lock);
+            if (_count > 0)
+            {
+                _head = (_head + 1) % ROUTE_QUEUE_SIZE;
+                _count--;
+            }
+            portEXIT_CRITICAL(&_lock);
+        }
+
+        bool empty() const
+        {
+            return _count == 0;
+        }
+
+        void clear()
+        {
+            portENTER_CRITICAL(&_lock);
+            _head = 0;
+            _count = 0;
+            portEXIT_CRITICAL(&_lock);
+        }
+
+    private:
+        midi_message _items[ROUTE_QUEUE_SIZE];
+        uint16_t _head = 0;
+        volatile uint16_t _count = 0;
+        portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+    };
+
+    class Router
+    {
+    public:
+        // Defaults match the behaviour before routing was configurable:
+        // local traffic goes out on both transports, incoming MIDI drives the IO, nothing is bridged
+        static RouteConfig defaultConfig(RouteId route)
+        {
+            switch (route)
+            {
+            case RouteId::IO_TO_ESPNOW:
+            case RouteId::IO_TO_USB:
+            case RouteId::ESPNOW_TO_IO:
+            case RouteId::USB_TO_IO:
+                return {true, ROUTE_ALL_CHANNELS};
+            default:
+                return {false, ROUTE_ALL_CHANNELS};
+            }
+        }
+
+        void begin()
+        {
+            for (uint8_t i = 0; i < ROUTE_COUNT; i++)
+                _routes[i] = defaultConfig(static_cast<RouteId>(i));
+            load();
+        }
+
+        inline bool accepts(RouteId route, const midi_message &msg)
+        {
+            const RouteConfig &config = _routes[static_cast<uint8_t>(route)];
+            bool pass = config.enabled &&
+                        (!hasChannel(msg) || (config.channelMask & (1 << ((msg.channel - 1) & 0x0F))));
+            if (!pass)
+                count(_stats[static_cast<uint8_t>(route)].filtered);
+            return pass;
+        }
+
+        bool set(uint8_t route, bool enabled, uint16_t channelMask)
+        {
+            if (route >= ROUTE_COUNT)
+                return false;
+            _routes[route].enabled = enabled;
+            _routes[route].channelMask = channelMask;
+            if (!enabled)
+                _queues[route].clear();
+            save();
+            return true;
+        }
+
+        void reset()
+        {
+            for (uint8_t i = 0; i < ROUTE_COUNT; i++)
+            {
+                _routes[i] = defaultConfig(static_cast<RouteId>(i));
+                _queues[i].clear();
+            }
+            save();
+        }
+
+        const RouteConfig &get(uint8_t route) const
+        {
+            return _routes[route < ROUTE_COUNT ? route : 0];
+        }
+
+        RouteQueue &queue(RouteId route)
+        {
+            return _queues[static_cast<uint8_t>(route)];
+        }
+
+        RouteStats &stats(RouteId route)
+        {
+            return _stats[static_cast<uint8_t>(route)];
+        }
+
+        void printStats(Print &out)
+        {
+            static const char *names[ROUTE_COUNT] = {"ESP-NOW -> USB", "USB -> ESP-NOW", "IO -> ESP-NOW",
+                                                     "IO -> USB", "ESP-NOW -> IO", "USB -> IO"};
+            out.println("=== Routes ===");
+            for (uint8_t i = 0; i < ROUTE_COUNT; i++)
+            {
+                out.printf("%-15s %s mask 0x%04X | forwarded %u, partial %u, filtered %u, queued %u, dropped %u\n",
+                           names[i], _routes[i].enabled ? "on " : "off", _routes[i].channelMask, _stats[i].forwarded,
+                           _stats[i].partial, _stats[i].filtered, _stats[i].queued, _stats[i].dropped);
+            }
+            out.println("==============");
+        }
+
+        // Stats are counted from the WiFi task (ESP-NOW receive) and the midi task
+        static inline void count(uint32_t &counter)
+        {
+            __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+        }
+
+        static bool hasChannel(const midi_message &msg)
+        {
+            return static_cast<uint8_t>(msg.status) < 0xF0;
+        }
+
+    private:
+        RouteConfig _routes[ROUTE_COUNT];
+        RouteStats _stats[ROUTE_COUNT];
+        RouteQueue _queues[ROUTE_COUNT];
+        Preferences _preferences;
+
+        // 3 bytes per route: enabled, mask low, mask high
+        void save()
+        {
+            uint8_t buf[ROUTE_COUNT * 3];
+            for (uint8_t i = 0; i < ROUTE_COUNT; i++)
+            {
+                buf[i * 3] = _routes[i].enabled;
+                buf[i * 3 + 1] = _routes[i].channelMask & 0xFF;
+                buf[i * 3 + 2] = _routes[i].channelMask >> 8;
+            }
+            _preferences.begin("routing", false);
+            _preferences.putBytes("routes", buf, sizeof(buf));
+            _preferences.end();
+        }
+
+        void load()
+        {
+            uint8_t buf[ROUTE_COUNT * 3];
+            _preferences.begin("routing", true);
+            size_t length = _preferences.isKey("routes") ? _preferences.getBytes("routes", buf, sizeof(buf)) : 0;
+            _preferences.end();
+            if (length != sizeof(buf))
+                return;
+            for (uint8_t i = 0; i < ROUTE_COUNT; i++)
+            {
+                _routes[i].enabled = buf[i * 3];
+                _routes[i].channelMask = buf[i * 3 + 1] | (buf[i * 3 + 2] << 8);
+            }
+        }
+    };
+};
@@ -0,0 +1,377 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "./utils/log.h"
+#include "./utils/gpio.h"
+
+// Inputs behind multiplexers, shift registers and key matrices, scanned at a fixed rate.
+// A PinConfig in one of the scanned modes uses its pin byte as the channel on that bus:
+//   mux     analog multiplexers (74HC4067 and alike) sharing their select lines, one signal pin each,
+//           channel = signal * 2^selects + select state
+//   shift   a chain of 74HC165 parallel in shift registers, channel = bit, the first bit out is 0
+//   matrix  diode matrix, rows driven low one at a time, columns pulled up, channel = row * columns + column
+// Switches are active low like the pulled up GPIO inputs, and reported after ENOMIK_SCAN_DEBOUNCE_US.
+// Mux channels are converted with analogRead, ENOMIK_SCAN_MUX_STEPS select states per scan, so a large
+// mux bank is spread over several scans instead of stretching one; analog pins leave the continuous ADC
+// driver while a mux is set. Buses are set up in the sketch before client.begin(), e.g.
+// client.io.getScanner().setMatrix(rows, 8, columns, 8).
+// Velocity keys on a matrix need finer timing than the 1 kHz scan: with setMatrixPeriod() the matrix
+// leaves scan() and pollMatrix() scans it at that period, every change stamped with the time its row
+// was read.
+
+#ifndef ENOMIK_SCAN_PERIOD_US
+#define ENOMIK_SCAN_PERIOD_US 1000 // 1 kHz
+#endif
+#ifndef ENOMIK_SCAN_SETTLE_US
+#define ENOMIK_SCAN_SETTLE_US 3 // after switching mux selects or a matrix row
+#endif
+#ifndef ENOMIK_SCAN_DEBOUNCE_US
+#define ENOMIK_SCAN_DEBOUNCE_US 4000
+#endif
+#ifndef ENOMIK_SCAN_MUX_STEPS
+#define ENOMIK_SCAN_MUX_STEPS 4 // select states per scan
+#endif
+#ifndef ENOMIK_SCAN_VELOCITY_PERIOD_US
+#define ENOMIK_SCAN_VELOCITY_PERIOD_US 250 // matrix with velocity keys, 4 kHz. 8 rows take ~40 µs a scan
+#endif
+#define ENOMIK_SCAN_MAX_CHANNELS 128
+#define ENOMIK_SCAN_MAX_LINES 16 // select, signal, row and column pins per bus
+
+namespace enomik
+{
+    enum ScanBus : uint8_t
+    {
+        SCAN_MUX = 0,
+        SCAN_SHIFT = 1,
+        SCAN_MATRIX = 2,
+        SCAN_BUSES
+    };
+
+    struct ScanStats
+    {
+        uint32_t scans = 0;
+        uint32_t matrixScans = 0; // by pollMatrix()
+        uint32_t muxPasses = 0;   // all mux channels read once
+        uint32_t changes = 0;     // switch changes reported
+        uint32_t late = 0;        // scans that started more than half a period late
+        uint32_t maxScanUs = 0;
+        // Over the last second
+        uint32_t scanHz = 0;
+        uint32_t matrixHz = 0; // pollMatrix() scans
+        uint32_t muxHz = 0;
+        uint32_t avgScanUs = 0;
+        uint16_t cpuPermille = 0; // of one core, scan() and pollMatrix()
+    };
+
+    class InputScanner
+    {
+    public:
+        bool setMux(const uint8_t *selects, uint8_t selectCount, const uint8_t *signals, uint8_t signalCount)
+        {
+            if (selectCount > 7 || signalCount > ENOMIK_SCAN_MAX_LINES ||
+                (signalCount << selectCount) > ENOMIK_SCAN_MAX_CHANNELS)
+            {
+                ENOMIK_LOGW("Mux: %d selects and %d signals are too many channels", selectCount, signalCount);
+                return false;
+            }
+            memcpy(_muxSelects, selects, selectCount);
+            memcpy(_muxSignals, signals, signalCount);
+            _muxSelectCount = selectCount;
+            _muxSignalCount = signalCount;
+            _muxState = 0;
+            for (uint8_t i = 0; i < selectCount; i++)
+            {
+                pinMode(selects[i], OUTPUT);
+                digitalWrite(selects[i], LOW);
+            }
+            _channels[SCAN_MUX] = signalCount << selectCount;
+            return true;
+        }
+
+        bool setShiftChain(uint8_t data, uint8_t clock, uint8_t latch, uint8_t bits)
+        {
+            if (bits > ENOMIK_SCAN_MAX_CHANNELS)
+                return false;
+            _shiftData = data;
+            _shiftClock = clock;
+            _shiftLatch = latch;
+            pinMode(data, INPUT);
+            pinMode(clock, OUTPUT);
+            pinMode(latch, OUTPUT);
+            digitalWrite(clock, LOW);
+            digitalWrite(latch, HIGH);
+            resetSwitches(SCAN_SHIFT, bits);
+            return true;
+        }
+
+        bool setMatrix(const uint8_t *rows, uint8_t rowCount, const uint8_t *columns, uint8_t columnCount)
+        {
+            if (rowCount > ENOMIK_SCAN_MAX_LINES || columnCount > ENOMIK_SCAN_MAX_LINES ||
+                rowCount * columnCount > ENOMIK_SCAN_MAX_CHANNELS)
+            {
+                ENOMIK_LOGW("Matrix: %d x %d are too many channels", rowCount, columnCount);
+                return false;
+            }
+            memcpy(_rows, rows, rowCount);
+            memcpy(_columns, columns, columnCount);
+            _rowCount = rowCount;
+            _columnCount = columnCount;
+            for (uint8_t i = 0; i < rowCount; i++)
+            {
+                pinMode(rows[i], OUTPUT);
+                digitalWrite(rows[i], HIGH);
+            }
+            for (uint8_t i = 0; i < columnCount; i++)
+                pinMode(columns[i], INPUT_PULLUP);
+            resetSwitches(SCAN_MATRIX, rowCount * columnCount);
+            return true;
+        }
+
+        inline uint8_t channels(uint8_t bus) const
+        {
+            return bus < SCAN_BUSES ? _channels[bus] : 0;
+        }
+
+        // 0: the matrix is scanned with the other buses by scan(). Otherwise by pollMatrix(), every periodUs
+        void setMatrixPeriod(uint32_t periodUs)
+        {
+            _matrixPeriodUs = periodUs;
+        }
+
+        // Call regularly, scans once per ENOMIK_SCAN_PERIOD_US. report(uint8_t bus, uint8_t channel, int value,
+        // uint32_t us) gets every mux sample and every debounced switch change (0 = closed), us is when the
+        // value was read
+        template <typename Report>
+        inline void scan(Report report)
+        {
+            bool matrix = _channels[SCAN_MATRIX] && !_matrixPeriodUs;
+            if (!_channels[SCAN_MUX] && !_channels[SCAN_SHIFT] && !matrix)
+                return;
+            uint32_t start = esp_timer_get_time();
+            int32_t behind = start - _nextScanUs;
+            if (_stats.scans && behind < -(int32_t)(ENOMIK_SCAN_PERIOD_US / 8))
+                return; // called more often than the scan rate
+            if (!_stats.scans || behind > (int32_t)(ENOMIK_SCAN_PERIOD_US / 2))
+            {
+                if (_stats.scans)
+                    _stats.late++;
+                _nextScanUs = start; // no catching up in bursts
+            }
+            _nextScanUs += ENOMIK_SCAN_PERIOD_US;
+
+            if (_channels[SCAN_SHIFT])
+                scanShift(start, report);
+            if (matrix)
+                scanMatrix(start, report);
+            if (_channels[SCAN_MUX])
+                scanMux(report);
+
+            uint32_t us = esp_timer_get_time() - start;
+            _stats.scans++;
+            if (us > _stats.maxScanUs)
+                _stats.maxScanUs = us;
+            _windowScans++;
+            _windowBusyUs += us;
+            updateWindow(start);
+        }
+
+        // Call on every loop pass, scans the matrix once per setMatrixPeriod(). Same report as scan()
+        template <typename Report>
+        inline void pollMatrix(Report report)
+        {
+            if (!_matrixPeriodUs || !_channels[SCAN_MATRIX])
+                return;
+            uint32_t start = esp_timer_get_time();
+            int32_t behind = start - _nextMatrixUs;
+            if (behind < 0)
+                return;
+            // No catching up in bursts
+            _nextMatrixUs = behind > (int32_t)_matrixPeriodUs ? start + _matrixPeriodUs : _nextMatrixUs + _matrixPeriodUs;
+            scanMatrix(start, report);
+            _stats.matrixScans++;
+            _windowMatrixScans++;
+            _windowMatrixBusyUs += esp_timer_get_time() - start;
+            updateWindow(start);
+        }
+
+        const ScanStats &getStats() const
+        {
+            return _stats;
+        }
+
+        void printStats(Print &out) const
+        {
+            out.println("=== Input scan ===");
+            out.printf("channels | mux %d, shift %d, matrix %d\n", _channels[SCAN_MUX], _channels[SCAN_SHIFT],
+                       _channels[SCAN_MATRIX]);
+            out.printf("scans/s %u (nominal %u), mux passes/s %u, late %u\n", _stats.scanHz,
+                       1000000 / ENOMIK_SCAN_PERIOD_US, _stats.muxHz, _stats.late);
+            if (_matrixPeriodUs)
+                out.printf("matrix scans/s %u (nominal %u)\n", _stats.matrixHz, 1000000 / _matrixPeriodUs);
+            out.printf("scan us: avg %u, max %u | cpu %u.%u%%\n", _stats.avgScanUs, _stats.maxScanUs,
+                       _stats.cpuPermille / 10, _stats.cpuPermille % 10);
+            out.printf("changes %u\n", _stats.changes);
+            out.println("==================");
+        }
+
+    private:
+        uint8_t _channels[SCAN_BUSES] = {};
+        ScanStats _stats;
+        uint32_t _nextScanUs = 0;
+        uint32_t _windowStartUs = 0;
+        uint32_t _windowScans = 0;
+        uint32_t _windowMatrixScans = 0;
+        uint32_t _windowMuxPasses = 0;
+        uint32_t _windowBusyUs = 0;
+        uint32_t _windowMatrixBusyUs = 0; // pollMatrix(), counted in cpuPermille only
+
+        uint8_t _muxSelects[ENOMIK_SCAN_MAX_LINES];
+        uint8_t _muxSignals[ENOMIK_SCAN_MAX_LINES];
+        uint8_t _muxSelectCount = 0;
+        uint8_t _muxSignalCount = 0;
+        uint8_t _muxState = 0; // select state the next scan starts at
+
+        uint8_t _shiftData = 0, _shiftClock = 0, _shiftLatch = 0;
+
+        uint8_t _rows[ENOMIK_SCAN_MAX_LINES];
+        uint8_t _columns[ENOMIK_SCAN_MAX_LINES];
+        uint8_t _rowCount = 0;
+        uint8_t _columnCount = 0;
+        uint32_t _matrixPeriodUs = 0;
+        uint32_t _nextMatrixUs = 0;
+        uint32_t _rowUs[ENOMIK_SCAN_MAX_LINES]; // when each row was read in the last matrix scan
+
+        // Switch buses, one bit per channel, 1 = open
+        uint64_t _levels[SCAN_BUSES][2];
+        uint32_t _changedUs[SCAN_BUSES][ENOMIK_SCAN_MAX_CHANNELS];
+        uint64_t _held[SCAN_BUSES][2] = {}; // changes waiting for the debounce, first seen at _heldUs
+        uint32_t _heldUs[SCAN_BUSES][ENOMIK_SCAN_MAX_CHANNELS];
+
+        void updateWindow(uint32_t now)
+        {
+            uint32_t elapsed = now - _windowStartUs;
+            if (elapsed < 1000000)
+                return;
+            _stats.scanHz = (uint64_t)_windowScans * 1000000 / elapsed;
+            _stats.matrixHz = (uint64_t)_windowMatrixScans * 1000000 / elapsed;
+            _stats.muxHz = (uint64_t)_windowMuxPasses * 1000000 / elapsed;
+            _stats.avgScanUs = _windowScans ? _windowBusyUs / _windowScans : 0;
+            _stats.cpuPermille = (uint64_t)(_windowBusyUs + _windowMatrixBusyUs) * 1000 / elapsed;
+            _windowStartUs = now;
+            _windowScans = 0;
+            _windowMatrixScans = 0;
+            _windowMuxPasses = 0;
+            _windowBusyUs = 0;
+            _windowMatrixBusyUs = 0;
+        }
+
+        void resetSwitches(uint8_t bus, uint8_t channels)
+        {
+            _levels[bus][0] = _levels[bus][1] = ~0ULL; // open, a closed switch is reported on the first scan
+            _held[bus][0] = _held[bus][1] = 0;
+            memset(_changedUs[bus], 0, sizeof(_changedUs[bus]));
+            _channels[bus] = channels;
+        }
+
+        // Compares 64 channels with the reported levels, only differing channels cost anything
+        template <typename Report>
+        inline void update(uint8_t bus, uint8_t word, uint64_t levels, uint32_t now, Report &report)
+        {
+            uint64_t changed = levels ^ _levels[bus][word];
+            _held[bus][word] &= changed; // back at the reported level, a bounce
+            while (changed)
+            {
+                uint8_t bit = __builtin_ctzll(changed);
+                changed &= changed - 1;
+                uint8_t channel = word * 64 + bit;
+                if (channel >= _channels[bus])
+                    continue;
+                uint32_t us = bus == SCAN_MATRIX ? _rowUs[channel / _columnCount] : now;
+                if (now - _changedUs[bus][channel] < ENOMIK_SCAN_DEBOUNCE_US)
+                {
+                    // Picked up by a later scan if it holds, with the time it was first seen (velocity keys)
+                    if (!(_held[bus][word] & (1ULL << bit)))
+                    {
+                        _held[bus][word] |= 1ULL << bit;
+                        _heldUs[bus][channel] = us;
+                    }
+                    continue;
+                }
+                if (_held[bus][word] & (1ULL << bit))
+                {
+                    us = _heldUs[bus][channel];
+                    _held[bus][word] &= ~(1ULL << bit);
+                }
+                _levels[bus][word] ^= 1ULL << bit;
+                _changedUs[bus][channel] = now;
+                _stats.changes++;
+                report(bus, channel, (int)((levels >> bit) & 1), us);
+            }
+        }
+
+        template <typename Report>
+        inline void scanShift(uint32_t now, Report &report)
+        {
+            // Load the parallel inputs, then shift them out, first bit is already on the data pin
+            digitalWrite(_shiftLatch, LOW);
+            delayMicroseconds(1);
+            digitalWrite(_shiftLatch, HIGH);
+            uint64_t levels[2] = {0, 0};
+            for (uint8_t i = 0; i < _channels[SCAN_SHIFT]; i++)
+            {
+                if (digitalRead(_shiftData))
+                    levels[i >> 6] |= 1ULL << (i & 63);
+                digitalWrite(_shiftClock, HIGH);
+                digitalWrite(_shiftClock, LOW);
+            }
+            update(SCAN_SHIFT, 0, levels[0], now, report);
+            if (_channels[SCAN_SHIFT] > 64)
+                update(SCAN_SHIFT, 1, levels[1], now, report);
+        }
+
+        template <typename Report>
+        inline void scanMatrix(uint32_t now, Report &report)
+        {
+            uint64_t levels[2] = {0, 0};
+            uint8_t channel = 0;
+            for (uint8_t row = 0; row < _rowCount; row++)
+            {
+                digitalWrite(_rows[row], LOW);
+                delayMicroseconds(ENOMIK_SCAN_SETTLE_US);
+                uint64_t port = readGpioInputs(); // all columns of the row at once
+                _rowUs[row] = esp_timer_get_time();
+                digitalWrite(_rows[row], HIGH);
+                for (uint8_t column = 0; column < _columnCount; column++, channel++)
+                {
+                    if ((port >> _columns[column]) & 1)
+                        levels[channel >> 6] |= 1ULL << (channel & 63);
+                }
+            }
+            update(SCAN_MATRIX, 0, levels[0], now, report);
+            if (_channels[SCAN_MATRIX] > 64)
+                update(SCAN_MATRIX, 1, levels[1], now, report);
+        }
+
+        template <typename Report>
+        inline void scanMux(Report &report)
+        {
+            uint8_t states = 1 << _muxSelectCount;
+            for (uint8_t step = 0; step < ENOMIK_SCAN_MUX_STEPS && step < states; step++)
+            {
+                for (uint8_t i = 0; i < _muxSelectCount; i++)
+                    digitalWrite(_muxSelects[i], (_muxState >> i) & 1);
+                delayMicroseconds(ENOMIK_SCAN_SETTLE_US);
+                for (uint8_t signal = 0; signal < _muxSignalCount; signal++)
+                    report(SCAN_MUX, (uint8_t)(signal * states + _muxState), (int)analogRead(_muxSignals[signal]),
+                           (uint32_t)esp_timer_get_time());
+                if (++_muxState == states)
+                {
+                    _muxState = 0;
+                    _stats.muxPasses++;
+                    _windowMuxPasses++;
+                }
+            }
+        }
+    };
+}
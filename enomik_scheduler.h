@@ -0,0 +1,221 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "./utils/callback.h"
+
+#ifndef SCHEDULER_MAX_TASKS
+#define SCHEDULER_MAX_TASKS 8
+#endif
+#ifndef SCHEDULER_LOOP_BUDGET_US
+#define SCHEDULER_LOOP_BUDGET_US 2000 // periodic work per loop() before the rest waits for the next pass
+#endif
+#define SCHEDULER_HISTOGRAM_BUCKETS 24 // powers of two, 0 µs up to ~8 s
+
+namespace enomik
+{
+    // Power of two buckets: 0 holds 0 µs, n holds [2^(n-1), 2^n)
+    struct TimeHistogram
+    {
+        uint32_t counts[SCHEDULER_HISTOGRAM_BUCKETS] = {};
+        uint32_t total = 0;
+        uint32_t maxUs = 0;
+
+        void add(uint32_t us)
+        {
+            int bucket = us ? 32 - __builtin_clz(us) : 0;
+            counts[bucket < SCHEDULER_HISTOGRAM_BUCKETS ? bucket : SCHEDULER_HISTOGRAM_BUCKETS - 1]++;
+            total++;
+            if (us > maxUs)
+                maxUs = us;
+        }
+
+        // Upper bound of the bucket holding the p-th percentile
+        uint32_t percentile(float p) const
+        {
+            uint32_t target = (uint32_t)(p / 100.0f * total + 0.5f);
+            uint32_t seen = 0;
+            for (int i = 0; i < SCHEDULER_HISTOGRAM_BUCKETS; i++)
+            {
+                seen += counts[i];
+                if (counts[i] && seen >= target)
+                {
+                    uint32_t upper = i ? (uint32_t)1 << i : 0;
+                    return upper < maxUs ? upper : maxUs;
+                }
+            }
+            return maxUs;
+        }
+
+        void clear()
+        {
+            *this = TimeHistogram();
+        }
+    };
+
+    struct SchedulerTask
+    {
+        const char *name = nullptr;
+        Callback<void()> run;
+        uint32_t periodUs = 0; // 0 runs every loop, ahead of the periodic tasks
+        uint32_t budgetUs = 0; // expected worst case, runs above it count as overruns
+        int64_t nextUs = 0;
+        int64_t lastStartUs = 0;
+        uint32_t averageUs = 0;
+
+        uint32_t runs = 0;
+        uint32_t overruns = 0; // took longer than budgetUs
+        uint32_t missed = 0;   // periods skipped entirely
+        uint32_t deferred = 0; // due, but the loop budget was used up
+        TimeHistogram runtime;
+        TimeHistogram period;
+    };
+
+    // Cooperative scheduler for Client::loop.
+    // Tasks with period 0 (MIDI I/O) run on every pass. Periodic tasks run at a fixed rate in the order
+    // they were added, as long as the loop budget lasts; a due task that doesn't fit waits for the next
+    // pass, at least one periodic task runs per pass so nothing starves.
+    class Scheduler
+    {
+    public:
+        // Returns the task id or -1 when full
+        template <typename Handler>
+        int add(const char *name, Handler &&handler, uint32_t periodUs, uint32_t budgetUs = 0)
+        {
+            if (_count >= SCHEDULER_MAX_TASKS)
+                return -1;
+            SchedulerTask &task = _tasks[_count];
+            task.name = name;
+            task.run = Callback<void()>(std::forward<Handler>(handler));
+            task.periodUs = periodUs;
+            task.budgetUs = budgetUs;
+            task.nextUs = esp_timer_get_time();
+            return _count++;
+        }
+
+        int add(const char *name, void (*handler)(void *context), void *context, uint32_t periodUs, uint32_t budgetUs = 0)
+        {
+            return add(name, Callback<void()>(handler, context), periodUs, budgetUs);
+        }
+
+        void setPeriod(int id, uint32_t periodUs)
+        {
+            if (id >= 0 && id < _count)
+                _tasks[id].periodUs = periodUs;
+        }
+
+        void run()
+        {
+            int64_t start = esp_timer_get_time();
+            if (_lastRunUs)
+                _loopPeriod.add(start - _lastRunUs);
+            _lastRunUs = start;
+
+            for (int i = 0; i < _count; i++)
+            {
+                if (_tasks[i].periodUs == 0)
+                    execute(_tasks[i], esp_timer_get_time());
+            }
+
+            bool ranPeriodic = false;
+            for (int i = 0; i < _count; i++)
+            {
+                SchedulerTask &task = _tasks[i];
+                if (task.periodUs == 0)
+                    continue;
+                int64_t now = esp_timer_get_time();
+                if (now < task.nextUs)
+                    continue;
+                if (ranPeriodic && now - start + task.averageUs > _loopBudgetUs)
+                {
+                    task.deferred++;
+                    continue;
+                }
+
+                execute(task, now);
+                ranPeriodic = true;
+
+                // Fixed rate: keep the phase, skip whole periods when far behind
+                task.nextUs += task.periodUs;
+                if (task.nextUs <= now)
+                {
+                    uint32_t behind = (now - task.nextUs) / task.periodUs + 1;
+                    task.missed += behind;
+                    task.nextUs += (int64_t)behind * task.periodUs;
+                }
+            }
+        }
+
+        void setLoopBudget(uint32_t us)
+        {
+            _loopBudgetUs = us;
+        }
+
+        int count() const
+        {
+            return _count;
+        }
+
+        const SchedulerTask &get(int id) const
+        {
+            return _tasks[id];
+        }
+
+        const TimeHistogram &getLoopPeriod() const
+        {
+            return _loopPeriod;
+        }
+
+        void resetStats()
+        {
+            for (int i = 0; i < _count; i++)
+            {
+                SchedulerTask &task = _tasks[i];
+                task.runs = task.overruns = task.missed = task.deferred = 0;
+                task.runtime.clear();
+                task.period.clear();
+            }
+            _loopPeriod.clear();
+        }
+
+        void printStats(Print &out)
+        {
+            out.println("=== Scheduler ===");
+            out.printf("loop period us: p50 %u, p99 %u, max %u\n",
+                       _loopPeriod.percentile(50), _loopPeriod.percentile(99), _loopPeriod.maxUs);
+            for (int i = 0; i < _count; i++)
+            {
+                const SchedulerTask &task = _tasks[i];
+                out.printf("%-10s every %6u us | runs %u, overruns %u, missed %u, deferred %u\n",
+                           task.name, task.periodUs, task.runs, task.overruns, task.missed, task.deferred);
+                out.printf("%-10s runtime us: p50 %u, p99 %u, max %u (budget %u) | period us: p50 %u, p99 %u, max %u\n",
+                           "", task.runtime.percentile(50), task.runtime.percentile(99), task.runtime.maxUs, task.budgetUs,
+                           task.period.percentile(50), task.period.percentile(99), task.period.maxUs);
+            }
+            out.println("=================");
+        }
+
+    private:
+        SchedulerTask _tasks[SCHEDULER_MAX_TASKS];
+        int _count = 0;
+        uint32_t _loopBudgetUs = SCHEDULER_LOOP_BUDGET_US;
+        int64_t _lastRunUs = 0;
+        TimeHistogram _loopPeriod;
+
+        void execute(SchedulerTask &task, int64_t now)
+        {
+            if (task.lastStartUs)
+                task.period.add(now - task.lastStartUs);
+            task.lastStartUs = now;
+
+            task.run();
+
+            uint32_t elapsed = esp_timer_get_time() - now;
+            task.runtime.add(elapsed);
+            task.averageUs = task.runs ? (task.averageUs * 7 + elapsed) / 8 : elapsed;
+            task.runs++;
+            if (task.budgetUs && elapsed > task.budgetUs)
+                task.overruns++;
+        }
+    };
+}
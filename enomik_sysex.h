@@ -1,5 +1,6 @@
 #include "./enomik_pinconfig.h"
 #include "./version.h"
+#include "./utils/log.h"
 
 namespace enomik
 {
@@ -19,12 +20,15 @@ namespace enomik
         GET_PEERS = 0x08,
         RESET = 0x09,
         GET_VERSION = 0x0A,
+        SET_ROUTE = 0x0B,
+        GET_ROUTES = 0x0C,
 
         // Response codes (command + 64)
         GET_PIN_CONFIG_RESPONSE = 0x42,      // 66
         GET_ALL_PIN_CONFIGS_RESPONSE = 0x44, // 68
         GET_PEERS_RESPONSE = 0x48,           // 72
-        GET_VERSION_RESPONSE = 0x4A          // 74
+        GET_VERSION_RESPONSE = 0x4A,         // 74
+        GET_ROUTES_RESPONSE = 0x4C           // 76
     };
 
     struct SysExPacket
@@ -146,8 +150,13 @@ namespace enomik
             pkt.data[10] = (cfg.midi_type == MidiStatus::MIDI_CONTROL_CHANGE) ? cfg.midi_cc : cfg.midi_note;
             pkt.data[11] = cfg.min_midi_value;
             pkt.data[12] = cfg.max_midi_value;
-            pkt.data[13] = SysExPacket::END_BYTE;
-            pkt.length = 14;
+            pkt.data[13] = cfg.filter;
+            pkt.data[14] = cfg.filter_param;
+            pkt.data[15] = cfg.slew;
+            pkt.data[16] = cfg.contact_pin;
+            pkt.data[17] = cfg.velocity_curve;
+            pkt.data[18] = SysExPacket::END_BYTE;
+            pkt.length = 19;
             return pkt;
         }
 
@@ -175,6 +184,31 @@ namespace enomik
             return pkt;
         }
 
+        // Encode routes: per route id, enabled, channel mask as 3 x 7 bit (bits 0-6, 7-13, 14-15)
+        static SysExPacket encodeRoutes(const bool *enabled, const uint16_t *channelMasks, uint8_t count)
+        {
+            SysExPacket pkt;
+            pkt.data[0] = SysExPacket::START_BYTE;
+            pkt.data[1] = SysExPacket::MANUFACTURER_ID;
+            pkt.data[2] = PROTOCOL_VERSION_MAJOR;
+            pkt.data[3] = PROTOCOL_VERSION_MINOR;
+            pkt.data[4] = static_cast<uint8_t>(SysExCommand::GET_ROUTES_RESPONSE);
+
+            int idx = 5;
+            for (uint8_t i = 0; i < count; i++)
+            {
+                pkt.data[idx++] = i;
+                pkt.data[idx++] = enabled[i] ? 1 : 0;
+                pkt.data[idx++] = channelMasks[i] & 0x7F;
+                pkt.data[idx++] = (channelMasks[i] >> 7) & 0x7F;
+                pkt.data[idx++] = (channelMasks[i] >> 14) & 0x03;
+            }
+
+            pkt.data[idx++] = SysExPacket::END_BYTE;
+            pkt.length = idx;
+            return pkt;
+        }
+
         // Convert SysExPacket to midi_sysex_message
         static midi_sysex_message toMidiMessage(const SysExPacket &pkt)
         {
@@ -209,12 +243,8 @@ namespace enomik
             if (length < 8)
                 return false;
 
-            Serial.println("Decoding PinConfig from SysEx payload");
-            Serial.println(payload[3]);
-            Serial.println(payload[4]);
-            Serial.println(payload[5]);
-            Serial.println(payload[6]);
-            Serial.println(payload[7]);
+            ENOMIK_LOGD("Decoding PinConfig from SysEx payload: %d %d %d %d %d",
+                        payload[3], payload[4], payload[5], payload[6], payload[7]);
 
             cfg.pin = payload[0];
             cfg.mode = payload[1];
@@ -225,16 +255,36 @@ namespace enomik
             cfg.midi_note = payload[5];
             cfg.min_midi_value = payload[6];
             cfg.max_midi_value = payload[7];
+            // Optional, older tools end here
+            cfg.filter = length > 8 ? payload[8] : 0;
+            cfg.filter_param = length > 9 ? payload[9] : 0;
+            cfg.slew = length > 10 ? payload[10] & 0x7F : 0;
+            cfg.contact_pin = length > 11 ? payload[11] & 0x7F : PIN_CONFIG_NO_PIN;
+            cfg.velocity_curve = length > 12 ? payload[12] & 0x7F : 0;
 
             return true;
         }
 
+        // Decode route: id, enabled, channel mask as 3 x 7 bit
+        static bool decodeRoute(const uint8_t *payload, uint16_t length, uint8_t &route, bool &enabled, uint16_t &channelMask)
+        {
+            if (length < 5)
+                return false;
+            route = payload[0];
+            enabled = payload[1] != 0;
+            channelMask = payload[2] | (payload[3] << 7) | ((payload[4] & 0x03) << 14);
+            return true;
+        }
+
         // Decode single pin number
-        static bool decodePin(const uint8_t *payload, uint16_t length, uint8_t &pin)
+        // Pin and an optional mode byte, which tells a GPIO from a channel on a scanned bus. 0 (a GPIO
+        // mode) when missing
+        static bool decodePin(const uint8_t *payload, uint16_t length, uint8_t &pin, uint8_t &mode)
         {
             if (length < 1)
                 return false;
             pin = payload[0];
+            mode = length > 1 ? payload[1] : 0;
             return true;
         }
     };
@@ -244,10 +294,11 @@ namespace enomik
     public:
         // Callbacks for different SysEx commands
         using PinConfigCallback = std::function<void(const PinConfig &)>;
-        using PinQueryCallback = std::function<void(uint8_t pin)>;
+        using PinQueryCallback = std::function<void(uint8_t pin, uint8_t mode)>;
         using VoidCallback = std::function<void()>;
         using MACCallback = std::function<void(const uint8_t mac[6])>;
         using SendCallback = std::function<void(const midi_sysex_message &)>;
+        using RouteCallback = std::function<void(uint8_t route, bool enabled, uint16_t channelMask)>;
 
         void setOnSetPinConfig(PinConfigCallback cb) { _onSetPinConfig = cb; }
         void setOnGetPinConfig(PinQueryCallback cb) { _onGetPinConfig = cb; }
@@ -260,6 +311,8 @@ namespace enomik
         void setOnReset(VoidCallback cb) { _onReset = cb; }
         void setOnGetVersion(VoidCallback cb) { _onGetVersion = cb; }
         void setOnSend(SendCallback cb) { _onSend = cb; }
+        void setOnSetRoute(RouteCallback cb) { _onSetRoute = cb; }
+        void setOnGetRoutes(VoidCallback cb) { _onGetRoutes = cb; }
 
         // Main entry point for handling incoming SysEx messages
         void handleSysEx(const uint8_t *data, uint16_t length)
@@ -267,7 +320,7 @@ namespace enomik
             // Validate minimum length
             if (length < SysExPacket::MIN_PACKET_SIZE)
             {
-                Serial.println("SysEx: Invalid packet length");
+                ENOMIK_LOGW("SysEx: Invalid packet length");
                 return;
             }
 
@@ -278,21 +331,15 @@ namespace enomik
 
             if (!packet.isValid())
             {
-                Serial.println("SysEx: Invalid packet format");
+                ENOMIK_LOGW("SysEx: Invalid packet format");
                 return;
             }
 
             // Check version compatibility
             if (!packet.isVersionCompatible())
             {
-                Serial.print("SysEx: Incompatible protocol version ");
-                Serial.print(packet.getMajorVersion());
-                Serial.print(".");
-                Serial.print(packet.getMinorVersion());
-                Serial.print(" (expected ");
-                Serial.print(PROTOCOL_VERSION_MAJOR);
-                Serial.print(".x)");
-                Serial.println();
+                ENOMIK_LOGW("SysEx: Incompatible protocol version %d.%d (expected %d.x)",
+                            packet.getMajorVersion(), packet.getMinorVersion(), PROTOCOL_VERSION_MAJOR);
                 return;
             }
 
@@ -364,6 +411,8 @@ namespace enomik
         VoidCallback _onReset;
         VoidCallback _onGetVersion;
         SendCallback _onSend;
+        RouteCallback _onSetRoute;
+        VoidCallback _onGetRoutes;
 
         void routeCommand(const SysExPacket &packet)
         {
@@ -371,8 +420,7 @@ namespace enomik
             const uint8_t *payload = packet.getPayload();
             uint16_t payloadLen = packet.getPayloadLength();
 
-            Serial.print("SysEx: Handling command 0x");
-            Serial.println(static_cast<uint8_t>(cmd), HEX);
+            ENOMIK_LOGD("SysEx: Handling command 0x%02X", static_cast<uint8_t>(cmd));
 
             switch (cmd)
             {
@@ -416,9 +464,17 @@ namespace enomik
                 handleGetVersion();
                 break;
 
+            case SysExCommand::SET_ROUTE:
+                handleSetRoute(payload, payloadLen);
+                break;
+
+            case SysExCommand::GET_ROUTES:
+                if (_onGetRoutes)
+                    _onGetRoutes();
+                break;
+
             default:
-                Serial.print("SysEx: Unknown command: 0x");
-                Serial.println(static_cast<uint8_t>(cmd), HEX);
+                ENOMIK_LOGW("SysEx: Unknown command: 0x%02X", static_cast<uint8_t>(cmd));
                 break;
             }
         }
@@ -427,20 +483,19 @@ namespace enomik
         {
             if (!_onSetPinConfig)
             {
-                Serial.println("SysEx: No SET_PIN_CONFIG handler");
+                ENOMIK_LOGW("SysEx: No SET_PIN_CONFIG handler");
                 return;
             }
 
             PinConfig cfg(0, 0);
             if (SysExDecoder::decodePinConfig(payload, length, cfg))
             {
-                Serial.print("SysEx: Setting config for pin ");
-                Serial.println(cfg.pin);
+                ENOMIK_LOGD("SysEx: Setting config for pin %d", cfg.pin);
                 _onSetPinConfig(cfg);
             }
             else
             {
-                Serial.println("SysEx: Failed to decode pin config");
+                ENOMIK_LOGW("SysEx: Failed to decode pin config");
             }
         }
 
@@ -448,20 +503,19 @@ namespace enomik
         {
             if (!_onGetPinConfig)
             {
-                Serial.println("SysEx: No GET_PIN_CONFIG handler");
+                ENOMIK_LOGW("SysEx: No GET_PIN_CONFIG handler");
                 return;
             }
 
-            uint8_t pin;
-            if (SysExDecoder::decodePin(payload, length, pin))
+            uint8_t pin, mode;
+            if (SysExDecoder::decodePin(payload, length, pin, mode))
             {
-                Serial.print("SysEx: Getting config for pin ");
-                Serial.println(pin);
-                _onGetPinConfig(pin);
+                ENOMIK_LOGD("SysEx: Getting config for pin %d, mode 0x%02X", pin, mode);
+                _onGetPinConfig(pin, mode);
             }
             else
             {
-                Serial.println("SysEx: Failed to decode pin number");
+                ENOMIK_LOGW("SysEx: Failed to decode pin number");
             }
         }
 
@@ -469,20 +523,19 @@ namespace enomik
         {
             if (!_onDeletePinConfig)
             {
-                Serial.println("SysEx: No DELETE_PIN_CONFIG handler");
+                ENOMIK_LOGW("SysEx: No DELETE_PIN_CONFIG handler");
                 return;
             }
 
-            uint8_t pin;
-            if (SysExDecoder::decodePin(payload, length, pin))
+            uint8_t pin, mode;
+            if (SysExDecoder::decodePin(payload, length, pin, mode))
             {
-                Serial.print("SysEx: Deleting config for pin ");
-                Serial.println(pin);
-                _onDeletePinConfig(pin);
+                ENOMIK_LOGD("SysEx: Deleting config for pin %d, mode 0x%02X", pin, mode);
+                _onDeletePinConfig(pin, mode);
             }
             else
             {
-                Serial.println("SysEx: Failed to decode pin number");
+                ENOMIK_LOGW("SysEx: Failed to decode pin number");
             }
         }
 
@@ -490,7 +543,7 @@ namespace enomik
         {
             if (_onClearPinConfigs)
             {
-                Serial.println("SysEx: Clearing all pin configs");
+                ENOMIK_LOGD("SysEx: Clearing all pin configs");
                 _onClearPinConfigs();
             }
         }
@@ -499,7 +552,7 @@ namespace enomik
         {
             if (_onGetAllPinConfigs)
             {
-                Serial.println("SysEx: Getting all pin configs");
+                ENOMIK_LOGD("SysEx: Getting all pin configs");
                 _onGetAllPinConfigs();
             }
         }
@@ -508,7 +561,7 @@ namespace enomik
         {
             if (_onGetMAC)
             {
-                Serial.println("SysEx: Getting MAC address");
+                ENOMIK_LOGD("SysEx: Getting MAC address");
                 _onGetMAC();
             }
         }
@@ -517,26 +570,19 @@ namespace enomik
         {
             if (!_onAddPeer)
             {
-                Serial.println("SysEx: No ADD_PEER handler");
+                ENOMIK_LOGW("SysEx: No ADD_PEER handler");
                 return;
             }
 
             uint8_t mac[6];
             if (SysExDecoder::decodeMAC(payload, length, mac))
             {
-                Serial.print("SysEx: Adding peer: ");
-                for (int i = 0; i < 6; i++)
-                {
-                    Serial.print(mac[i], HEX);
-                    if (i < 5)
-                        Serial.print(":");
-                }
-                Serial.println();
+                ENOMIK_LOGD("SysEx: Adding peer: " ENOMIK_LOG_MAC_FORMAT, ENOMIK_LOG_MAC_ARGS(mac));
                 _onAddPeer(mac);
             }
             else
             {
-                Serial.println("SysEx: Failed to decode MAC address");
+                ENOMIK_LOGW("SysEx: Failed to decode MAC address");
             }
         }
 
@@ -544,7 +590,7 @@ namespace enomik
         {
             if (_onGetPeers)
             {
-                Serial.println("SysEx: Getting peers");
+                ENOMIK_LOGD("SysEx: Getting peers");
                 _onGetPeers();
             }
         }
@@ -553,16 +599,37 @@ namespace enomik
         {
             if (_onReset)
             {
-                Serial.println("SysEx: Performing reset");
+                ENOMIK_LOGD("SysEx: Performing reset");
                 _onReset();
             }
         }
 
+        void handleSetRoute(const uint8_t *payload, uint16_t length)
+        {
+            if (!_onSetRoute)
+            {
+                ENOMIK_LOGW("SysEx: No SET_ROUTE handler");
+                return;
+            }
+
+            uint8_t route;
+            bool enabled;
+            uint16_t channelMask;
+            if (SysExDecoder::decodeRoute(payload, length, route, enabled, channelMask))
+            {
+                _onSetRoute(route, enabled, channelMask);
+            }
+            else
+            {
+                ENOMIK_LOGW("SysEx: Failed to decode route");
+            }
+        }
+
         void handleGetVersion()
         {
             if (_onGetVersion)
             {
-                Serial.println("SysEx: Getting version");
+                ENOMIK_LOGD("SysEx: Getting version");
                 _onGetVersion();
             }
         }
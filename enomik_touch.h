@@ -0,0 +1,256 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "./utils/log.h"
+#include "./utils/ring.h"
+
+// Touch pins on threshold interrupts.
+// touchAttachInterruptArg() puts the touch sensor FSM into continuous (timer) mode with its hardware
+// filter, so pads are measured in the background. Each pin's baseline is calibrated when it is
+// attached, the threshold is a percentage of it (up to 99). The touch interrupt pushes (pin, touched, µs) into a
+// lock-free ring and poll() only consumes those events.
+// ESP32: readings drop when touched and the interrupt only reports touches, releases are found by
+// reading the (already measured) value of touched pins. ESP32-S2/S3: readings rise, the interrupt
+// reports both.
+
+#if defined(CONFIG_IDF_TARGET_ESP32S2) || defined(CONFIG_IDF_TARGET_ESP32S3)
+#define ENOMIK_TOUCH_RELEASE_INTERRUPT 1
+#else
+#define ENOMIK_TOUCH_RELEASE_INTERRUPT 0
+#endif
+
+#ifndef ENOMIK_TOUCH_QUEUE_SIZE
+#define ENOMIK_TOUCH_QUEUE_SIZE 32 // events, must be a power of two
+#endif
+#ifndef ENOMIK_TOUCH_CALIBRATION_SAMPLES
+#define ENOMIK_TOUCH_CALIBRATION_SAMPLES 16
+#endif
+#ifndef ENOMIK_TOUCH_DEFAULT_PERCENT
+#define ENOMIK_TOUCH_DEFAULT_PERCENT 30 // change against the baseline that counts as a touch
+#endif
+#ifndef ENOMIK_TOUCH_RELEASE_CHECK_US
+#define ENOMIK_TOUCH_RELEASE_CHECK_US 2000 // ESP32 only
+#endif
+#define ENOMIK_TOUCH_MAX_PINS 64
+
+namespace enomik
+{
+    struct TouchEvent
+    {
+        uint8_t pin;
+        bool touched;
+        uint32_t us; // esp_timer_get_time() in the interrupt
+    };
+
+    struct TouchStats
+    {
+        uint32_t touches = 0;
+        uint32_t releases = 0;
+        uint32_t overflows = 0;    // events lost to a full queue
+        uint32_t maxLatencyUs = 0; // interrupt until poll() reported it
+        uint64_t totalLatencyUs = 0;
+    };
+
+    class TouchSensor
+    {
+    public:
+        // Calibrates pin and starts its threshold interrupt. percent is the change against the
+        // baseline that counts as a touch, 0 for ENOMIK_TOUCH_DEFAULT_PERCENT
+        bool attach(uint8_t pin, uint8_t percent)
+        {
+            if (pin >= ENOMIK_TOUCH_MAX_PINS)
+                return false;
+            _instance = this;
+            percent = percent ? (percent < 100 ? percent : 99) : ENOMIK_TOUCH_DEFAULT_PERCENT;
+            if (isAttached(pin) && _percent[pin] == percent)
+                return true;
+
+            uint32_t baseline = calibrate(pin);
+            if (!baseline)
+            {
+                ENOMIK_LOGW("Touch pin %d reads 0, not a touch pin?", pin);
+                return false;
+            }
+#if ENOMIK_TOUCH_RELEASE_INTERRUPT
+            uint32_t threshold = baseline * percent / 100; // above the benchmark the sensor tracks
+#else
+            uint32_t threshold = baseline * (100 - percent) / 100; // absolute, touched below
+#endif
+            _baseline[pin] = baseline;
+            _threshold[pin] = threshold;
+            _percent[pin] = percent;
+            _touched[pin] = false;
+            _attached |= 1ULL << pin;
+            touchAttachInterruptArg(pin, onTouch, (void *)(uintptr_t)pin, threshold);
+            ENOMIK_LOGI("Touch pin %d: baseline %d, threshold %d", pin, (int)baseline, (int)threshold);
+            return true;
+        }
+
+        void detach(uint8_t pin)
+        {
+            if (!isAttached(pin))
+                return;
+            touchDetachInterrupt(pin);
+            _attached &= ~(1ULL << pin);
+            portENTER_CRITICAL(&_heldLock);
+            _held &= ~(1ULL << pin);
+            portEXIT_CRITICAL(&_heldLock);
+        }
+
+        inline bool isAttached(uint8_t pin) const
+        {
+            return pin < ENOMIK_TOUCH_MAX_PINS && (_attached & (1ULL << pin));
+        }
+
+        uint64_t getAttached() const
+        {
+            return _attached;
+        }
+
+        uint32_t getBaseline(uint8_t pin) const
+        {
+            return isAttached(pin) ? _baseline[pin] : 0;
+        }
+
+        // Call on every loop pass. report(uint8_t pin, bool touched, uint32_t us) is called for every
+        // touch and release
+        template <typename Report>
+        inline void poll(Report report)
+        {
+            _stats.overflows = _interruptOverflows - _overflowsAtReset;
+#if ENOMIK_TOUCH_RELEASE_INTERRUPT
+            if (_events.empty())
+                return;
+#else
+            if (_events.empty() && !_held)
+                return;
+#endif
+            uint32_t now = esp_timer_get_time();
+            TouchEvent event;
+            while (_events.pop(event))
+            {
+                if (!isAttached(event.pin) || _touched[event.pin] == event.touched)
+                    continue;
+                emit(event.pin, event.touched, event.us, now, report);
+            }
+
+#if !ENOMIK_TOUCH_RELEASE_INTERRUPT
+            // The pad is measured continuously anyway, touchRead only fetches the last result
+            if (_held && now - _lastReleaseCheckUs >= ENOMIK_TOUCH_RELEASE_CHECK_US)
+            {
+                _lastReleaseCheckUs = now;
+                portENTER_CRITICAL(&_heldLock);
+                uint64_t held = _held;
+                portEXIT_CRITICAL(&_heldLock);
+                while (held)
+                {
+                    uint8_t pin = __builtin_ctzll(held);
+                    held &= held - 1;
+                    // 1/8 of the touch range as hysteresis
+                    if (touchRead(pin) > _threshold[pin] + (_baseline[pin] - _threshold[pin]) / 8)
+                        emit(pin, false, now, now, report);
+                }
+            }
+#endif
+        }
+
+        const TouchStats &getStats() const
+        {
+            return _stats;
+        }
+
+        void resetStats()
+        {
+            _stats = TouchStats();
+            _overflowsAtReset = _interruptOverflows;
+        }
+
+        void printStats(Print &out) const
+        {
+            out.println("=== Touch ===");
+            uint64_t attached = _attached;
+            while (attached)
+            {
+                uint8_t pin = __builtin_ctzll(attached);
+                attached &= attached - 1;
+                out.printf("pin %d | baseline %u, threshold %u (%d%%)%s\n", pin, _baseline[pin], _threshold[pin],
+                           _percent[pin], _touched[pin] ? ", touched" : "");
+            }
+            out.printf("touches %u, releases %u, overflows %u\n", _stats.touches, _stats.releases, _stats.overflows);
+            out.printf("interrupt to report us: avg %u, max %u\n",
+                       _stats.touches + _stats.releases ? (unsigned)(_stats.totalLatencyUs / (_stats.touches + _stats.releases)) : 0,
+                       _stats.maxLatencyUs);
+            out.println("=============");
+        }
+
+    private:
+        static TouchSensor *_instance; // interrupt argument is the pin, there is one touch sensor anyway
+        SpscRing<TouchEvent, ENOMIK_TOUCH_QUEUE_SIZE> _events; // the interrupt pushes, poll() pops
+        uint64_t _attached = 0;
+        volatile uint64_t _held = 0; // ESP32: touched, waiting for the release. Set by the interrupt
+        portMUX_TYPE _heldLock = portMUX_INITIALIZER_UNLOCKED; // 64 bit read-modify-write isn't atomic
+        uint32_t _baseline[ENOMIK_TOUCH_MAX_PINS];
+        uint32_t _threshold[ENOMIK_TOUCH_MAX_PINS];
+        uint8_t _percent[ENOMIK_TOUCH_MAX_PINS];
+        bool _touched[ENOMIK_TOUCH_MAX_PINS]; // as reported
+        uint32_t _lastReleaseCheckUs = 0;
+        TouchStats _stats;
+        volatile uint32_t _interruptOverflows = 0; // counted by the interrupt only, poll() folds it into _stats
+        uint32_t _overflowsAtReset = 0;
+
+        // Average of a few readings while nobody touches the pad, at boot or when the config changes
+        static uint32_t calibrate(uint8_t pin)
+        {
+            uint32_t sum = 0;
+            for (int i = 0; i < ENOMIK_TOUCH_CALIBRATION_SAMPLES; i++)
+                sum += touchRead(pin);
+            return sum / ENOMIK_TOUCH_CALIBRATION_SAMPLES;
+        }
+
+        static void IRAM_ATTR onTouch(void *arg)
+        {
+            TouchSensor *self = _instance;
+            if (!self)
+                return;
+            uint8_t pin = (uint8_t)(uintptr_t)arg;
+#if ENOMIK_TOUCH_RELEASE_INTERRUPT
+            bool touched = touchInterruptGetLastStatus(pin);
+#else
+            // Fires on every measurement below the threshold, only the first one is news
+            portENTER_CRITICAL_ISR(&self->_heldLock);
+            bool news = !(self->_held & (1ULL << pin));
+            self->_held |= 1ULL << pin;
+            portEXIT_CRITICAL_ISR(&self->_heldLock);
+            if (!news)
+                return;
+            bool touched = true;
+#endif
+            if (!self->_events.push({pin, touched, (uint32_t)esp_timer_get_time()}))
+                self->_interruptOverflows++;
+        }
+
+        template <typename Report>
+        inline void emit(uint8_t pin, bool touched, uint32_t us, uint32_t now, Report &report)
+        {
+            _touched[pin] = touched;
+            if (!touched)
+            {
+                portENTER_CRITICAL(&_heldLock);
+                _held &= ~(1ULL << pin);
+                portEXIT_CRITICAL(&_heldLock);
+            }
+            uint32_t latency = now - us;
+            if (touched)
+                _stats.touches++;
+            else
+                _stats.releases++;
+            _stats.totalLatencyUs += latency;
+            if (latency > _stats.maxLatencyUs)
+                _stats.maxLatencyUs = latency;
+            report(pin, touched, us);
+        }
+    };
+
+    TouchSensor *TouchSensor::_instance = nullptr;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+#include <math.h>
+
+// Velocity for keys with two contacts: the time from the first contact closing to the second one
+// closing, measured from the edge interrupt timestamps (GPIO keys, needs ENOMIK_EDGE_INTERRUPTS 1) or
+// the row read times of the matrix scan (matrix keys, ENOMIK_SCAN_VELOCITY_PERIOD_US resolution).
+// Times are placed on a log scale between ENOMIK_VELOCITY_FAST_US (max velocity) and
+// ENOMIK_VELOCITY_SLOW_US (min velocity), which is close to how the dynamics of a press are heard, then
+// bent by the curve: 32 (or 0) is that log scale, below 32 gives more velocity for the same press (soft),
+// above 32 less (hard).
+
+#ifndef ENOMIK_VELOCITY_FAST_US
+#define ENOMIK_VELOCITY_FAST_US 1500
+#endif
+#ifndef ENOMIK_VELOCITY_SLOW_US
+#define ENOMIK_VELOCITY_SLOW_US 80000
+#endif
+#define ENOMIK_VELOCITY_CURVE_DEFAULT 32
+
+namespace enomik
+{
+    struct VelocityCurve
+    {
+        static uint8_t velocity(uint32_t us, uint8_t curve, uint8_t min, uint8_t max)
+        {
+            min = min ? min : 1; // velocity 0 would be a note off
+            if (max < min)
+                max = min;
+            if (us <= ENOMIK_VELOCITY_FAST_US)
+                return max;
+            if (us >= ENOMIK_VELOCITY_SLOW_US)
+                return min;
+            float x = logf((float)ENOMIK_VELOCITY_SLOW_US / us) /
+                      logf((float)ENOMIK_VELOCITY_SLOW_US / ENOMIK_VELOCITY_FAST_US);
+            float gamma = (curve ? curve : ENOMIK_VELOCITY_CURVE_DEFAULT) / 32.0f;
+            return min + (uint8_t)lroundf((max - min) * powf(x, gamma));
+        }
+    };
+}
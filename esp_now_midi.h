@@ -6,20 +6,166 @@
 #include "./version.h"
 #include <esp_now.h>
 #include <esp_wifi.h> // Needed for wifi_tx_info_t in newer versions
+#include <esp_timer.h>
+#include <new>
 #include <WiFi.h>
 #include "./midiHelpers.h"
+#include "./MidiCapture.h"
+#include "./MidiStateMirror.h"
+#include "./utils/callback.h"
+#include "./utils/log.h"
 #define ESP_NOW_DEBUGGING 0
 
+// Library control frames (benchmarks, link management): [ESP_NOW_MIDI_CONTROL, type, payload...]
+// 0xFD is an undefined MIDI status byte, so these never collide with MIDI traffic
+#define ESP_NOW_MIDI_CONTROL 0xFD
+#define ESP_NOW_MIDI_CONTROL_TYPES 16
+#define ESP_NOW_MIDI_ALL_PEERS 0xFFFFFFFF
+
+enum EspNowMidiControlType : uint8_t
+{
+  CONTROL_PING = 0x01,
+  CONTROL_PONG = 0x02,
+  CONTROL_HEARTBEAT = 0x03,
+  CONTROL_MESH = 0x04,
+  CONTROL_STATE_DIGEST = 0x05,  // [channel mask lsb, msb, 4 byte digest per channel in the mask]
+  CONTROL_STATE_REQUEST = 0x06, // [channel mask lsb, msb]
+  CONTROL_STATE_SNAPSHOT = 0x07 // one channel, see MIDI_STATE_SNAPSHOT_SIZE
+};
+
+// Peer liveness, see esp_now_midi::enableHeartbeat
+#ifndef ESP_NOW_MIDI_HEARTBEAT_INTERVAL_MS
+#define ESP_NOW_MIDI_HEARTBEAT_INTERVAL_MS 1000
+#endif
+#ifndef ESP_NOW_MIDI_PEER_TIMEOUT_MS
+#define ESP_NOW_MIDI_PEER_TIMEOUT_MS 3500 // three missed heartbeats
+#endif
+
+// Subscriptions: which (channel, message type) each peer wants, see esp_now_midi::subscribe.
+// Type bit n = channel voice status 0x80 + n * 0x10 (note off ... pitch bend), bit 7 = system messages
+#define ESP_NOW_MIDI_SUBSCRIBE_ALL_CHANNELS 0xFFFF
+#define ESP_NOW_MIDI_SUBSCRIBE_ALL_TYPES 0xFF
+#define ESP_NOW_MIDI_SUBSCRIBE_SYSTEM 0x80
+#define ESP_NOW_MIDI_SUBSCRIBE_TYPE(status) ((uint8_t)(1 << (((status) >> 4) - 8)))
+
+// Estimated airtime per frame for the counters: preamble + (header + payload) at the PHY rate, no ACK
+#ifndef ESP_NOW_MIDI_PHY_RATE_KBPS
+#define ESP_NOW_MIDI_PHY_RATE_KBPS 1000 // ESP-NOW default, 1 Mbps long preamble
+#endif
+#define ESP_NOW_MIDI_FRAME_AIRTIME_US(len) (192 + (43 + (len)) * 8000 / ESP_NOW_MIDI_PHY_RATE_KBPS)
+
+// State mirror, see esp_now_midi::enableStateSync
+#ifndef ESP_NOW_MIDI_STATE_INTERVAL_MS
+#define ESP_NOW_MIDI_STATE_INTERVAL_MS 1000 // digest of the sent state
+#endif
+
+// Multi-hop relay, see esp_now_midi::enableMesh
+#ifndef ESP_NOW_MIDI_MESH_TTL
+#define ESP_NOW_MIDI_MESH_TTL 4 // hops a frame may take, including the first
+#endif
+#ifndef ESP_NOW_MIDI_MESH_ORIGINS
+#define ESP_NOW_MIDI_MESH_ORIGINS 16 // nodes tracked for duplicates and routes, the oldest is replaced
+#endif
+#ifndef ESP_NOW_MIDI_MESH_ROUTE_TIMEOUT_MS
+#define ESP_NOW_MIDI_MESH_ROUTE_TIMEOUT_MS 5000 // routes expire, an origin silent this long may have restarted
+#endif
+#define ESP_NOW_MIDI_MESH_EVERYONE 0
+
+// Session: with an id set every frame starts with [ESP_NOW_MIDI_SESSION, id lsb, id msb] and frames
+// from other sessions are dropped before they reach the peer table, see esp_now_midi::setSession.
+// 0xF4 is an undefined MIDI status byte like ESP_NOW_MIDI_CONTROL
+#define ESP_NOW_MIDI_SESSION 0xF4
+#define ESP_NOW_MIDI_SESSION_TAG_SIZE 3
+#ifndef ESP_NOW_MIDI_SESSION_ID
+#define ESP_NOW_MIDI_SESSION_ID 0 // 0 = no session, untagged frames as older firmware sends them
+#endif
+
+enum EspNowMidiPeerEvent : uint8_t
+{
+  PEER_ALIVE, // a dead peer sent something again
+  PEER_DEAD   // nothing heard for the timeout, dropped from sendToAllPeers
+};
+
 // Version detection
 #if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION >= ESP_ARDUINO_VERSION_VAL(3, 3, 0)
 #define ESP_NOW_NEW_CALLBACK_SIGNATURE 1
 #endif
 
+// Traffic per peer, see esp_now_midi::printPeerStats
+struct PeerStats
+{
+  uint32_t frames;    // handed to esp_now_send
+  uint32_t failed;    // esp_now_send errors
+  uint32_t filtered;  // MIDI messages the peer did not subscribe to
+  uint32_t bytes;
+  uint64_t airtimeUs; // estimated, see ESP_NOW_MIDI_FRAME_AIRTIME_US
+};
+
+// [ESP_NOW_MIDI_CONTROL, CONTROL_MESH, ...] followed by the MIDI frame
+struct esp_now_midi_mesh_header
+{
+  uint8_t control;  // ESP_NOW_MIDI_CONTROL
+  uint8_t type;     // CONTROL_MESH
+  uint32_t origin;  // node id, the last 4 bytes of the origin's MAC
+  uint32_t dest;    // node id, ESP_NOW_MIDI_MESH_EVERYONE for all nodes
+  uint16_t seq;     // per origin
+  uint8_t ttl;      // relays forward while ttl > 1
+  uint8_t hops;     // relays passed so far
+  uint16_t relayUs; // time spent inside relays, summed over all hops, saturates
+} __attribute__((packed));
+
+// Everything known about one origin: duplicate window, the route back to it and latency counters
+struct MeshRoute
+{
+  uint32_t origin;
+  int8_t via;         // peer index the first copy arrived from, the fastest path back
+  uint8_t hops;       // 1 = direct neighbour
+  uint16_t lastSeq;   // newest sequence number seen
+  uint32_t window;    // bit n set = lastSeq - n seen
+  int64_t lastSeenUs;
+  uint32_t frames;     // first copies
+  uint32_t duplicates; // further copies, dropped
+  uint32_t relays;     // relays passed by all first copies
+  uint64_t relayUs;    // time spent in those relays
+};
+
+struct MeshStats
+{
+  uint32_t originated;
+  uint32_t delivered; // to this node's handlers
+  uint32_t duplicates;
+  uint32_t forwarded;
+  uint32_t expired;   // ttl ran out here
+  uint64_t relayUs;   // receive to forward in this relay
+  uint32_t relayMaxUs;
+};
+
+struct StateSyncStats
+{
+  uint32_t digestsSent;
+  uint32_t digestsReceived;
+  uint32_t mismatches; // channels whose digest differed
+  uint32_t requestsSent;
+  uint32_t snapshotsSent;
+  uint32_t snapshotsReceived;
+  uint32_t notesTurnedOff; // held here, released on the other end
+};
+
+struct SessionStats
+{
+  uint32_t accepted;
+  uint32_t foreign;  // tagged with another session
+  uint32_t untagged; // no session while one is set
+};
+
 // Optimized peer storage with packed MAC address for fast comparison
 struct PeerInfo
 {
   uint8_t mac[6];
   uint64_t packed_mac; // Stored as 48-bit value in 64-bit integer
+  int64_t lastSeenUs;  // last frame received from this peer
+  bool alive;
+  bool heartbeats;     // has sent a heartbeat, only such peers can time out
 
   static uint64_t packMac(const uint8_t mac[6])
   {
@@ -47,16 +193,14 @@ public:
   static void DefaultOnDataSent(const wifi_tx_info_t *info, esp_now_send_status_t status)
   {
 #if ESP_NOW_DEBUGGING == 1
-    Serial.print("\r\nLast Packet Send Status:\t");
-    Serial.println(status == ESP_NOW_SEND_SUCCESS ? "Delivery Success" : "Delivery Fail");
+    ENOMIK_LOGD("Last Packet Send Status: %s", status == ESP_NOW_SEND_SUCCESS ? "Delivery Success" : "Delivery Fail");
 #endif
   }
 #else
   static void DefaultOnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status)
   {
 #if ESP_NOW_DEBUGGING == 1
-    Serial.print("\r\nLast Packet Send Status:\t");
-    Serial.println(status == ESP_NOW_SEND_SUCCESS ? "Delivery Success" : "Delivery Fail");
+    ENOMIK_LOGD("Last Packet Send Status: %s", status == ESP_NOW_SEND_SUCCESS ? "Delivery Success" : "Delivery Fail");
 #endif
   }
 #endif
@@ -84,7 +228,7 @@ public:
 #ifdef ESP_NOW_NEW_CALLBACK_SIGNATURE
   static void OnDataRecvStatic(const esp_now_recv_info_t *recv_info, const uint8_t *incomingData, int len)
   {
-    if (_instance)
+    if (_instance && _instance->acceptSession(incomingData, len))
     {
       _instance->OnDataRecv(recv_info->src_addr, incomingData, len);
     }
@@ -92,7 +236,7 @@ public:
 #else
   static void OnDataRecvStatic(const uint8_t *mac, const uint8_t *incomingData, int len)
   {
-    if (_instance)
+    if (_instance && _instance->acceptSession(incomingData, len))
     {
       _instance->OnDataRecv(mac, incomingData, len);
     }
@@ -102,6 +246,7 @@ public:
   {
     _instance = this;
     _autoPeerDiscovery = autoPeerDiscovery;
+    enomik::Log::begin();
     userDataSentCallback = callback; // This needs to be INSIDE the function
 
     // Initialize WiFi if needed
@@ -117,11 +262,11 @@ public:
 
     if (init_result == ESP_ERR_ESPNOW_EXIST)
     {
-      Serial.println("[ESP-NOW] Already initialized");
+      ENOMIK_LOGI("[ESP-NOW] Already initialized");
     }
     else if (init_result != ESP_OK)
     {
-      Serial.printf("[ESP-NOW] Init failed with error: %d\n", init_result);
+      ENOMIK_LOGE("[ESP-NOW] Init failed with error: %d", init_result);
       return;
     }
 
@@ -156,19 +301,11 @@ public:
   {
     if (_peersCount >= MAX_PEERS)
     {
-      Serial.println("Maximum number of peers reached");
+      ENOMIK_LOGW("Maximum number of peers reached");
       return false;
     }
 
-    // Debug print
-    Serial.print("Adding peer: ");
-    for (int i = 0; i < 6; i++)
-    {
-      Serial.print(macAddress[i], HEX);
-      if (i < 5)
-        Serial.print(":");
-    }
-    Serial.println();
+    ENOMIK_LOGD("Adding peer: " ENOMIK_LOG_MAC_FORMAT, ENOMIK_LOG_MAC_ARGS(macAddress));
 
     // Create the peer info structure
     esp_now_peer_info_t peerInfo;
@@ -180,22 +317,24 @@ public:
     // Add the peer to ESP-NOW
     if (esp_now_add_peer(&peerInfo) != ESP_OK)
     {
-      Serial.println("Failed to add peer");
+      ENOMIK_LOGE("Failed to add peer " ENOMIK_LOG_MAC_FORMAT, ENOMIK_LOG_MAC_ARGS(macAddress));
       return false;
     }
 
     // Store the peer in our array AFTER successful ESP-NOW registration
     memcpy(_peers[_peersCount].mac, macAddress, 6);
     _peers[_peersCount].packed_mac = PeerInfo::packMac(macAddress);
+    _peers[_peersCount].lastSeenUs = esp_timer_get_time();
+    _peers[_peersCount].alive = true;
+    _peers[_peersCount].heartbeats = false;
     _peersCount++;
-    Serial.print("Peer added successfully. Total peers: ");
-    Serial.println(_peersCount);
+    ENOMIK_LOGI("Peer added successfully. Total peers: %d", _peersCount);
     return true;
   }
 
   void clearPeers()
   {
-    Serial.println("Clearing all peers from ESP-NOW...");
+    ENOMIK_LOGI("Clearing all peers from ESP-NOW...");
 
     // Remove all peers from ESP-NOW
     for (int i = 0; i < _peersCount; i++)
@@ -203,26 +342,28 @@ public:
       esp_err_t result = esp_now_del_peer(_peers[i].mac);
       if (result == ESP_OK)
       {
-        Serial.print("Removed peer: ");
-        for (int j = 0; j < 6; j++)
-        {
-          Serial.print(_peers[i].mac[j], HEX);
-          if (j < 5)
-            Serial.print(":");
-        }
-        Serial.println();
+        ENOMIK_LOGD("Removed peer: " ENOMIK_LOG_MAC_FORMAT, ENOMIK_LOG_MAC_ARGS(_peers[i].mac));
       }
       else
       {
-        Serial.printf("Failed to remove peer, error: %d\n", result);
+        ENOMIK_LOGE("Failed to remove peer, error: %d", result);
       }
     }
 
     // Clear the internal peer list
     memset(_peers, 0, sizeof(_peers));
     _peersCount = 0;
+    _subscribedPeers = 0;
+    _configuredPeers = 0;
+    _meshRoutesCount = 0; // routes point at peer indices
+    resetPeerStats();
+    for (int i = 0; i < MAX_PEERS; i++)
+    {
+      if (_stateIn[i])
+        _stateIn[i]->clear(); // kept allocated for the next peer in that slot
+    }
 
-    Serial.println("All peers cleared");
+    ENOMIK_LOGI("All peers cleared");
   }
 
   int getPeersCount() const
@@ -230,6 +371,111 @@ public:
     return _peersCount;
   }
 
+  const uint8_t *getPeerMac(int index) const
+  {
+    if (index < 0 || index >= _peersCount)
+      return nullptr;
+    return _peers[index].mac;
+  }
+
+  // Index into the peer table, -1 if unknown
+  int findPeer(const uint8_t mac[6]) const
+  {
+    uint64_t packed = PeerInfo::packMac(mac);
+    for (int i = 0; i < _peersCount; i++)
+    {
+      if (_peers[i].packed_mac == packed)
+        return i;
+    }
+    return -1;
+  }
+
+  // Liveness: every peer gets a heartbeat control frame per interval, any frame received from a peer
+  // counts as a sign of life. Peers that sent a heartbeat and then stay silent for timeoutMs are
+  // skipped by sendToAllPeers until they send again. Peers that never sent one (listen-only, or
+  // without heartbeats enabled) are never evicted. Needs updatePeers() to be called regularly,
+  // enomik::Client does that.
+  void enableHeartbeat(uint32_t intervalMs = ESP_NOW_MIDI_HEARTBEAT_INTERVAL_MS, uint32_t timeoutMs = ESP_NOW_MIDI_PEER_TIMEOUT_MS)
+  {
+    _heartbeatIntervalUs = (int64_t)intervalMs * 1000;
+    _peerTimeoutUs = (int64_t)timeoutMs * 1000;
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < _peersCount; i++)
+    {
+      _peers[i].lastSeenUs = now;
+      _peers[i].alive = true;
+    }
+  }
+
+  void disableHeartbeat()
+  {
+    _heartbeatIntervalUs = 0;
+    for (int i = 0; i < _peersCount; i++)
+      _peers[i].alive = true;
+  }
+
+  // Sends the heartbeat when due and evicts silent peers, cheap when there is nothing to do
+  void updatePeers()
+  {
+    int64_t now = esp_timer_get_time();
+    if (_stateIntervalUs && now - _lastDigestUs >= _stateIntervalUs)
+    {
+      _lastDigestUs = now;
+      allocateStateMirrors(); // peers discovered since
+      sendStateDigest();
+    }
+
+    if (!_heartbeatIntervalUs)
+      return;
+
+    if (now - _lastHeartbeatUs >= _heartbeatIntervalUs)
+    {
+      _lastHeartbeatUs = now;
+      sendHeartbeat(); // dead peers too, so they can come back
+    }
+
+    for (int i = 0; i < _peersCount; i++)
+    {
+      if (_peers[i].alive && _peers[i].heartbeats && now - _peers[i].lastSeenUs > _peerTimeoutUs)
+      {
+        _peers[i].alive = false;
+        ENOMIK_LOGI("Peer " ENOMIK_LOG_MAC_FORMAT " timed out", ENOMIK_LOG_MAC_ARGS(_peers[i].mac));
+        if (onPeerEventHandler)
+          onPeerEventHandler(_peers[i].mac, PEER_DEAD);
+      }
+    }
+  }
+
+  bool isPeerAlive(int index) const
+  {
+    return index >= 0 && index < _peersCount && _peers[index].alive;
+  }
+
+  int getAlivePeersCount() const
+  {
+    int count = 0;
+    for (int i = 0; i < _peersCount; i++)
+    {
+      if (_peers[i].alive)
+        count++;
+    }
+    return count;
+  }
+
+  // Microseconds since the last frame from the peer, -1 for unknown peers
+  int64_t getPeerSilenceUs(int index) const
+  {
+    if (index < 0 || index >= _peersCount)
+      return -1;
+    return esp_timer_get_time() - _peers[index].lastSeenUs;
+  }
+
+  // Record all sent and received frames into capture, nullptr disables capturing
+  void setCapture(MidiCapture *capture)
+  {
+    _capture = capture;
+  }
+
   void printPeers() const
   {
     Serial.println("=== Registered ESP-NOW Peers ===");
@@ -252,23 +498,297 @@ public:
   // Send to all peers
   esp_err_t sendToAllPeers(const uint8_t *data, size_t len)
   {
-    esp_err_t result = ESP_OK;
+    return sendToPeers(ESP_NOW_MIDI_ALL_PEERS, data, len);
+  }
+
+  // Send to the peers subscribed to the message's channel and type. Sends return the last per peer
+  // error, reached tells a partial failure (the frame is out, resending it would duplicate it) from a
+  // total one
+  esp_err_t sendMessage(const midi_message &message, int *reached = nullptr)
+  {
+    if (_stateOut)
+    {
+      portENTER_CRITICAL(&_stateLock);
+      _stateOut->apply(message);
+      portEXIT_CRITICAL(&_stateLock);
+    }
+    midi_message_packet packet = midi_message_packet::fromMessage(message);
+    return sendToPeers(getSubscribers(message), (uint8_t *)&packet, packet.getDataSize(), reached);
+  }
 
+  // Send to the peers in mask, bit n = peer index n. reached: peers the frame went out to
+  esp_err_t sendToPeers(uint32_t mask, const uint8_t *data, size_t len, int *reached = nullptr)
+  {
+    if (reached)
+      *reached = 0;
     if (_peersCount == 0)
     {
-      Serial.println("No peers registered!");
+      ENOMIK_LOGD("No peers registered!");
       return ESP_FAIL;
     }
 
+    captureOut(data, len);
+    if (!_meshEnabled)
+      return transmit(mask, data, len, true, reached);
+
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+    size_t frameLen = wrapMesh(frame, ESP_NOW_MIDI_MESH_EVERYONE, data, len);
+    return frameLen ? transmit(mask, frame, frameLen, true, reached) : ESP_ERR_ESPNOW_ARG;
+  }
+
+  // One node. With the mesh enabled nodes out of range are reached over the relays, on the learned
+  // route if there is one, by flooding otherwise.
+  esp_err_t sendMessageTo(const uint8_t mac[6], const midi_message &message)
+  {
+    if (_stateOut && message.status < 0xF0)
+      _stateUnsynced |= 1 << ((message.channel - 1) & 0x0F); // the other peers never saw it
+    midi_message_packet packet = midi_message_packet::fromMessage(message);
+    int peer = findPeer(mac);
+    if (!_meshEnabled && peer < 0)
+      return ESP_ERR_ESPNOW_NOT_FOUND;
+
+    captureOut((uint8_t *)&packet, packet.getDataSize());
+    if (!_meshEnabled)
+      return transmit(1UL << peer, (uint8_t *)&packet, packet.getDataSize(), false); // not filtered for the others
+
+    uint32_t dest = meshIdOf(mac);
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+    size_t frameLen = wrapMesh(frame, dest, (uint8_t *)&packet, packet.getDataSize());
+    int via = nextHop(dest);
+    return transmit(via >= 0 ? 1UL << via : ESP_NOW_MIDI_ALL_PEERS, frame, frameLen, false);
+  }
+
+  // --- State sync ---
+  // Both ends mirror held notes, controllers, program and pitch bend per channel: one mirror for what
+  // this node sent with sendMessage, and one per peer for what that peer sent. Senders send every
+  // peer a digest of the sent state every intervalMs, a receiver whose mirror of that sender differs
+  // asks for snapshots of those channels only, one frame per channel, and reconciles: notes that
+  // sender still holds here are turned off through the note off handler (unless another peer holds
+  // them too), changed controllers, programs and pitch bends go through their handlers. Nothing is
+  // acknowledged. A peer only gets the channels its subscription fully covers, and channels used
+  // with sendMessageTo leave the sync, as the other peers never saw those messages.
+  // Enabling asks all peers for their state, so a rebooted receiver catches up right away.
+  // Needs updatePeers() to be called regularly, the mirrors take about 2.5 kB each, one for the sent
+  // state and one per peer. They are allocated here and by updatePeers for peers added later, never
+  // in the receive callback; a peer's messages are mirrored once its mirror exists.
+  bool enableStateSync(uint32_t intervalMs = ESP_NOW_MIDI_STATE_INTERVAL_MS)
+  {
+    if (!_stateOut)
+      _stateOut = new (std::nothrow) MidiStateMirror();
+    if (!_stateOut)
+    {
+      ENOMIK_LOGE("State sync: out of memory");
+      return false;
+    }
+    allocateStateMirrors();
+    _stateIntervalUs = (int64_t)intervalMs * 1000;
+    requestState();
+    return true;
+  }
+
+  void disableStateSync()
+  {
+    _stateIntervalUs = 0;
+  }
+
+  // Ask every peer for snapshots of these channels, bit n = MIDI channel n + 1
+  esp_err_t requestState(uint16_t channelMask = 0xFFFF, const uint8_t *mac = nullptr)
+  {
+    uint8_t payload[2] = {(uint8_t)(channelMask & 0xFF), (uint8_t)(channelMask >> 8)};
+    _lastStateRequestUs = esp_timer_get_time();
+    _stateStats.requestsSent++;
+    return sendControlFrame(mac, CONTROL_STATE_REQUEST, payload, sizeof(payload));
+  }
+
+  // What this node sent and what a peer sent it, nullptr until enableStateSync (or updatePeers for new peers)
+  const MidiStateMirror *getSentState() const
+  {
+    return _stateOut;
+  }
+
+  const MidiStateMirror *getReceivedState(int peer) const
+  {
+    return peer >= 0 && peer < _peersCount ? _stateIn[peer] : nullptr;
+  }
+
+  const StateSyncStats &getStateSyncStats() const
+  {
+    return _stateStats;
+  }
+
+  // --- Mesh ---
+  // MIDI frames carry an origin id, sequence number and TTL, so nodes drop the copies that arrive
+  // over more than one path. Relays forward frames that are not addressed only to them right from
+  // the receive callback, before their own handlers run. The first copy of a frame arrived over the
+  // fastest path, relays and senders use that neighbour for frames to that origin.
+  // Every node of a mesh enables it, nodes without it ignore mesh frames. Control frames
+  // (heartbeats, benchmarks) stay between neighbours.
+  void enableMesh(bool relay = false, uint8_t ttl = ESP_NOW_MIDI_MESH_TTL)
+  {
+    uint8_t mac[6];
+    esp_wifi_get_mac(WIFI_IF_STA, mac);
+    _meshId = meshIdOf(mac);
+    _meshRelay = relay;
+    _meshTtl = ttl ? ttl : 1;
+    _meshSeq = (uint16_t)esp_timer_get_time(); // a restarted node doesn't look like a replay
+    _meshEnabled = true;
+  }
+
+  void disableMesh()
+  {
+    _meshEnabled = false;
+  }
+
+  bool isMeshEnabled() const
+  {
+    return _meshEnabled;
+  }
+
+  bool isMeshRelay() const
+  {
+    return _meshEnabled && _meshRelay;
+  }
+
+  static uint32_t meshIdOf(const uint8_t mac[6])
+  {
+    return (uint32_t)(PeerInfo::packMac(mac) >> 16);
+  }
+
+  const MeshStats &getMeshStats() const
+  {
+    return _meshStats;
+  }
+
+  int getMeshRoutesCount() const
+  {
+    return _meshRoutesCount;
+  }
+
+  const MeshRoute &getMeshRoute(int index) const
+  {
+    return _meshRoutes[index >= 0 && index < _meshRoutesCount ? index : 0];
+  }
+
+  // Per origin: route, duplicates and latency per hop (relay time measured, airtime estimated)
+  void printMeshStats(Print &out) const
+  {
+    out.println("=== ESP-NOW mesh ===");
+    out.printf("node %08X%s ttl %u | originated %u, delivered %u, duplicates %u, forwarded %u, expired %u\n",
+               (unsigned)_meshId, _meshRelay ? " (relay)" : "", _meshTtl, _meshStats.originated, _meshStats.delivered,
+               _meshStats.duplicates, _meshStats.forwarded, _meshStats.expired);
+    if (_meshStats.forwarded)
+      out.printf("in this relay us: avg %u, max %u\n",
+                 (unsigned)(_meshStats.relayUs / _meshStats.forwarded), _meshStats.relayMaxUs);
+    uint32_t airtimeUs = ESP_NOW_MIDI_FRAME_AIRTIME_US(sizeof(esp_now_midi_mesh_header) + 3);
+    for (int i = 0; i < _meshRoutesCount; i++)
+    {
+      const MeshRoute &route = _meshRoutes[i];
+      const uint8_t *via = getPeerMac(route.via);
+      out.printf("%08X via " ENOMIK_LOG_MAC_FORMAT " hops %u | frames %u, duplicates %u | per hop us: relay %u + ~%u on air\n",
+                 (unsigned)route.origin, ENOMIK_LOG_MAC_ARGS(via ? via : (const uint8_t *)"\0\0\0\0\0\0"), route.hops,
+                 route.frames, route.duplicates, route.relays ? (unsigned)(route.relayUs / route.relays) : 0, (unsigned)airtimeUs);
+    }
+    out.println("====================");
+  }
+
+  // --- Subscriptions ---
+  // Peers without a subscription get everything. A subscription comes from explicit configuration
+  // here, or from the peer announcing it with setSubscription (carried by its heartbeats).
+  // Explicit configuration wins over announcements.
+  bool subscribe(int peer, uint16_t channelMask, uint8_t typeMask)
+  {
+    if (!applySubscription(peer, channelMask, typeMask))
+      return false;
+    _configuredPeers |= 1UL << peer;
+    return true;
+  }
+
+  bool subscribe(const uint8_t mac[6], uint16_t channelMask, uint8_t typeMask)
+  {
+    return subscribe(findPeer(mac), channelMask, typeMask);
+  }
+
+  // Back to receiving everything
+  void unsubscribe(int peer)
+  {
+    if (peer < 0 || peer >= _peersCount)
+      return;
+    _subscribedPeers &= ~(1UL << peer);
+    _configuredPeers &= ~(1UL << peer);
+  }
+
+  // Peers a message goes to, bit n = peer index n
+  inline uint32_t getSubscribers(const midi_message &message) const
+  {
+    if (message.status >= 0xF0)
+      return _subscriptions[0][7] | ~_subscribedPeers;
+    return _subscriptions[(message.channel - 1) & 0x0F][((message.status >> 4) - 8) & 0x07] | ~_subscribedPeers;
+  }
+
+  // Receiver side: ask peers for these channels and types only. Sent right away and with every
+  // heartbeat, so senders that reboot learn it again (needs enableHeartbeat).
+  void setSubscription(uint16_t channelMask, uint8_t typeMask)
+  {
+    _ownChannelMask = channelMask;
+    _ownTypeMask = typeMask;
+    _hasOwnSubscription = true;
+    sendHeartbeat();
+  }
+
+  void clearSubscription()
+  {
+    _hasOwnSubscription = false;
+    sendHeartbeat();
+  }
+
+  const PeerStats &getPeerStats(int index) const
+  {
+    return _peerStats[index >= 0 && index < _peersCount ? index : 0];
+  }
+
+  void resetPeerStats()
+  {
+    memset(_peerStats, 0, sizeof(_peerStats));
+  }
+
+  void printPeerStats(Print &out) const
+  {
+    out.println("=== ESP-NOW peer traffic ===");
     for (int i = 0; i < _peersCount; i++)
     {
-      esp_err_t err = esp_now_send(_peers[i].mac, data, len);
-      if (err != ESP_OK)
-      {
-        result = err; // Return last error if any
-      }
+      const PeerStats &stats = _peerStats[i];
+      out.printf(ENOMIK_LOG_MAC_FORMAT " %s%s| frames %u, failed %u, filtered %u, bytes %u, airtime %llu us\n",
+                 ENOMIK_LOG_MAC_ARGS(_peers[i].mac), _peers[i].alive ? "" : "(dead) ",
+                 (_subscribedPeers & (1UL << i)) ? "(subscribed) " : "",
+                 stats.frames, stats.failed, stats.filtered, stats.bytes, (unsigned long long)stats.airtimeUs);
     }
-    return result;
+    out.printf("session %u | accepted %u, foreign %u, untagged %u\n", _session,
+               _sessionStats.accepted, _sessionStats.foreign, _sessionStats.untagged);
+    out.println("============================");
+  }
+
+  // Rigs sharing a channel keep apart by session id: frames are tagged with it and anything tagged
+  // differently, or untagged, is dropped on arrival, before auto discovery adds the sender as a peer.
+  // 0 turns it off, untagged frames are sent and tagged ones dropped. Peers of an old session stay,
+  // see clearPeers()
+  void setSession(uint16_t id)
+  {
+    _session = id;
+  }
+
+  uint16_t getSession() const
+  {
+    return _session;
+  }
+
+  const SessionStats &getSessionStats() const
+  {
+    return _sessionStats;
+  }
+
+  void resetSessionStats()
+  {
+    memset(&_sessionStats, 0, sizeof(_sessionStats));
   }
 
   inline esp_err_t sendNoteOn(byte note, byte velocity, byte channel)
@@ -279,8 +799,7 @@ public:
     message.firstByte = note;
     message.secondByte = velocity;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendNoteOff(byte note, byte velocity, byte channel)
@@ -291,8 +810,7 @@ public:
     message.firstByte = note;
     message.secondByte = velocity;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendControlChange(byte control, byte value, byte channel)
@@ -303,8 +821,7 @@ public:
     message.firstByte = control;
     message.secondByte = value;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendProgramChange(byte program, byte channel)
@@ -315,8 +832,7 @@ public:
     message.firstByte = program;
     message.secondByte = 0;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendAfterTouch(byte pressure, byte channel)
@@ -327,8 +843,7 @@ public:
     message.firstByte = pressure;
     message.secondByte = 0;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendAfterTouch(byte note, byte pressure, byte channel)
@@ -339,8 +854,7 @@ public:
     message.firstByte = note;
     message.secondByte = pressure;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendAfterTouchPoly(byte note, byte pressure, byte channel)
@@ -357,8 +871,7 @@ public:
     message.firstByte = value & 0x7F;
     message.secondByte = (value >> 7) & 0x7F;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendPitchBend(int16_t value, byte channel)
@@ -382,8 +895,7 @@ public:
     message.firstByte = 0;
     message.secondByte = 0;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendStop()
@@ -394,8 +906,7 @@ public:
     message.firstByte = 0;
     message.secondByte = 0;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendContinue()
@@ -406,8 +917,7 @@ public:
     message.firstByte = 0;
     message.secondByte = 0;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendClock()
@@ -418,8 +928,7 @@ public:
     message.firstByte = 0;
     message.secondByte = 0;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendSongPosition(uint16_t value)
@@ -431,8 +940,7 @@ public:
     message.firstByte = value & 0x7F;
     message.secondByte = (value >> 7) & 0x7F;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendSongSelect(uint8_t value)
@@ -444,8 +952,7 @@ public:
     message.firstByte = value;
     message.secondByte = 0;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendTuneRequest()
@@ -456,8 +963,7 @@ public:
     message.firstByte = 0;
     message.secondByte = 0;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendTimeCode(uint8_t value)
@@ -469,8 +975,7 @@ public:
     message.firstByte = value;
     message.secondByte = 0;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendActiveSensing()
@@ -481,8 +986,7 @@ public:
     message.firstByte = 0;
     message.secondByte = 0;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
   inline esp_err_t sendSystemReset()
   {
@@ -492,8 +996,7 @@ public:
     message.firstByte = 0;
     message.secondByte = 0;
 
-    midi_message_packet packet = midi_message_packet::fromMessage(message);
-    return sendToAllPeers((uint8_t *)&packet, packet.getDataSize());
+    return sendMessage(message);
   }
 
   inline esp_err_t sendSysex(uint8_t data[128], uint8_t length)
@@ -504,11 +1007,45 @@ public:
     return sendToAllPeers((uint8_t *)&sysexMessage, sizeof(sysexMessage));
   }
 
+  // Frames without the session tag, after the session check in OnDataRecvStatic
   void OnDataRecv(const uint8_t *mac, const uint8_t *incomingData, int len)
   {
-    if (_autoPeerDiscovery && !hasPeer(mac))
+    int peer = findPeer(mac);
+    if (_autoPeerDiscovery && peer < 0 && addPeer(mac))
+    {
+      peer = _peersCount - 1;
+    }
+    if (peer >= 0)
+    {
+      markSeen(peer);
+    }
+    if (len >= 2 && incomingData[0] == ESP_NOW_MIDI_CONTROL)
+    {
+      uint8_t type = incomingData[1];
+      if (type == CONTROL_MESH)
+      {
+        if (_meshEnabled)
+          onMeshFrame(mac, peer, incomingData, len);
+        return;
+      }
+      if (type == CONTROL_HEARTBEAT && peer >= 0)
+        onHeartbeat(peer, incomingData + 2, len - 2);
+      else if (type >= CONTROL_STATE_DIGEST && type <= CONTROL_STATE_SNAPSHOT && _stateIntervalUs)
+        onStateFrame(mac, type, incomingData + 2, len - 2);
+      if (type < ESP_NOW_MIDI_CONTROL_TYPES && _controlHandlers[type].handler)
+        _controlHandlers[type].handler(_controlHandlers[type].context, mac, incomingData + 2, len - 2);
+      return;
+    }
+    if (_capture)
     {
-      addPeer(mac);
+      uint8_t capturePeer = peer < 0 ? MIDI_CAPTURE_PEER_NONE : peer;
+      if ((size_t)len > sizeof(midi_message_packet))
+      {
+        uint16_t sysexLength = (size_t)len >= sizeof(midi_sysex_message) ? ((const midi_sysex_message *)incomingData)->length : len;
+        _capture->recordSysEx(CAPTURE_ESPNOW_IN, capturePeer, sysexLength);
+      }
+      else
+        _capture->record(CAPTURE_ESPNOW_IN, capturePeer, incomingData, len);
     }
     // Handle SysEx separately (larger than 3 bytes)
     if (len > sizeof(midi_message_packet))
@@ -524,69 +1061,59 @@ public:
     memset(&packet, 0, sizeof(packet)); // Zero out the packet first
     memcpy(&packet, incomingData, len); // Copy only received bytes
     midi_message message = packet.toMessage();
+    MidiStateMirror *mirror = _stateOut && peer >= 0 && !_meshRelayed ? receivedState(peer) : nullptr;
+    if (mirror)
+      mirror->apply(message);
+    dispatch(message);
+  }
 
-    switch (message.status)
+  // Control frames, handled before any MIDI processing and never captured
+  typedef void (*ControlFrameHandler)(void *context, const uint8_t *mac, const uint8_t *payload, int len);
+
+  bool setControlFrameHandler(uint8_t type, ControlFrameHandler handler, void *context = nullptr)
+  {
+    if (type >= ESP_NOW_MIDI_CONTROL_TYPES)
+      return false;
+    _controlHandlers[type].handler = handler;
+    _controlHandlers[type].context = context;
+    return true;
+  }
+
+  // Send a control frame to one peer, or to all peers if mac is nullptr
+  esp_err_t sendControlFrame(const uint8_t *mac, uint8_t type, const void *payload, size_t len)
+  {
+    size_t tag = _session ? ESP_NOW_MIDI_SESSION_TAG_SIZE : 0;
+    if (len > ESP_NOW_MAX_DATA_LEN - 2 - tag)
+      return ESP_ERR_ESPNOW_ARG;
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+    tagSession(frame);
+    frame[tag] = ESP_NOW_MIDI_CONTROL;
+    frame[tag + 1] = type;
+    if (len)
+      memcpy(frame + tag + 2, payload, len);
+    len += tag + 2;
+    if (mac)
+      return esp_now_send(mac, frame, len);
+
+    esp_err_t result = ESP_OK;
+    for (int i = 0; i < _peersCount; i++)
     {
-    case MIDI_NOTE_ON:
-      if (onNoteOnHandler)
-        onNoteOnHandler(message.channel, message.firstByte, message.secondByte);
-      break;
-    case MIDI_NOTE_OFF:
-      if (onNoteOffHandler)
-        onNoteOffHandler(message.channel, message.firstByte, message.secondByte);
-      break;
-    case MIDI_CONTROL_CHANGE:
-      if (onControlChangeHandler)
-        onControlChangeHandler(message.channel, message.firstByte, message.secondByte);
-      break;
-    case MIDI_PROGRAM_CHANGE:
-      if (onProgramChangeHandler)
-        onProgramChangeHandler(message.channel, message.firstByte);
-      break;
-    case MIDI_AFTERTOUCH:
-      if (onAfterTouchChannelHandler)
-        onAfterTouchChannelHandler(message.channel, message.firstByte);
-      break;
-    case MIDI_POLY_AFTERTOUCH:
-      if (onAfterTouchPolyHandler)
-        onAfterTouchPolyHandler(message.channel, message.firstByte, message.secondByte);
-      break;
-    case MIDI_PITCH_BEND:
-    {
-      int pitchBendValue = (message.secondByte << 7) | message.firstByte;
-      int16_t signedValue = pitchBendValue - 8192;
-      if (onPitchBendHandler)
-        onPitchBendHandler(message.channel, signedValue);
-      break;
-    }
-    case MIDI_START:
-      if (onStartHandler)
-        onStartHandler();
-      break;
-    case MIDI_STOP:
-      if (onStopHandler)
-        onStopHandler();
-      break;
-    case MIDI_CONTINUE:
-      if (onContinueHandler)
-        onContinueHandler();
-      break;
-    case MIDI_TIME_CLOCK:
-      if (onClockHandler)
-        onClockHandler();
-      break;
-    case MIDI_SONG_POS_POINTER:
-    {
-      int songPosValue = (message.secondByte << 7) | message.firstByte;
-      if (onSongPositionHandler)
-        onSongPositionHandler(songPosValue);
-      break;
-    }
-    case MIDI_SONG_SELECT:
-      if (onSongSelectHandler)
-        onSongSelectHandler(message.firstByte);
-      break;
+      esp_err_t err = esp_now_send(_peers[i].mac, frame, len);
+      if (err != ESP_OK)
+        result = err;
     }
+    return result;
+  }
+
+  // Liveness changes, PEER_ALIVE is raised from the WiFi task, PEER_DEAD from updatePeers()
+  void setHandlePeerEvent(void (*callback)(const uint8_t *mac, EspNowMidiPeerEvent event))
+  {
+    onPeerEventHandler = callback;
+  }
+
+  void setHandlePeerEvent(void (*callback)(void *context, const uint8_t *mac, EspNowMidiPeerEvent event), void *context)
+  {
+    onPeerEventHandler = {callback, context};
   }
 
   void setHandleNoteOn(void (*callback)(byte channel, byte note, byte velocity))
@@ -594,75 +1121,135 @@ public:
     onNoteOnHandler = callback;
   }
 
+  // Every handler can also take a context pointer, passed back as the first argument
+  void setHandleNoteOn(void (*callback)(void *context, byte channel, byte note, byte velocity), void *context)
+  {
+    onNoteOnHandler = {callback, context};
+  }
+
   void setHandleNoteOff(void (*callback)(byte channel, byte note, byte velocity))
   {
     onNoteOffHandler = callback;
   }
 
+  void setHandleNoteOff(void (*callback)(void *context, byte channel, byte note, byte velocity), void *context)
+  {
+    onNoteOffHandler = {callback, context};
+  }
+
   void setHandleControlChange(void (*callback)(byte channel, byte control, byte value))
   {
     onControlChangeHandler = callback;
   }
 
+  void setHandleControlChange(void (*callback)(void *context, byte channel, byte control, byte value), void *context)
+  {
+    onControlChangeHandler = {callback, context};
+  }
+
   void setHandleProgramChange(void (*callback)(byte channel, byte program))
   {
     onProgramChangeHandler = callback;
   }
 
+  void setHandleProgramChange(void (*callback)(void *context, byte channel, byte program), void *context)
+  {
+    onProgramChangeHandler = {callback, context};
+  }
+
   void setHandlePitchBend(void (*callback)(byte channel, int value))
   {
     onPitchBendHandler = callback;
   }
 
+  void setHandlePitchBend(void (*callback)(void *context, byte channel, int value), void *context)
+  {
+    onPitchBendHandler = {callback, context};
+  }
+
   void setHandleAfterTouchChannel(void (*callback)(byte channel, byte pressure))
   {
     onAfterTouchChannelHandler = callback;
   }
 
+  void setHandleAfterTouchChannel(void (*callback)(void *context, byte channel, byte pressure), void *context)
+  {
+    onAfterTouchChannelHandler = {callback, context};
+  }
+
   void setHandleAfterTouchPoly(void (*callback)(byte channel, byte note, byte pressure))
   {
     onAfterTouchPolyHandler = callback;
   }
 
+  void setHandleAfterTouchPoly(void (*callback)(void *context, byte channel, byte note, byte pressure), void *context)
+  {
+    onAfterTouchPolyHandler = {callback, context};
+  }
+
   void setHandleStart(void (*callback)())
   {
     onStartHandler = callback;
   }
 
+  void setHandleStart(void (*callback)(void *context), void *context)
+  {
+    onStartHandler = {callback, context};
+  }
+
   void setHandleStop(void (*callback)())
   {
     onStopHandler = callback;
   }
 
+  void setHandleStop(void (*callback)(void *context), void *context)
+  {
+    onStopHandler = {callback, context};
+  }
+
   void setHandleContinue(void (*callback)())
   {
     onContinueHandler = callback;
   }
 
+  void setHandleContinue(void (*callback)(void *context), void *context)
+  {
+    onContinueHandler = {callback, context};
+  }
+
   void setHandleClock(void (*callback)())
   {
     onClockHandler = callback;
   }
 
+  void setHandleClock(void (*callback)(void *context), void *context)
+  {
+    onClockHandler = {callback, context};
+  }
+
   void setHandleSongPosition(void (*callback)(uint16_t value))
   {
     onSongPositionHandler = callback;
   }
 
+  void setHandleSongPosition(void (*callback)(void *context, uint16_t value), void *context)
+  {
+    onSongPositionHandler = {callback, context};
+  }
+
   void setHandleSongSelect(void (*callback)(byte value))
   {
     onSongSelectHandler = callback;
   }
 
+  void setHandleSongSelect(void (*callback)(void *context, byte value), void *context)
+  {
+    onSongSelectHandler = {callback, context};
+  }
+
   bool hasPeer(const uint8_t mac[6]) const
   {
-    uint64_t packed = PeerInfo::packMac(mac);
-    for (int i = 0; i < _peersCount; i++)
-    {
-      if (_peers[i].packed_mac == packed)
-        return true;
-    }
-    return false;
+    return findPeer(mac) >= 0;
   }
 
 private:
@@ -671,21 +1258,564 @@ private:
   static esp_now_midi *_instance; // Static pointer to hold the instance
   DataSentCallback userDataSentCallback = nullptr;
   bool _autoPeerDiscovery = true;
+  MidiCapture *_capture = nullptr;
+
+  struct ControlHandlerEntry
+  {
+    ControlFrameHandler handler = nullptr;
+    void *context = nullptr;
+  };
+  ControlHandlerEntry _controlHandlers[ESP_NOW_MIDI_CONTROL_TYPES];
+
+  int64_t _heartbeatIntervalUs = 0; // 0 = liveness tracking off
+  int64_t _peerTimeoutUs = (int64_t)ESP_NOW_MIDI_PEER_TIMEOUT_MS * 1000;
+  int64_t _lastHeartbeatUs = 0;
+  enomik::Callback<void(const uint8_t *mac, EspNowMidiPeerEvent event)> onPeerEventHandler;
+
+  // Subscriptions, bit n = peer index n
+  uint32_t _subscriptions[16][8] = {}; // [channel][type], system messages in [0][7]
+  uint32_t _subscribedPeers = 0;       // peers with a subscription, everyone else gets everything
+  uint32_t _configuredPeers = 0;       // configured locally, announcements are ignored
+  bool _hasOwnSubscription = false;
+  uint16_t _ownChannelMask = ESP_NOW_MIDI_SUBSCRIBE_ALL_CHANNELS;
+  uint8_t _ownTypeMask = ESP_NOW_MIDI_SUBSCRIBE_ALL_TYPES;
+  PeerStats _peerStats[MAX_PEERS] = {};
+
+  uint16_t _session = ESP_NOW_MIDI_SESSION_ID;
+  SessionStats _sessionStats = {};
+
+  inline void tagSession(uint8_t *frame) const
+  {
+    if (!_session)
+      return;
+    frame[0] = ESP_NOW_MIDI_SESSION;
+    frame[1] = _session & 0xFF;
+    frame[2] = _session >> 8;
+  }
+
+  // Strips the session tag, false if the frame belongs to another session
+  inline bool acceptSession(const uint8_t *&data, int &len)
+  {
+    bool tagged = len >= ESP_NOW_MIDI_SESSION_TAG_SIZE && data[0] == ESP_NOW_MIDI_SESSION;
+    if (!tagged)
+    {
+      if (!_session)
+        return true; // not counted, the common case without sessions
+      _sessionStats.untagged++;
+      return false;
+    }
+    if ((data[1] | (data[2] << 8)) != _session)
+    {
+      _sessionStats.foreign++;
+      return false;
+    }
+    _sessionStats.accepted++;
+    data += ESP_NOW_MIDI_SESSION_TAG_SIZE;
+    len -= ESP_NOW_MIDI_SESSION_TAG_SIZE;
+    return true;
+  }
+
+  bool applySubscription(int peer, uint16_t channelMask, uint8_t typeMask)
+  {
+    if (peer < 0 || peer >= _peersCount)
+      return false;
+    uint32_t bit = 1UL << peer;
+    for (int channel = 0; channel < 16; channel++)
+    {
+      for (int type = 0; type < 7; type++)
+      {
+        bool wanted = (channelMask & (1 << channel)) && (typeMask & (1 << type));
+        _subscriptions[channel][type] = wanted ? _subscriptions[channel][type] | bit : _subscriptions[channel][type] & ~bit;
+      }
+    }
+    _subscriptions[0][7] = (typeMask & ESP_NOW_MIDI_SUBSCRIBE_SYSTEM) ? _subscriptions[0][7] | bit : _subscriptions[0][7] & ~bit;
+    _subscribedPeers |= bit;
+    return true;
+  }
+
+  // Mesh
+  bool _meshEnabled = false;
+  bool _meshRelay = false;
+  uint8_t _meshTtl = ESP_NOW_MIDI_MESH_TTL;
+  uint16_t _meshSeq = 0;
+  uint32_t _meshId = 0;
+  MeshRoute _meshRoutes[ESP_NOW_MIDI_MESH_ORIGINS];
+  int _meshRoutesCount = 0;
+  MeshStats _meshStats = {};
+
+  inline void captureOut(const uint8_t *data, size_t len)
+  {
+    if (!_capture)
+      return;
+    if (len > sizeof(midi_message_packet))
+      _capture->recordSysEx(CAPTURE_ESPNOW_OUT, MIDI_CAPTURE_PEER_NONE, ((const midi_sysex_message *)data)->length);
+    else
+      _capture->record(CAPTURE_ESPNOW_OUT, MIDI_CAPTURE_PEER_NONE, data, len);
+  }
+
+  // Also runs on the WiFi task (relays, control replies), so the reached count goes back to the caller.
+  // ESP_ERR_ESPNOW_NOT_FOUND if the mask names peers but none of them is alive
+  esp_err_t transmit(uint32_t mask, const uint8_t *data, size_t len, bool countFiltered, int *reached = nullptr)
+  {
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+    if (_session)
+    {
+      if (len > ESP_NOW_MAX_DATA_LEN - ESP_NOW_MIDI_SESSION_TAG_SIZE)
+        return ESP_ERR_ESPNOW_ARG;
+      tagSession(frame);
+      memcpy(frame + ESP_NOW_MIDI_SESSION_TAG_SIZE, data, len);
+      data = frame;
+      len += ESP_NOW_MIDI_SESSION_TAG_SIZE;
+    }
+    esp_err_t result = ESP_OK;
+    int sent = 0;
+    int alive = 0;
+    for (int i = 0; i < _peersCount; i++)
+    {
+      if (!_peers[i].alive)
+        continue; // no airtime and retries for peers that are gone
+      if (mask & (1UL << i))
+        alive++;
+      PeerStats &stats = _peerStats[i];
+      if (!(mask & (1UL << i)))
+      {
+        if (countFiltered)
+          stats.filtered++;
+        continue;
+      }
+      esp_err_t err = esp_now_send(_peers[i].mac, data, len);
+      if (err != ESP_OK)
+      {
+        stats.failed++;
+        result = err; // Return last error if any
+        continue;
+      }
+      stats.frames++;
+      stats.bytes += len;
+      stats.airtimeUs += ESP_NOW_MIDI_FRAME_AIRTIME_US(len);
+      sent++;
+    }
+    if (reached)
+      *reached = sent;
+    if (!alive && (mask & ((1UL << _peersCount) - 1)))
+      return ESP_ERR_ESPNOW_NOT_FOUND;
+    return result;
+  }
+
+  // Returns the frame length, 0 if data doesn't fit
+  size_t wrapMesh(uint8_t *frame, uint32_t dest, const uint8_t *data, size_t len)
+  {
+    if (len > ESP_NOW_MAX_DATA_LEN - sizeof(esp_now_midi_mesh_header))
+      return 0;
+    esp_now_midi_mesh_header header = {ESP_NOW_MIDI_CONTROL, CONTROL_MESH, _meshId, dest, _meshSeq++, _meshTtl, 0, 0};
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), data, len);
+    _meshStats.originated++;
+    return sizeof(header) + len;
+  }
+
+  // Peer index towards a node, -1 if unknown
+  int nextHop(uint32_t dest)
+  {
+    for (int i = 0; i < _peersCount; i++)
+    {
+      if ((uint32_t)(_peers[i].packed_mac >> 16) == dest)
+        return _peers[i].alive ? i : -1;
+    }
+    MeshRoute *route = findMeshRoute(dest);
+    if (route && route->via >= 0 && route->via < _peersCount && _peers[route->via].alive &&
+        esp_timer_get_time() - route->lastSeenUs < (int64_t)ESP_NOW_MIDI_MESH_ROUTE_TIMEOUT_MS * 1000)
+      return route->via;
+    return -1;
+  }
+
+  MeshRoute *findMeshRoute(uint32_t origin)
+  {
+    for (int i = 0; i < _meshRoutesCount; i++)
+    {
+      if (_meshRoutes[i].origin == origin)
+        return &_meshRoutes[i];
+    }
+    return nullptr;
+  }
+
+  MeshRoute &meshRouteFor(uint32_t origin, uint16_t seq, int64_t now)
+  {
+    MeshRoute *route = findMeshRoute(origin);
+    if (route)
+      return *route;
+    int index = _meshRoutesCount;
+    if (index == ESP_NOW_MIDI_MESH_ORIGINS)
+    {
+      index = 0; // full, replace the origin silent for the longest time
+      for (int i = 1; i < _meshRoutesCount; i++)
+      {
+        if (_meshRoutes[i].lastSeenUs < _meshRoutes[index].lastSeenUs)
+          index = i;
+      }
+    }
+    else
+    {
+      _meshRoutesCount++;
+    }
+    _meshRoutes[index] = {origin, -1, 0, (uint16_t)(seq - 1), 0, now, 0, 0, 0, 0};
+    return _meshRoutes[index];
+  }
+
+  // Sliding window over the last 32 sequence numbers of an origin
+  static bool isDuplicate(MeshRoute &route, uint16_t seq, int64_t now)
+  {
+    int16_t diff = (int16_t)(seq - route.lastSeq);
+    if (diff > 0 || now - route.lastSeenUs > (int64_t)ESP_NOW_MIDI_MESH_ROUTE_TIMEOUT_MS * 1000)
+    {
+      route.window = diff > 0 && diff < 32 ? (route.window << diff) | 1 : 1; // newer, or the origin restarted
+      route.lastSeq = seq;
+      return false;
+    }
+    if (diff <= -32)
+      return true; // too old to tell, late copies are useless for MIDI anyway
+    uint32_t bit = 1UL << -diff;
+    if (route.window & bit)
+      return true;
+    route.window |= bit;
+    return false;
+  }
+
+  void onMeshFrame(const uint8_t *mac, int peer, const uint8_t *frame, int len)
+  {
+    int64_t now = esp_timer_get_time();
+    if (len <= (int)sizeof(esp_now_midi_mesh_header))
+      return;
+    esp_now_midi_mesh_header header;
+    memcpy(&header, frame, sizeof(header));
+    if (header.origin == _meshId)
+      return; // our own frame, back from a relay
+
+    MeshRoute &route = meshRouteFor(header.origin, header.seq, now);
+    if (isDuplicate(route, header.seq, now))
+    {
+      route.duplicates++;
+      _meshStats.duplicates++;
+      return;
+    }
+    route.via = peer;
+    route.hops = header.hops + 1;
+    route.lastSeenUs = now;
+    route.frames++;
+    route.relays += header.hops;
+    route.relayUs += header.relayUs;
+
+    const uint8_t *inner = frame + sizeof(header);
+    int innerLen = len - sizeof(header);
+    bool everyone = header.dest == ESP_NOW_MIDI_MESH_EVERYONE;
+    if (_meshRelay && (everyone || header.dest != _meshId))
+    {
+      if (header.ttl > 1)
+        relayMesh(header, peer, inner, innerLen, now);
+      else
+        _meshStats.expired++;
+    }
+    if (everyone || header.dest == _meshId)
+    {
+      _meshStats.delivered++;
+      // as if the neighbour had sent it, but only its own frames go into its state mirror
+      _meshRelayed = peer < 0 || (uint32_t)(_peers[peer].packed_mac >> 16) != header.origin;
+      OnDataRecv(mac, inner, innerLen);
+      _meshRelayed = false;
+    }
+  }
+
+  void relayMesh(esp_now_midi_mesh_header header, int from, const uint8_t *data, int len, int64_t receivedUs)
+  {
+    uint32_t mask = ESP_NOW_MIDI_ALL_PEERS;
+    int via = header.dest != ESP_NOW_MIDI_MESH_EVERYONE ? nextHop(header.dest) : -1;
+    if (via >= 0 && via != from)
+      mask = 1UL << via; // a route back to the sender is stale, flood instead
+    if (from >= 0)
+      mask &= ~(1UL << from);
+    for (int i = 0; i < _peersCount; i++)
+    {
+      if ((uint32_t)(_peers[i].packed_mac >> 16) == header.origin)
+        mask &= ~(1UL << i); // the origin has it
+    }
+    if (!mask)
+      return;
+
+    uint32_t residenceUs = esp_timer_get_time() - receivedUs;
+    uint32_t relayUs = header.relayUs + residenceUs;
+    header.relayUs = relayUs < 0xFFFF ? relayUs : 0xFFFF;
+    header.ttl--;
+    header.hops++;
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), data, len);
+    transmit(mask, frame, sizeof(header) + len, false);
+
+    _meshStats.forwarded++;
+    _meshStats.relayUs += residenceUs;
+    if (residenceUs > _meshStats.relayMaxUs)
+      _meshStats.relayMaxUs = residenceUs;
+  }
+
+  // Heartbeat payload: empty, or the subscription as [channel mask low, high, type mask]
+  esp_err_t sendHeartbeat()
+  {
+    uint8_t payload[3] = {(uint8_t)(_ownChannelMask & 0xFF), (uint8_t)(_ownChannelMask >> 8), _ownTypeMask};
+    return sendControlFrame(nullptr, CONTROL_HEARTBEAT, payload, _hasOwnSubscription ? sizeof(payload) : 0);
+  }
+
+  void onHeartbeat(int peer, const uint8_t *payload, int len)
+  {
+    _peers[peer].heartbeats = true;
+    if (_configuredPeers & (1UL << peer))
+      return;
+    if (len >= 3)
+      applySubscription(peer, payload[0] | (payload[1] << 8), payload[2]);
+    else
+      _subscribedPeers &= ~(1UL << peer);
+  }
+
+  // State sync
+  MidiStateMirror *_stateOut = nullptr;       // what this node sent to all (subscribed) peers
+  portMUX_TYPE _stateLock = portMUX_INITIALIZER_UNLOCKED; // _stateOut: sendMessage vs snapshot requests on the WiFi task
+  MidiStateMirror *_stateIn[MAX_PEERS] = {}; // what each peer sent, allocated on the loop task
+  uint16_t _stateUnsynced = 0;                // channels used with sendMessageTo
+  int64_t _stateIntervalUs = 0;               // 0 = off
+  int64_t _lastDigestUs = 0;
+  int64_t _lastStateRequestUs = 0;
+  StateSyncStats _stateStats = {};
+  bool _meshRelayed = false; // the frame being handled was relayed from another origin
+
+  void allocateStateMirrors()
+  {
+    for (int i = 0; i < _peersCount; i++)
+    {
+      if (_stateIn[i])
+        continue;
+      MidiStateMirror *mirror = new (std::nothrow) MidiStateMirror();
+      if (!mirror)
+      {
+        ENOMIK_LOGE("State sync: out of memory for peer %d", i);
+        return;
+      }
+      __atomic_store_n(&_stateIn[i], mirror, __ATOMIC_RELEASE); // read by the receive callback
+    }
+  }
+
+  // Lookup only, the receive callback doesn't allocate. nullptr until the loop task allocated it
+  MidiStateMirror *receivedState(int peer)
+  {
+    return __atomic_load_n(&_stateIn[peer], __ATOMIC_ACQUIRE);
+  }
+
+  // Channels whose sent state the peer has seen in full: all of them without a subscription,
+  // otherwise the ones it subscribed with every type the mirror tracks
+  uint16_t syncedChannels(int peer) const
+  {
+    uint16_t channels = _stateOut->getChannels() & ~_stateUnsynced;
+    uint32_t bit = 1UL << peer;
+    if (!(_subscribedPeers & bit))
+      return channels;
+    for (uint8_t ch = 0; ch < 16; ch++)
+    {
+      const uint32_t *types = _subscriptions[ch];
+      // note off, note on, control change, program change, pitch bend
+      if (!(types[0] & types[1] & types[3] & types[4] & types[6] & bit))
+        channels &= ~(1 << ch);
+    }
+    return channels;
+  }
+
+  void sendStateDigest()
+  {
+    for (int i = 0; i < _peersCount; i++)
+    {
+      uint16_t channels = syncedChannels(i);
+      if (!channels)
+        continue;
+      uint8_t payload[2 + 16 * 4] = {(uint8_t)(channels & 0xFF), (uint8_t)(channels >> 8)};
+      size_t len = 2;
+      for (uint8_t ch = 0; ch < 16; ch++)
+      {
+        if (!(channels & (1 << ch)))
+          continue;
+        portENTER_CRITICAL(&_stateLock);
+        uint32_t digest = _stateOut->digest(ch + 1);
+        portEXIT_CRITICAL(&_stateLock);
+        memcpy(payload + len, &digest, 4);
+        len += 4;
+      }
+      _stateStats.digestsSent++;
+      sendControlFrame(_peers[i].mac, CONTROL_STATE_DIGEST, payload, len);
+    }
+  }
+
+  // Whether a peer other than except holds the note. Such a note stays on, that peer's sync turns it off
+  bool heldByOthers(int except, uint8_t channel, uint8_t note) const
+  {
+    for (int i = 0; i < _peersCount; i++)
+    {
+      if (i != except && _stateIn[i] && _stateIn[i]->isNoteOn(channel, note))
+        return true;
+    }
+    return false;
+  }
+
+  void onStateFrame(const uint8_t *mac, uint8_t type, const uint8_t *payload, int len)
+  {
+    int peer = findPeer(mac);
+    if (peer < 0)
+      return;
+    MidiStateMirror *mirror = receivedState(peer);
+    if (type == CONTROL_STATE_SNAPSHOT)
+    {
+      auto emit = [this, peer](const midi_message &message)
+      {
+        if (message.status != MIDI_NOTE_OFF || !heldByOthers(peer, message.channel, message.firstByte))
+          dispatch(message);
+      };
+      int turnedOff = mirror ? mirror->reconcile(payload, len, emit) : -1;
+      if (turnedOff < 0)
+        return;
+      _stateStats.snapshotsReceived++;
+      _stateStats.notesTurnedOff += turnedOff;
+      return;
+    }
+    if (len < 2)
+      return;
+    uint16_t channels = payload[0] | (payload[1] << 8);
+
+    if (type == CONTROL_STATE_REQUEST)
+    {
+      uint8_t snapshot[MIDI_STATE_SNAPSHOT_SIZE];
+      channels &= syncedChannels(peer);
+      for (uint8_t ch = 0; ch < 16; ch++)
+      {
+        if (!(channels & (1 << ch)))
+          continue;
+        portENTER_CRITICAL(&_stateLock);
+        _stateOut->encode(ch + 1, snapshot);
+        portEXIT_CRITICAL(&_stateLock);
+        if (sendControlFrame(mac, CONTROL_STATE_SNAPSHOT, snapshot, sizeof(snapshot)) == ESP_OK)
+          _stateStats.snapshotsSent++;
+      }
+      return;
+    }
+
+    // Digest: ask for the channels that differ, at most twice per interval
+    if (!mirror)
+      return;
+    _stateStats.digestsReceived++;
+    uint16_t mismatched = 0;
+    int offset = 2;
+    for (uint8_t ch = 0; ch < 16 && offset + 4 <= len; ch++)
+    {
+      if (!(channels & (1 << ch)))
+        continue;
+      uint32_t digest;
+      memcpy(&digest, payload + offset, 4);
+      offset += 4;
+      if (digest != mirror->digest(ch + 1))
+        mismatched |= 1 << ch;
+    }
+    _stateStats.mismatches += __builtin_popcount(mismatched);
+    if (mismatched && esp_timer_get_time() - _lastStateRequestUs >= _stateIntervalUs / 2)
+      requestState(mismatched, mac);
+  }
+
+  // Calls the handler for a received message
+  void dispatch(const midi_message &message)
+  {
+    switch (message.status)
+    {
+    case MIDI_NOTE_ON:
+      if (onNoteOnHandler)
+        onNoteOnHandler(message.channel, message.firstByte, message.secondByte);
+      break;
+    case MIDI_NOTE_OFF:
+      if (onNoteOffHandler)
+        onNoteOffHandler(message.channel, message.firstByte, message.secondByte);
+      break;
+    case MIDI_CONTROL_CHANGE:
+      if (onControlChangeHandler)
+        onControlChangeHandler(message.channel, message.firstByte, message.secondByte);
+      break;
+    case MIDI_PROGRAM_CHANGE:
+      if (onProgramChangeHandler)
+        onProgramChangeHandler(message.channel, message.firstByte);
+      break;
+    case MIDI_AFTERTOUCH:
+      if (onAfterTouchChannelHandler)
+        onAfterTouchChannelHandler(message.channel, message.firstByte);
+      break;
+    case MIDI_POLY_AFTERTOUCH:
+      if (onAfterTouchPolyHandler)
+        onAfterTouchPolyHandler(message.channel, message.firstByte, message.secondByte);
+      break;
+    case MIDI_PITCH_BEND:
+    {
+      int pitchBendValue = (message.secondByte << 7) | message.firstByte;
+      int16_t signedValue = pitchBendValue - 8192;
+      if (onPitchBendHandler)
+        onPitchBendHandler(message.channel, signedValue);
+      break;
+    }
+    case MIDI_START:
+      if (onStartHandler)
+        onStartHandler();
+      break;
+    case MIDI_STOP:
+      if (onStopHandler)
+        onStopHandler();
+      break;
+    case MIDI_CONTINUE:
+      if (onContinueHandler)
+        onContinueHandler();
+      break;
+    case MIDI_TIME_CLOCK:
+      if (onClockHandler)
+        onClockHandler();
+      break;
+    case MIDI_SONG_POS_POINTER:
+    {
+      int songPosValue = (message.secondByte << 7) | message.firstByte;
+      if (onSongPositionHandler)
+        onSongPositionHandler(songPosValue);
+      break;
+    }
+    case MIDI_SONG_SELECT:
+      if (onSongSelectHandler)
+        onSongSelectHandler(message.firstByte);
+      break;
+    }
+  }
+
+  inline void markSeen(int peer)
+  {
+    _peers[peer].lastSeenUs = esp_timer_get_time();
+    if (!_peers[peer].alive)
+    {
+      _peers[peer].alive = true;
+      _lastDigestUs = 0; // the peer may have missed state, send the digest with the next update
+      if (onPeerEventHandler)
+        onPeerEventHandler(_peers[peer].mac, PEER_ALIVE);
+    }
+  }
 
   // MIDI Handlers
-  void (*onNoteOnHandler)(byte channel, byte note, byte velocity) = nullptr;
-  void (*onNoteOffHandler)(byte channel, byte note, byte velocity) = nullptr;
-  void (*onControlChangeHandler)(byte channel, byte control, byte value) = nullptr;
-  void (*onProgramChangeHandler)(byte channel, byte program) = nullptr;
-  void (*onPitchBendHandler)(byte channel, int value) = nullptr;
-  void (*onAfterTouchChannelHandler)(byte channel, byte value) = nullptr;
-  void (*onAfterTouchPolyHandler)(byte channel, byte note, byte value) = nullptr;
-  void (*onStartHandler)() = nullptr;
-  void (*onStopHandler)() = nullptr;
-  void (*onContinueHandler)() = nullptr;
-  void (*onClockHandler)() = nullptr;
-  void (*onSongPositionHandler)(uint16_t value) = nullptr;
-  void (*onSongSelectHandler)(byte value) = nullptr;
+  enomik::Callback<void(byte channel, byte note, byte velocity)> onNoteOnHandler;
+  enomik::Callback<void(byte channel, byte note, byte velocity)> onNoteOffHandler;
+  enomik::Callback<void(byte channel, byte control, byte value)> onControlChangeHandler;
+  enomik::Callback<void(byte channel, byte program)> onProgramChangeHandler;
+  enomik::Callback<void(byte channel, int value)> onPitchBendHandler;
+  enomik::Callback<void(byte channel, byte value)> onAfterTouchChannelHandler;
+  enomik::Callback<void(byte channel, byte note, byte value)> onAfterTouchPolyHandler;
+  enomik::Callback<void()> onStartHandler;
+  enomik::Callback<void()> onStopHandler;
+  enomik::Callback<void()> onContinueHandler;
+  enomik::Callback<void()> onClockHandler;
+  enomik::Callback<void(uint16_t value)> onSongPositionHandler;
+  enomik::Callback<void(byte value)> onSongSelectHandler;
 };
 
 esp_now_midi *esp_now_midi::_instance = nullptr;
\ No newline at end of file
@@ -99,6 +99,10 @@ void onPitchBend(byte channel, int value) {}
 void onAfterTouch(byte channel, byte value) {}
 void onPolyAfterTouch(byte channel, byte note, byte value) {}
 
+void updateDmx() {
+  dmx.update();
+}
+
 void setup() {
   Serial.begin(115200);
   WiFi.mode(WIFI_STA);
@@ -118,6 +122,9 @@ void setup() {
   dmx.begin(dmxSerial, enPin, numChannels);
   dmx.setComDir(DMX_WRITE_DIR);
 
+  // refresh the fixtures at ~40 Hz from the client scheduler, so a slow frame can't hold up MIDI
+  _client.scheduler.add("dmx", updateDmx, 25000, 5000);
+
   // register as a client by sending any message
   // this is needed in this case, as the client will stay unkown to the dongle until the first message is sent.
   _client.sendControlChange(127, 127, 16);
@@ -125,5 +132,4 @@ void setup() {
 
 void loop() {
   _client.loop();
-  dmx.update();
 }
@@ -4,6 +4,7 @@
 
 #define SCREEN_ADDRESS 0x3C ///< See datasheet for Address; or run an i2c scanner
 #define UPDATE_DISPLAY_INTERVAL 64
+#define CAPTURE_DRAIN_COMMAND 'c' // send this character via serial to dump the traffic capture
 
 // DO NOT CHANGE BELOW THIS LINE
 #define MAC_ADDR_LEN 6
@@ -3,6 +3,7 @@
 #include <Adafruit_TinyUSB.h>
 #include <MIDI.h>
 #include <esp_now_midi.h>
+#include <UsbMidiOut.h>
 #include <esp_system.h>
 #include "MidiMessageHistory.h"
 
@@ -14,6 +15,8 @@ String version = getVersion();
 
 Adafruit_USBD_MIDI usb_midi;
 MIDI_CREATE_INSTANCE(Adafruit_USBD_MIDI, usb_midi, MIDI);
+// ESP-NOW -> USB, packets are collected and written once per USB frame
+UsbMidiOut<Adafruit_USBD_MIDI> usbOut(usb_midi);
 
 esp_now_midi* espnowMIDI = nullptr;
 #if HAS_DISPLAY == 1
@@ -29,6 +32,15 @@ String macStr;
 MidiMessageHistory messageHistory[MAX_HISTORY];
 int messageIndex = 0;
 
+// Binary capture of all ESP-NOW and USB traffic, including clock and song position
+MidiCapture capture;
+
+// ESP-NOW to USB, recorded as USB out
+void sendUsb(const midi_message& msg) {
+  capture.record(CAPTURE_USB_OUT, MIDI_CAPTURE_PEER_NONE, msg);
+  sendUsb(msg);
+}
+
 // Function to add a new message to the history
 void addToHistory(const midi_message& msg, bool outgoing = false) {
   messageHistory[messageIndex].message = msg;
@@ -62,7 +74,7 @@ void handleNoteOn(byte channel, byte note, byte velocity) {
   msg.secondByte = velocity;
   addToHistory(msg, false);
 
-  MIDI.sendNoteOn(note, velocity, channel);
+  sendUsb(msg);
 }
 
 void handleNoteOff(byte channel, byte note, byte velocity) {
@@ -73,7 +85,7 @@ void handleNoteOff(byte channel, byte note, byte velocity) {
   msg.secondByte = velocity;
   addToHistory(msg, false);
 
-  MIDI.sendNoteOff(note, velocity, channel);
+  sendUsb(msg);
 }
 
 void handleControlChange(byte channel, byte control, byte value) {
@@ -84,7 +96,7 @@ void handleControlChange(byte channel, byte control, byte value) {
   msg.secondByte = value;
   addToHistory(msg, false);
 
-  MIDI.sendControlChange(control, value, channel);
+  sendUsb(msg);
 }
 
 void handleProgramChange(byte channel, byte program) {
@@ -95,7 +107,7 @@ void handleProgramChange(byte channel, byte program) {
   msg.secondByte = 0;
   addToHistory(msg, false);
 
-  MIDI.sendProgramChange(program, channel);
+  sendUsb(msg);
 }
 
 void handleAfterTouchChannel(byte channel, byte pressure) {
@@ -106,7 +118,7 @@ void handleAfterTouchChannel(byte channel, byte pressure) {
   msg.secondByte = 0;
   addToHistory(msg, false);
 
-  MIDI.sendAfterTouch(pressure, channel);
+  sendUsb(msg);
 }
 
 void handleAfterTouchPoly(byte channel, byte note, byte pressure) {
@@ -117,7 +129,7 @@ void handleAfterTouchPoly(byte channel, byte note, byte pressure) {
   msg.secondByte = pressure;
   addToHistory(msg, false);
 
-  MIDI.sendAfterTouch(note, pressure, channel);
+  sendUsb(msg);
 }
 
 void handlePitchBend(byte channel, int value) {
@@ -129,7 +141,7 @@ void handlePitchBend(byte channel, int value) {
   msg.secondByte = (unsignedValue >> 7) & 0x7F;
   addToHistory(msg, false);
 
-  MIDI.sendPitchBend(value + 8192, channel);  // MIDI library expects 0-16383
+  sendUsb(msg);
 }
 
 void handleStart() {
@@ -140,7 +152,7 @@ void handleStart() {
   msg.secondByte = 0;
   addToHistory(msg, false);
 
-  MIDI.sendStart();
+  sendUsb(msg);
 }
 
 void handleStop() {
@@ -151,7 +163,7 @@ void handleStop() {
   msg.secondByte = 0;
   addToHistory(msg, false);
 
-  MIDI.sendStop();
+  sendUsb(msg);
 }
 
 void handleContinue() {
@@ -162,17 +174,19 @@ void handleContinue() {
   msg.secondByte = 0;
   addToHistory(msg, false);
 
-  MIDI.sendContinue();
+  sendUsb(msg);
 }
 
 void handleClock() {
   // Don't print or add to history - too many messages
-  MIDI.sendClock();
+  midi_message msg = { 0, MIDI_TIME_CLOCK, 0, 0 };
+  sendUsb(msg);
 }
 
 void handleSongPosition(uint16_t value) {
   // Don't add to history - too frequent
-  MIDI.sendSongPosition(value);
+  midi_message msg = { 0, MIDI_SONG_POS_POINTER, (byte)(value & 0x7F), (byte)((value >> 7) & 0x7F) };
+  sendUsb(msg);
 }
 
 void handleSongSelect(byte value) {
@@ -183,7 +197,7 @@ void handleSongSelect(byte value) {
   msg.secondByte = 0;
   addToHistory(msg, false);
 
-  MIDI.sendSongSelect(value);
+  sendUsb(msg);
 }
 
 // USB MIDI receive handlers - forward to ESP-NOW
@@ -194,6 +208,7 @@ void onNoteOn(byte channel, byte pitch, byte velocity) {
   msg.firstByte = pitch;
   msg.secondByte = velocity;
   addToHistory(msg, true);
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
 
   espnowMIDI->sendNoteOn(pitch, velocity, channel);
 }
@@ -205,6 +220,7 @@ void onNoteOff(byte channel, byte pitch, byte velocity) {
   msg.firstByte = pitch;
   msg.secondByte = velocity;
   addToHistory(msg, true);
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
 
   espnowMIDI->sendNoteOff(pitch, velocity, channel);
 }
@@ -216,6 +232,7 @@ void onControlChange(byte channel, byte controller, byte value) {
   msg.firstByte = controller;
   msg.secondByte = value;
   addToHistory(msg, true);
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
 
   espnowMIDI->sendControlChange(controller, value, channel);
 }
@@ -227,6 +244,7 @@ void onProgramChange(byte channel, byte program) {
   msg.firstByte = program;
   msg.secondByte = 0;
   addToHistory(msg, true);
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
 
   espnowMIDI->sendProgramChange(program, channel);
 }
@@ -238,6 +256,7 @@ void onAfterTouch(byte channel, byte pressure) {
   msg.firstByte = pressure;
   msg.secondByte = 0;
   addToHistory(msg, true);
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
 
   espnowMIDI->sendAfterTouch(pressure, channel);
 }
@@ -249,6 +268,7 @@ void onPolyAfterTouch(byte channel, byte note, byte pressure) {
   msg.firstByte = note;
   msg.secondByte = pressure;
   addToHistory(msg, true);
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
 
   espnowMIDI->sendAfterTouchPoly(note, pressure, channel);
 }
@@ -260,6 +280,7 @@ void onPitchBend(byte channel, int value) {
   msg.firstByte = value & 0x7F;
   msg.secondByte = (value >> 7) & 0x7F;
   addToHistory(msg, true);
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
 
   // Convert from MIDI library format (0-16383) to signed (-8192 to 8191)
   espnowMIDI->sendPitchBend(value - 8192, channel);
@@ -272,6 +293,7 @@ void onStart() {
   msg.firstByte = 0;
   msg.secondByte = 0;
   addToHistory(msg, true);
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
 
   espnowMIDI->sendStart();
 }
@@ -283,6 +305,7 @@ void onStop() {
   msg.firstByte = 0;
   msg.secondByte = 0;
   addToHistory(msg, true);
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
 
   espnowMIDI->sendStop();
 }
@@ -294,17 +317,22 @@ void onContinue() {
   msg.firstByte = 0;
   msg.secondByte = 0;
   addToHistory(msg, true);
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
 
   espnowMIDI->sendContinue();
 }
 
 void onClock() {
   // Don't print or add to history - too many messages
+  midi_message msg = { 0, MIDI_TIME_CLOCK, 0, 0 };
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
   espnowMIDI->sendClock();
 }
 
 void onSongPosition(unsigned int value) {
   // Don't add to history - too frequent
+  midi_message msg = { 0, MIDI_SONG_POS_POINTER, (byte)(value & 0x7F), (byte)((value >> 7) & 0x7F) };
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
   espnowMIDI->sendSongPosition(value);
 }
 
@@ -315,6 +343,7 @@ void onSongSelect(byte value) {
   msg.firstByte = value;
   msg.secondByte = 0;
   addToHistory(msg, true);
+  capture.record(CAPTURE_USB_IN, MIDI_CAPTURE_PEER_NONE, msg);
 
   espnowMIDI->sendSongSelect(value);
 }
@@ -326,6 +355,7 @@ void setup() {
   Serial.println("=== ESP-NOW MIDI DONGLE ===");
   Serial.printf("ESP-IDF Version: %s\n", esp_get_idf_version());
   Serial.printf("Channel: %d\n", ESP_NOW_MIDI_CHANNEL);
+  Serial.printf("Session: %u\n", ESP_NOW_MIDI_SESSION_ID);
 
 
   // Initialize USB MIDI
@@ -347,6 +377,7 @@ void setup() {
   // Initialize ESP-NOW MIDI library
   espnowMIDI = new esp_now_midi();
   espnowMIDI->begin();
+  espnowMIDI->setCapture(&capture);
 
   readMacAddress();
   Serial.print("Mac: ");
@@ -442,6 +473,19 @@ void loop() {
     MIDI.read();
   }
 
+  // ESP-NOW -> USB packets that found the USB FIFO full, nothing piles up while unplugged.
+  // clear() is safe against a send() from the WiFi task.
+  if (TinyUSBDevice.mounted()) {
+    usbOut.poll();
+  } else {
+    usbOut.clear();
+  }
+
+  // Dump the capture ring, see scripts/midi_capture.py
+  if (Serial.available() && Serial.read() == CAPTURE_DRAIN_COMMAND) {
+    capture.drain(Serial);
+  }
+
 
 #if HAS_DISPLAY == 1
   if (display && (now - lastDisplayUpdate) >= UPDATE_DISPLAY_INTERVAL) {
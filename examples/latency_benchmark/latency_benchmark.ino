@@ -0,0 +1,40 @@
+#include <esp_now.h>
+#include <WiFi.h>
+#include "esp_now_midi.h"
+#include "LatencyBenchmark.h"
+
+// Radio-only latency benchmark, flash it to two boards.
+// The initiator pings the responder and prints rtt and one way latency histograms in the
+// benchmark results format after every run, save the serial output and run
+//   python3 scripts/benchmark.py report serial.log
+// Set INITIATOR to 0 for the responder.
+
+#define INITIATOR 1
+#define ITERATIONS 10000
+#define INTERVAL_US 10000
+#define BOARD "lolin esp32-s2-mini"
+#define DISTANCE "0.5m"
+
+// on the responder: run the print_mac firmware and paste it here
+uint8_t peerMacAddress[6] = { 0x84, 0xF7, 0x03, 0xF2, 0x54, 0x62 };
+esp_now_midi ESP_NOW_MIDI;
+LatencyBenchmark benchmark;
+
+void setup() {
+  Serial.begin(115200);
+  ESP_NOW_MIDI.begin(false, INITIATOR == 0);
+  benchmark.begin(ESP_NOW_MIDI);
+#if INITIATOR == 1
+  ESP_NOW_MIDI.addPeer(peerMacAddress);
+  benchmark.start(peerMacAddress, ITERATIONS, INTERVAL_US);
+#endif
+}
+
+void loop() {
+#if INITIATOR == 1
+  if (benchmark.loop()) {
+    benchmark.printResults(Serial, BOARD, DISTANCE);
+    benchmark.start(peerMacAddress, ITERATIONS, INTERVAL_US);
+  }
+#endif
+}
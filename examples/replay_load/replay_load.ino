@@ -0,0 +1,44 @@
+#include <esp_now.h>
+#include <WiFi.h>
+#include "esp_now_midi.h"
+#include "MidiReplay.h"
+
+// Bench load generator: pushes synthetic traffic (chord bursts, a CC sweep and 24 ppqn clock)
+// through esp_now_midi at SPEED times real time and prints throughput, latency and drops.
+
+#define SPEED 10.0f
+#define EVENTS 2000
+#define PAUSE_BETWEEN_RUNS 5000
+
+// on the dongle: run the print_mac firmware and paste it here
+uint8_t peerMacAddress[6] = { 0x84, 0xF7, 0x03, 0xF2, 0x54, 0x62 };
+esp_now_midi ESP_NOW_MIDI;
+
+ChordBurstGenerator chords(EVENTS / 8, 20000, 4, 1);
+CcSweepGenerator sweep(EVENTS, 5000, 1, 2);
+ClockGenerator midiClock(EVENTS, 120.0f);
+MergedTraceSource mix;
+MidiReplay replay(ESP_NOW_MIDI);
+
+uint64_t now() {
+  return esp_timer_get_time();
+}
+
+void setup() {
+  Serial.begin(115200);
+  ESP_NOW_MIDI.begin();
+  ESP_NOW_MIDI.addPeer(peerMacAddress);
+
+  mix.add(&chords);
+  mix.add(&sweep);
+  mix.add(&midiClock);
+  replay.begin(&mix, SPEED, now());
+}
+
+void loop() {
+  if (!replay.poll(now)) {
+    replay.printStats(Serial);
+    delay(PAUSE_BETWEEN_RUNS);
+    replay.begin(&mix, SPEED, now());
+  }
+}
@@ -0,0 +1,124 @@
+// Handler dispatch cost: the old enomik::Client path (static trampoline -> instancePtr -> std::function)
+// against enomik::Callback with a plain function, a context pointer and a wrapped std::function,
+// plus esp_now_midi::OnDataRecv end to end. Cycles per call from rdtsc on x86, nanoseconds elsewhere.
+//
+//   dispatch_bench [iterations]
+#include <Arduino.h> // included implicitly in sketches
+#include "esp_now_midi.h"
+#include "utils/callback.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "cycles"
+static inline uint64_t ticks() { return __rdtsc(); }
+#else
+#include <chrono>
+#define BENCH_UNIT "ns"
+static inline uint64_t ticks()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+static volatile uint32_t sink = 0;
+
+__attribute__((noinline)) static void onControlChange(byte channel, byte control, byte value)
+{
+    sink += channel + control + value;
+}
+
+struct Receiver
+{
+    uint32_t total = 0;
+
+    __attribute__((noinline)) void onControlChange(byte channel, byte control, byte value)
+    {
+        total += channel + control + value;
+    }
+
+    static void onControlChangeContext(void *context, byte channel, byte control, byte value)
+    {
+        static_cast<Receiver *>(context)->onControlChange(channel, control, value);
+    }
+};
+
+// Shape of the previous enomik::Client dispatch
+struct LegacyClient
+{
+    static LegacyClient *instancePtr;
+    std::function<void(byte, byte, byte)> _onControlChangeHandler;
+
+    __attribute__((noinline)) static void handleControlChangeStatic(byte channel, byte control, byte value)
+    {
+        if (instancePtr && instancePtr->_onControlChangeHandler)
+            instancePtr->_onControlChangeHandler(channel, control, value);
+    }
+};
+LegacyClient *LegacyClient::instancePtr = nullptr;
+
+template <typename Call>
+static double measure(uint32_t iterations, Call call)
+{
+    for (uint32_t i = 0; i < 1000; i++)
+        call(i);
+    uint64_t best = UINT64_MAX;
+    for (int round = 0; round < 5; round++)
+    {
+        uint64_t start = ticks();
+        for (uint32_t i = 0; i < iterations; i++)
+            call(i);
+        uint64_t elapsed = ticks() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    return (double)best / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = argc > 1 ? atoi(argv[1]) : 10000000;
+    Receiver receiver;
+
+    LegacyClient legacy;
+    LegacyClient::instancePtr = &legacy;
+    legacy._onControlChangeHandler = [&receiver](byte channel, byte control, byte value)
+    { receiver.onControlChange(channel, control, value); };
+    void (*volatile legacyEntry)(byte, byte, byte) = LegacyClient::handleControlChangeStatic;
+
+    enomik::Callback<void(byte, byte, byte)> plain(onControlChange);
+    enomik::Callback<void(byte, byte, byte)> context(Receiver::onControlChangeContext, &receiver);
+    auto bound = enomik::Callback<void(byte, byte, byte)>::bind<Receiver, &Receiver::onControlChange>(&receiver);
+    enomik::Callback<void(byte, byte, byte)> wrapped([&receiver](byte channel, byte control, byte value)
+                                                     { receiver.onControlChange(channel, control, value); });
+
+    printf("dispatch, %s per call (best of 5 x %u)\n", BENCH_UNIT, iterations);
+    printf("  legacy trampoline + std::function  %6.2f\n", measure(iterations, [&](uint32_t i)
+                                                                   { legacyEntry(1, i & 0x7F, 64); }));
+    printf("  Callback, function pointer         %6.2f\n", measure(iterations, [&](uint32_t i)
+                                                                   { plain(1, i & 0x7F, 64); }));
+    printf("  Callback, context pointer          %6.2f\n", measure(iterations, [&](uint32_t i)
+                                                                   { context(1, i & 0x7F, 64); }));
+    printf("  Callback, bound member             %6.2f\n", measure(iterations, [&](uint32_t i)
+                                                                   { bound(1, i & 0x7F, 64); }));
+    printf("  Callback, wrapped std::function    %6.2f\n", measure(iterations, [&](uint32_t i)
+                                                                   { wrapped(1, i & 0x7F, 64); }));
+
+    // Whole receive path: packet decode + switch + handler
+    esp_now_midi midi;
+    Serial.enabled = false;
+    midi.begin(false, false);
+    uint8_t mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+    midi.addPeer(mac);
+    uint8_t packet[3] = {MIDI_CONTROL_CHANGE, 1, 64};
+
+    midi.setHandleControlChange(LegacyClient::handleControlChangeStatic);
+    double receiveLegacy = measure(iterations, [&](uint32_t i)
+                                   { packet[1] = i & 0x7F; midi.OnDataRecv(mac, packet, 3); });
+    midi.setHandleControlChange(Receiver::onControlChangeContext, &receiver);
+    double receiveContext = measure(iterations, [&](uint32_t i)
+                                    { packet[1] = i & 0x7F; midi.OnDataRecv(mac, packet, 3); });
+    printf("esp_now_midi::OnDataRecv, %s per message\n", BENCH_UNIT);
+    printf("  legacy trampoline + std::function  %6.2f\n", receiveLegacy);
+    printf("  context handler                    %6.2f\n", receiveContext);
+    printf("(sink %u, %u)\n", (unsigned)sink, receiver.total & 1);
+    return 0;
+}
@@ -0,0 +1,248 @@
+// Analog input filters from enomik_filters.h against the previous float EWMA: cost per sample, and
+// latency against noise on recorded sensor data (one raw ADC or touch value per line) or on a
+// synthetic pot (steps and ramps, gaussian noise and spikes). Latency is the shift that brings the
+// output closest to a reference (the clean signal, or a centered moving average of a recording),
+// noise the rms distance to the reference while it doesn't move. MIDI messages are counted as IO
+// would send them, quiet ones while the reference doesn't move.
+//
+//   filter_bench [--input samples.txt] [--rate hz] [--max adc] [--noise counts] [--seconds s]
+#include <Arduino.h> // included implicitly in sketches
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include "enomik_filters.h"
+
+using namespace enomik;
+
+struct Candidate
+{
+    const char *name;
+    int type; // -1 = float EWMA as IO had it
+    uint8_t param;
+};
+
+static const Candidate candidates[] = {
+    {"float ewma", -1, 0},
+    {"none", FILTER_NONE, 0},
+    {"ewma", FILTER_EWMA, 0},
+    {"ewma 0.1", FILTER_EWMA, 13},
+    {"one-euro", FILTER_ONE_EURO, 0},
+    {"one-euro 60", FILTER_ONE_EURO, 60},
+    {"median 5", FILTER_MEDIAN, 5},
+    {"median 7", FILTER_MEDIAN, 7},
+    {"deadband", FILTER_DEADBAND, 0},
+    {"deadband 32", FILTER_DEADBAND, 32},
+};
+
+static std::vector<int32_t> run(const Candidate &candidate, const std::vector<int32_t> &input)
+{
+    std::vector<int32_t> output(input.size());
+    if (candidate.type < 0)
+    {
+        float smoothed = input.empty() ? 0 : input[0];
+        for (size_t i = 0; i < input.size(); i++)
+        {
+            smoothed = 0.3f * input[i] + 0.7f * smoothed;
+            output[i] = (int32_t)smoothed;
+        }
+        return output;
+    }
+    Filter filter;
+    filter.configure(candidate.type, candidate.param);
+    for (size_t i = 0; i < input.size(); i++)
+        output[i] = filter.update(input[i]);
+    return output;
+}
+
+static double nsPerSample(const Candidate &candidate, const std::vector<int32_t> &input)
+{
+    volatile int32_t sink = 0;
+    double best = 1e9;
+    for (int pass = 0; pass < 5; pass++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (candidate.type < 0)
+        {
+            float smoothed = input[0];
+            for (int32_t x : input)
+            {
+                smoothed = 0.3f * x + 0.7f * smoothed;
+                sink = (int32_t)smoothed;
+            }
+        }
+        else
+        {
+            Filter filter;
+            filter.configure(candidate.type, candidate.param);
+            for (int32_t x : input)
+                sink = filter.update(x);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, ns / input.size());
+    }
+    (void)sink;
+    return best;
+}
+
+// IO's 7 bit mapping and send threshold
+static uint32_t midiMessages(const std::vector<int32_t> &values, int maxValue, const std::vector<bool> &quiet,
+                             uint32_t &quietMessages)
+{
+    uint32_t messages = 0;
+    int last = -1;
+    quietMessages = 0;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        int value = std::max(0, std::min(127, (int)((int64_t)values[i] * 127 / maxValue)));
+        if (last != -1 && std::abs(value - last) < 2) // IO::ANALOG_THRESHOLD
+            continue;
+        if (last != -1 && quiet[i])
+            quietMessages++;
+        last = value;
+        messages++;
+    }
+    return messages;
+}
+
+int main(int argc, char **argv)
+{
+    std::string inputFile;
+    float rate = 1000;
+    int maxValue = 4095;
+    float noise = 4;
+    float seconds = 20;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "--input")
+            inputFile = argv[i + 1];
+        else if (arg == "--rate")
+            rate = atof(argv[i + 1]);
+        else if (arg == "--max")
+            maxValue = atoi(argv[i + 1]);
+        else if (arg == "--noise")
+            noise = atof(argv[i + 1]);
+        else if (arg == "--seconds")
+            seconds = atof(argv[i + 1]);
+        else
+        {
+            printf("usage: filter_bench [--input samples.txt] [--rate hz] [--max adc] [--noise counts] [--seconds s]\n");
+            return 1;
+        }
+    }
+
+    std::vector<int32_t> input;
+    std::vector<double> reference;
+    if (!inputFile.empty())
+    {
+        FILE *file = fopen(inputFile.c_str(), "r");
+        if (!file)
+        {
+            printf("can't open %s\n", inputFile.c_str());
+            return 1;
+        }
+        long value;
+        while (fscanf(file, "%ld", &value) == 1)
+            input.push_back(value);
+        fclose(file);
+        const int half = 7;
+        for (size_t i = 0; i < input.size(); i++)
+        {
+            double sum = 0;
+            int count = 0;
+            for (int j = -half; j <= half; j++)
+            {
+                if ((int64_t)i + j >= 0 && i + j < input.size())
+                {
+                    sum += input[i + j];
+                    count++;
+                }
+            }
+            reference.push_back(sum / count);
+        }
+    }
+    else
+    {
+        // A pot that rests, jumps and is turned slowly, with ADC noise and the odd spike
+        std::mt19937 random(1);
+        std::normal_distribution<double> gaussian(0, noise);
+        std::uniform_real_distribution<double> uniform(0, 1);
+        size_t samples = (size_t)(seconds * rate);
+        double level = maxValue / 4.0, target = level;
+        for (size_t i = 0; i < samples; i++)
+        {
+            size_t phase = i % (size_t)(2 * rate);
+            if (phase == 0)
+                target = uniform(random) * maxValue;
+            if (phase < rate / 2)
+                level = target; // step
+            else if (phase > rate && phase < 1.5 * rate)
+                level += (maxValue / 2.0 - level) / (rate / 4); // ramp
+            double sample = level + gaussian(random);
+            if (uniform(random) < 0.001)
+                sample += (uniform(random) < 0.5 ? -1 : 1) * maxValue / 32.0;
+            input.push_back(std::max(0, std::min(maxValue, (int)std::lround(sample))));
+            reference.push_back(level);
+        }
+    }
+    if (input.size() < 100)
+    {
+        printf("not enough samples\n");
+        return 1;
+    }
+
+    // Quiet: the reference moves less than half a MIDI step over +-25 ms
+    std::vector<bool> quiet(input.size());
+    int window = std::max(1, (int)(rate * 0.025f));
+    double step = maxValue / 127.0 / 2;
+    for (size_t i = 0; i < input.size(); i++)
+    {
+        size_t from = i >= (size_t)window ? i - window : 0;
+        size_t to = std::min(input.size() - 1, i + window);
+        quiet[i] = std::fabs(reference[to] - reference[from]) < step;
+    }
+
+    printf("%zu samples at %.0f Hz (%s), 0-%d\n", input.size(), rate,
+           inputFile.empty() ? "synthetic" : inputFile.c_str(), maxValue);
+    printf("%-12s %8s %8s %8s %8s %7s\n", "", "ns/smpl", "lag ms", "noise", "msgs", "quiet");
+    for (const Candidate &candidate : candidates)
+    {
+        std::vector<int32_t> output = run(candidate, input);
+
+        int bestLag = 0;
+        double bestRms = 1e18;
+        int maxLag = std::min((int)(rate / 5), (int)input.size() / 2);
+        for (int lag = 0; lag <= maxLag; lag++)
+        {
+            double sum = 0;
+            for (size_t i = lag; i < output.size(); i++)
+            {
+                double d = output[i] - reference[i - lag];
+                sum += d * d;
+            }
+            double rms = std::sqrt(sum / (output.size() - lag));
+            if (rms < bestRms)
+            {
+                bestRms = rms;
+                bestLag = lag;
+            }
+        }
+        double sum = 0;
+        size_t count = 0;
+        for (size_t i = 0; i < output.size(); i++)
+        {
+            if (!quiet[i])
+                continue;
+            sum += (output[i] - reference[i]) * (output[i] - reference[i]);
+            count++;
+        }
+
+        uint32_t quietMessages;
+        uint32_t messages = midiMessages(output, maxValue, quiet, quietMessages);
+        printf("%-12s %8.2f %8.1f %8.2f %8u %7u\n", candidate.name, nsPerSample(candidate, input),
+               bestLag * 1000.0 / rate, count ? std::sqrt(sum / count) : 0.0, messages, quietMessages);
+    }
+    return 0;
+}
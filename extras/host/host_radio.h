@@ -0,0 +1,512 @@
+#pragma once
+// Host transport behind the esp_now_* shims: a simulated ESP-NOW radio.
+//
+// The device under test is the code calling esp_now_send(). Simulated nodes are added with
+// addNode(), each with its own link model (loss, burst loss, delay distribution), and can
+// transmit to the device with sendFrom(). Frames to a peer without a node are looped back as if
+// that peer had echoed them.
+// All nodes share one channel: transmissions are serialized, wait for a random backoff and
+// occupy the channel for their airtime, lost unicast frames are retried by the MAC.
+// Every random draw comes from one seeded generator, so a scenario replays identically.
+#include <deque>
+#include <queue>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "esp_now.h"
+
+namespace host
+{
+    // Deterministic across platforms, unlike the std:: distributions
+    class Random
+    {
+    public:
+        void seed(uint64_t seed)
+        {
+            _state = seed ? seed : 0x9E3779B97F4A7C15ull;
+        }
+
+        uint64_t next()
+        {
+            // xorshift64*
+            _state ^= _state >> 12;
+            _state ^= _state << 25;
+            _state ^= _state >> 27;
+            return _state * 0x2545F4914F6CDD1Dull;
+        }
+
+        double uniform()
+        {
+            return (next() >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        double normal()
+        {
+            double u1 = uniform();
+            double u2 = uniform();
+            if (u1 < 1e-300)
+                u1 = 1e-300;
+            return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+        }
+
+    private:
+        uint64_t _state = 0x9E3779B97F4A7C15ull;
+    };
+
+    struct DelayModel
+    {
+        enum Kind
+        {
+            FIXED,
+            UNIFORM,
+            LOGNORMAL,
+            EMPIRICAL
+        };
+
+        Kind kind = FIXED;
+        double a = 0; // fixed: delay, uniform: min, lognormal: mu of ln(us)
+        double b = 0; // uniform: max, lognormal: sigma of ln(us)
+        std::vector<double> samples;
+
+        static DelayModel fixed(double us)
+        {
+            DelayModel m;
+            m.a = us;
+            return m;
+        }
+
+        static DelayModel uniform(double minUs, double maxUs)
+        {
+            DelayModel m;
+            m.kind = UNIFORM;
+            m.a = minUs;
+            m.b = maxUs;
+            return m;
+        }
+
+        static DelayModel lognormal(double mu, double sigma)
+        {
+            DelayModel m;
+            m.kind = LOGNORMAL;
+            m.a = mu;
+            m.b = sigma;
+            return m;
+        }
+
+        // Reads a file from benchmarks/ (header lines, then one round trip time in ms per line).
+        // scale converts to the modeled delay, 0.5 treats half the round trip as one way latency.
+        static bool readBenchmark(const char *path, std::vector<double> &us, double scale = 0.5)
+        {
+            std::ifstream file(path);
+            if (!file)
+                return false;
+            std::string line;
+            while (std::getline(file, line))
+            {
+                std::istringstream in(line);
+                double ms;
+                std::string rest;
+                if ((in >> ms) && !(in >> rest) && ms > 0)
+                    us.push_back(ms * 1000.0 * scale);
+            }
+            return !us.empty();
+        }
+
+        // Log-normal fit (mean and deviation of ln) of a benchmark file
+        static bool fitBenchmark(const char *path, DelayModel &model, double scale = 0.5)
+        {
+            std::vector<double> us;
+            if (!readBenchmark(path, us, scale))
+                return false;
+            double sum = 0, sumSq = 0;
+            for (double v : us)
+            {
+                sum += log(v);
+                sumSq += log(v) * log(v);
+            }
+            double mu = sum / us.size();
+            double variance = sumSq / us.size() - mu * mu;
+            model = lognormal(mu, sqrt(variance > 0 ? variance : 0));
+            return true;
+        }
+
+        // Resamples the measured values directly
+        static bool empiricalBenchmark(const char *path, DelayModel &model, double scale = 0.5)
+        {
+            model = DelayModel();
+            model.kind = EMPIRICAL;
+            return readBenchmark(path, model.samples, scale);
+        }
+
+        double sample(Random &random) const
+        {
+            switch (kind)
+            {
+            case UNIFORM:
+                return a + (b - a) * random.uniform();
+            case LOGNORMAL:
+                return exp(a + b * random.normal());
+            case EMPIRICAL:
+                return samples.empty() ? 0 : samples[random.next() % samples.size()];
+            default:
+                return a;
+            }
+        }
+    };
+
+    // Gilbert-Elliott loss: independent loss in the good state, lossInBad in the bad state
+    struct LinkModel
+    {
+        double loss = 0;         // per attempt loss probability in the good state
+        double goodToBad = 0;    // per attempt probability of entering a burst
+        double badToGood = 1;    // per attempt probability of leaving a burst
+        double lossInBad = 1;
+        DelayModel delay;        // added after the frame left the air
+
+        // Bursty loss with the given average rate and mean burst length in frames
+        static LinkModel burstLoss(double averageLoss, double meanBurst)
+        {
+            LinkModel link;
+            link.badToGood = 1.0 / (meanBurst > 1 ? meanBurst : 1);
+            link.goodToBad = averageLoss * link.badToGood / (1.0 - averageLoss);
+            return link;
+        }
+
+        bool bad = false;
+
+        bool lose(Random &random)
+        {
+            if (bad)
+                bad = random.uniform() >= badToGood;
+            else
+                bad = random.uniform() < goodToBad;
+            return random.uniform() < (bad ? lossInBad : loss);
+        }
+    };
+
+    using NodeReceiveHandler = std::function<void(const uint8_t *src, const uint8_t *data, size_t len)>;
+
+    struct Node
+    {
+        uint8_t mac[ESP_NOW_ETH_ALEN];
+        LinkModel link;
+        NodeReceiveHandler onReceive;
+        uint32_t received = 0;
+    };
+
+    struct RadioStats
+    {
+        uint32_t queued = 0;
+        uint32_t delivered = 0;
+        uint32_t dropped = 0;   // rejected because the sender's queue was full
+        uint32_t lost = 0;      // all attempts lost
+        uint32_t attempts = 0;  // transmissions including MAC retries
+        uint64_t airtimeUs = 0; // channel occupancy
+        size_t maxQueueDepth = 0;
+        std::vector<uint32_t> latencyUs; // send to delivery, delivered frames only
+
+        uint32_t latencyPercentile(double percentile) const
+        {
+            if (latencyUs.empty())
+                return 0;
+            std::vector<uint32_t> sorted = latencyUs;
+            std::sort(sorted.begin(), sorted.end());
+            size_t index = (size_t)(percentile / 100.0 * (sorted.size() - 1));
+            return sorted[index];
+        }
+    };
+
+    class SimRadio
+    {
+    public:
+        static constexpr uint8_t LOCAL_MAC[ESP_NOW_ETH_ALEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+        size_t queueSize = 16;    // frames a sender buffers before esp_now_send() fails
+        uint32_t airtimeUs = 0;   // fixed time on air per frame, used when phyRateMbps is 0
+        double phyRateMbps = 0;   // > 0: airtime follows the frame length, ESP-NOW defaults to 1 Mbps
+        uint8_t maxRetries = 0;   // MAC retransmissions of a lost unicast frame
+        uint32_t slotUs = 9;      // backoff slot
+        uint8_t contentionWindow = 0; // random backoff of 0..contentionWindow slots per attempt
+        LinkModel loopbackLink;   // for peers without a node
+
+        RadioStats stats;
+
+        void seed(uint64_t seed)
+        {
+            _random.seed(seed);
+        }
+
+        Node &addNode(const uint8_t mac[ESP_NOW_ETH_ALEN], const LinkModel &link, NodeReceiveHandler onReceive = nullptr)
+        {
+            Node node;
+            memcpy(node.mac, mac, ESP_NOW_ETH_ALEN);
+            node.link = link;
+            node.onReceive = onReceive;
+            _nodes.push_back(node);
+            return _nodes.back();
+        }
+
+        Node *findNode(const uint8_t mac[ESP_NOW_ETH_ALEN])
+        {
+            for (auto &node : _nodes)
+            {
+                if (memcmp(node.mac, mac, ESP_NOW_ETH_ALEN) == 0)
+                    return &node;
+            }
+            return nullptr;
+        }
+
+        // Device under test transmits (esp_now_send)
+        esp_err_t send(const uint8_t *peer, const uint8_t *data, size_t len)
+        {
+            if (!_initialized)
+                return ESP_ERR_ESPNOW_NOT_INIT;
+            return transmit(LOCAL_MAC, peer, data, len);
+        }
+
+        // A simulated node transmits to the device under test
+        esp_err_t sendFrom(const uint8_t src[ESP_NOW_ETH_ALEN], const uint8_t *data, size_t len)
+        {
+            return transmit(src, LOCAL_MAC, data, len);
+        }
+
+        uint64_t nextDeliveryUs() const
+        {
+            return _events.empty() ? UINT64_MAX : _events.top().timeUs;
+        }
+
+        // Run every event that is due: send callbacks at the end of transmission, receptions after the link delay
+        void deliver()
+        {
+            while (!_events.empty() && _events.top().timeUs <= clockUs())
+            {
+                Event event = _events.top();
+                _events.pop();
+
+                bool fromLocal = memcmp(event.src, LOCAL_MAC, ESP_NOW_ETH_ALEN) == 0;
+                if (event.type == Event::SEND_DONE)
+                {
+                    Queue &queue = queueOf(event.src);
+                    if (queue.pending > 0)
+                        queue.pending--;
+                    if (fromLocal && _sendCb)
+                    {
+                        wifi_tx_info_t info = {LOCAL_MAC, event.dst};
+                        _sendCb(&info, event.delivered ? ESP_NOW_SEND_SUCCESS : ESP_NOW_SEND_FAIL);
+                    }
+                    continue;
+                }
+
+                stats.delivered++;
+                stats.latencyUs.push_back((uint32_t)(clockUs() - event.queuedUs));
+
+                if (!fromLocal)
+                {
+                    if (_recvCb)
+                    {
+                        esp_now_recv_info_t info = {event.src, (uint8_t *)LOCAL_MAC, nullptr};
+                        _recvCb(&info, event.data, event.len);
+                    }
+                    continue;
+                }
+
+                Node *node = findNode(event.dst);
+                if (node)
+                {
+                    node->received++;
+                    if (node->onReceive)
+                        node->onReceive(LOCAL_MAC, event.data, event.len);
+                }
+                else if (_recvCb)
+                {
+                    // no node behind this peer: loop the frame back
+                    esp_now_recv_info_t info = {event.dst, (uint8_t *)LOCAL_MAC, nullptr};
+                    _recvCb(&info, event.data, event.len);
+                }
+            }
+        }
+
+        uint32_t frameAirtimeUs(size_t len) const
+        {
+            if (phyRateMbps <= 0)
+                return airtimeUs;
+            // long preamble + PLCP header, 802.11 action frame and vendor element overhead, ACK
+            const double PLCP_US = 192.0;
+            const size_t MAC_OVERHEAD_BYTES = 43;
+            const double ACK_US = 304.0;
+            return (uint32_t)(PLCP_US + (MAC_OVERHEAD_BYTES + len) * 8.0 / phyRateMbps + ACK_US);
+        }
+
+        void printStats(Print &out) const
+        {
+            out.println("=== Radio ===");
+            out.printf("queued: %u, delivered: %u, lost: %u, dropped (queue full): %u\n",
+                       stats.queued, stats.delivered, stats.lost, stats.dropped);
+            out.printf("attempts: %u, airtime: %.3f s, max queue depth %zu/%zu\n",
+                       stats.attempts, stats.airtimeUs / 1e6, stats.maxQueueDepth, queueSize);
+            if (!stats.latencyUs.empty())
+            {
+                out.printf("latency us: p50 %u, p90 %u, p99 %u, max %u\n",
+                           stats.latencyPercentile(50), stats.latencyPercentile(90),
+                           stats.latencyPercentile(99), stats.latencyPercentile(100));
+            }
+            out.println("=============");
+        }
+
+        // Driver side, used by the esp_now_* shims
+        esp_err_t init()
+        {
+            if (_initialized)
+                return ESP_ERR_ESPNOW_EXIST;
+            _initialized = true;
+            return ESP_OK;
+        }
+        void setSendCallback(esp_now_send_cb_t cb) { _sendCb = cb; }
+        void setRecvCallback(esp_now_recv_cb_t cb) { _recvCb = cb; }
+
+    private:
+        struct Event
+        {
+            enum Type
+            {
+                SEND_DONE,
+                RECEIVE
+            };
+            Type type;
+            uint64_t timeUs;
+            uint64_t sequence; // keeps ordering stable for equal times
+            uint64_t queuedUs;
+            bool delivered;
+            uint8_t src[ESP_NOW_ETH_ALEN];
+            uint8_t dst[ESP_NOW_ETH_ALEN];
+            uint8_t data[ESP_NOW_MAX_DATA_LEN];
+            size_t len;
+
+            bool operator>(const Event &other) const
+            {
+                return timeUs != other.timeUs ? timeUs > other.timeUs : sequence > other.sequence;
+            }
+        };
+
+        struct Queue
+        {
+            uint8_t mac[ESP_NOW_ETH_ALEN];
+            size_t pending; // frames not yet off the air
+        };
+
+        std::deque<Node> _nodes;
+        std::vector<Queue> _queues;
+        std::priority_queue<Event, std::vector<Event>, std::greater<Event>> _events;
+        uint64_t _sequence = 0;
+        uint64_t _channelFreeUs = 0;
+        Random _random;
+        bool _initialized = false;
+        esp_now_send_cb_t _sendCb = nullptr;
+        esp_now_recv_cb_t _recvCb = nullptr;
+
+        Queue &queueOf(const uint8_t mac[ESP_NOW_ETH_ALEN])
+        {
+            for (auto &queue : _queues)
+            {
+                if (memcmp(queue.mac, mac, ESP_NOW_ETH_ALEN) == 0)
+                    return queue;
+            }
+            Queue queue;
+            memcpy(queue.mac, mac, ESP_NOW_ETH_ALEN);
+            queue.pending = 0;
+            _queues.push_back(queue);
+            return _queues.back();
+        }
+
+        LinkModel &linkBetween(const uint8_t src[ESP_NOW_ETH_ALEN], const uint8_t dst[ESP_NOW_ETH_ALEN])
+        {
+            Node *node = findNode(memcmp(src, LOCAL_MAC, ESP_NOW_ETH_ALEN) == 0 ? dst : src);
+            return node ? node->link : loopbackLink;
+        }
+
+        esp_err_t transmit(const uint8_t src[ESP_NOW_ETH_ALEN], const uint8_t dst[ESP_NOW_ETH_ALEN],
+                           const uint8_t *data, size_t len)
+        {
+            if (len == 0 || len > ESP_NOW_MAX_DATA_LEN)
+                return ESP_ERR_ESPNOW_ARG;
+
+            Queue &queue = queueOf(src);
+            if (queue.pending >= queueSize)
+            {
+                stats.dropped++;
+                return ESP_ERR_ESPNOW_NO_MEM;
+            }
+            queue.pending++;
+            stats.queued++;
+            stats.maxQueueDepth = std::max(stats.maxQueueDepth, queue.pending);
+
+            // Schedule the whole exchange now: frames are handled in call order, which keeps the run deterministic
+            LinkModel &link = linkBetween(src, dst);
+            uint32_t airtime = frameAirtimeUs(len);
+            uint64_t t = std::max(clockUs(), _channelFreeUs);
+            bool delivered = false;
+            for (int attempt = 0; attempt <= maxRetries && !delivered; attempt++)
+            {
+                if (contentionWindow > 0)
+                    t += slotUs * (_random.next() % (contentionWindow + 1));
+                t += airtime;
+                stats.attempts++;
+                stats.airtimeUs += airtime;
+                delivered = !link.lose(_random);
+            }
+            _channelFreeUs = t;
+
+            Event event;
+            event.queuedUs = clockUs();
+            event.delivered = delivered;
+            memcpy(event.src, src, ESP_NOW_ETH_ALEN);
+            memcpy(event.dst, dst, ESP_NOW_ETH_ALEN);
+            memcpy(event.data, data, len);
+            event.len = len;
+
+            event.type = Event::SEND_DONE;
+            event.timeUs = t;
+            event.sequence = _sequence++;
+            _events.push(event);
+
+            if (delivered)
+            {
+                double extra = link.delay.sample(_random);
+                event.type = Event::RECEIVE;
+                event.timeUs = t + (uint64_t)(extra > 0 ? extra : 0);
+                event.sequence = _sequence++;
+                _events.push(event);
+            }
+            else
+            {
+                stats.lost++;
+            }
+            return ESP_OK;
+        }
+    };
+
+    inline SimRadio &radio()
+    {
+        static SimRadio instance;
+        return instance;
+    }
+}
+
+inline esp_err_t esp_now_init() { return host::radio().init(); }
+inline esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len)
+{
+    return host::radio().send(peer_addr, data, len);
+}
+inline esp_err_t esp_now_add_peer(const esp_now_peer_info_t *) { return ESP_OK; }
+inline esp_err_t esp_now_del_peer(const uint8_t *) { return ESP_OK; }
+inline esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb)
+{
+    host::radio().setSendCallback(cb);
+    return ESP_OK;
+}
+inline esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb)
+{
+    host::radio().setRecvCallback(cb);
+    return ESP_OK;
+}
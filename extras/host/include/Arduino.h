@@ -0,0 +1,151 @@
+#pragma once
+// Minimal Arduino core for building the library on a Linux host, see extras/host/README.md
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <cmath>
+#include <string>
+#include <functional>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+typedef uint8_t byte;
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define DEC 10
+#define HEX 16
+#define HIGH 0x1
+#define LOW 0x0
+
+#define ESP_ARDUINO_VERSION_MAJOR 3
+#define ESP_ARDUINO_VERSION_VAL(major, minor, patch) ((major << 16) | (minor << 8) | (patch))
+#define ESP_ARDUINO_VERSION ESP_ARDUINO_VERSION_VAL(3, 3, 0)
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+inline long map(long x, long in_min, long in_max, long out_min, long out_max)
+{
+    return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+inline unsigned long micros() { return (unsigned long)esp_timer_get_time(); }
+inline unsigned long millis() { return (unsigned long)(esp_timer_get_time() / 1000); }
+inline void delayMicroseconds(unsigned int us) { host::advanceClock(us); }
+inline void delay(unsigned long ms) { host::advanceClock((uint64_t)ms * 1000); }
+
+class String
+{
+public:
+    String() {}
+    String(const char *s) : _s(s) {}
+    String(const std::string &s) : _s(s) {}
+    String(int value, unsigned char base = DEC) : _s(format(value, base)) {}
+    String(unsigned int value, unsigned char base = DEC) : _s(format(value, base)) {}
+    String(long value, unsigned char base = DEC) : _s(format(value, base)) {}
+    String(unsigned long value, unsigned char base = DEC) : _s(format(value, base)) {}
+
+    String operator+(const String &rhs) const { return String(_s + rhs._s); }
+    String operator+(const char *rhs) const { return String(_s + rhs); }
+    String &operator+=(const String &rhs)
+    {
+        _s += rhs._s;
+        return *this;
+    }
+    bool operator==(const String &rhs) const { return _s == rhs._s; }
+    const char *c_str() const { return _s.c_str(); }
+    unsigned int length() const { return _s.size(); }
+
+private:
+    std::string _s;
+
+    static std::string format(long long value, unsigned char base)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), base == HEX ? "%llx" : "%lld", value);
+        return buf;
+    }
+};
+
+class Print
+{
+public:
+    virtual ~Print() = default;
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while (size--)
+            n += write(*buffer++);
+        return n;
+    }
+
+    size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t print(const String &s) { return print(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(long long n, int base = DEC) { return printf(base == HEX ? "%llX" : "%lld", n); }
+    size_t print(int n, int base = DEC) { return print((long long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((long long)n, base); }
+    size_t print(long n, int base = DEC) { return print((long long)n, base); }
+    size_t print(unsigned long n, int base = DEC) { return print((long long)n, base); }
+    size_t print(unsigned char n, int base = DEC) { return print((long long)n, base); }
+    size_t print(double n, int digits = 2) { return printf("%.*f", digits, n); }
+
+    size_t println() { return print("\n"); }
+    template <typename T>
+    size_t println(const T &value)
+    {
+        return print(value) + println();
+    }
+    template <typename T>
+    size_t println(const T &value, int format)
+    {
+        return print(value, format) + println();
+    }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char buf[256];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        if (len < 0)
+            return 0;
+        return write((const uint8_t *)buf, (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+    }
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+};
+
+// Serial goes to stdout, set enabled = false to silence library debug output during runs
+class HostSerial : public Stream
+{
+public:
+    bool enabled = true;
+
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override
+    {
+        if (enabled)
+            fputc(c, stdout);
+        return 1;
+    }
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        if (enabled)
+            fwrite(buffer, 1, size, stdout);
+        return size;
+    }
+};
+
+inline HostSerial Serial;
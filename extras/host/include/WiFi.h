@@ -0,0 +1,18 @@
+#pragma once
+#include "esp_wifi.h"
+
+#define WIFI_MODE_STA 1
+#define WIFI_STA 1
+
+class HostWiFi
+{
+public:
+    int getMode() { return _mode; }
+    void mode(int mode) { _mode = mode; }
+    void disconnect() {}
+
+private:
+    int _mode = 0;
+};
+
+inline HostWiFi WiFi;
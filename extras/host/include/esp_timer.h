@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+
+// Simulated clock, only moves when the host program advances it
+namespace host
+{
+    inline uint64_t &clockUs()
+    {
+        static uint64_t now = 0;
+        return now;
+    }
+
+    inline void advanceClock(uint64_t us)
+    {
+        clockUs() += us;
+    }
+
+    inline void setClock(uint64_t us)
+    {
+        if (us > clockUs())
+            clockUs() = us;
+    }
+}
+
+inline int64_t esp_timer_get_time()
+{
+    return (int64_t)host::clockUs();
+}
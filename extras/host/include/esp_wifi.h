@@ -0,0 +1,23 @@
+#pragma once
+#include "Arduino.h"
+
+#define WIFI_SECOND_CHAN_NONE 0
+#define WIFI_PS_NONE 0
+#define WIFI_PS_MIN_MODEM 1
+#define WIFI_IF_STA 0
+
+typedef struct
+{
+    const uint8_t *src_addr;
+    const uint8_t *des_addr;
+} wifi_tx_info_t;
+
+inline esp_err_t esp_wifi_set_channel(uint8_t, int) { return ESP_OK; }
+inline esp_err_t esp_wifi_set_ps(int) { return ESP_OK; }
+inline esp_err_t esp_wifi_set_max_tx_power(int8_t) { return ESP_OK; }
+inline esp_err_t esp_wifi_get_mac(int, uint8_t mac[6])
+{
+    static const uint8_t device[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00}; // host::SimRadio::LOCAL_MAC
+    memcpy(mac, device, 6);
+    return ESP_OK;
+}
@@ -0,0 +1,164 @@
+// Replay load test: drives a recorded capture or a synthetic trace through esp_now_midi's
+// send and receive paths against the loopback radio and reports throughput, latency and drops.
+//
+//   replay_load --gen mix --speed 10
+//   replay_load --trace show.emcp --speed 100 --peers 4 --airtime 250
+#include <Arduino.h> // included implicitly in sketches
+#include <chrono>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include "esp_now_midi.h"
+#include "MidiReplay.h"
+
+static uint32_t receivedMessages = 0;
+
+static void countNote(byte, byte, byte) { receivedMessages++; }
+static void countControlChange(byte, byte, byte) { receivedMessages++; }
+static void countProgramChange(byte, byte) { receivedMessages++; }
+static void countPitchBend(byte, int) { receivedMessages++; }
+static void countRealtime() { receivedMessages++; }
+
+static bool loadCapture(const char *path, std::vector<midi_capture_record> &records)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> blob((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::string data(blob.begin(), blob.end());
+    size_t start = data.find("EMCP");
+    if (start == std::string::npos || data.size() < start + sizeof(midi_capture_header))
+        return false;
+
+    midi_capture_header header;
+    memcpy(&header, data.data() + start, sizeof(header));
+    if (header.recordSize != sizeof(midi_capture_record))
+        return false;
+
+    size_t offset = start + sizeof(header);
+    size_t available = (data.size() - offset) / sizeof(midi_capture_record);
+    records.resize(header.count < available ? header.count : available);
+    memcpy(records.data(), data.data() + offset, records.size() * sizeof(midi_capture_record));
+    return true;
+}
+
+static void usage()
+{
+    printf("usage: replay_load [--trace file.emcp | --gen chord|cc|clock|mix] [--speed x] [--count n]\n"
+           "                   [--peers n] [--airtime us] [--queue frames] [--direction out|in]\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *trace = nullptr;
+    std::string generator = "mix";
+    float speed = 1.0f;
+    uint32_t count = 1000;
+    int peers = 1;
+    MidiCaptureDirection direction = CAPTURE_ESPNOW_OUT;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--trace" && hasValue)
+            trace = argv[++i];
+        else if (arg == "--gen" && hasValue)
+            generator = argv[++i];
+        else if (arg == "--speed" && hasValue)
+            speed = atof(argv[++i]);
+        else if (arg == "--count" && hasValue)
+            count = atoi(argv[++i]);
+        else if (arg == "--peers" && hasValue)
+            peers = atoi(argv[++i]);
+        else if (arg == "--airtime" && hasValue)
+            host::radio().airtimeUs = atoi(argv[++i]);
+        else if (arg == "--queue" && hasValue)
+            host::radio().queueSize = atoi(argv[++i]);
+        else if (arg == "--direction" && hasValue)
+            direction = std::string(argv[++i]) == "in" ? CAPTURE_ESPNOW_IN : CAPTURE_ESPNOW_OUT;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    esp_now_midi midi;
+    Serial.enabled = false;
+    midi.begin(false, false);
+    for (int i = 0; i < peers; i++)
+    {
+        uint8_t mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, (uint8_t)(i + 1)};
+        midi.addPeer(mac);
+    }
+    midi.setHandleNoteOn(countNote);
+    midi.setHandleNoteOff(countNote);
+    midi.setHandleControlChange(countControlChange);
+    midi.setHandleProgramChange(countProgramChange);
+    midi.setHandlePitchBend(countPitchBend);
+    midi.setHandleClock(countRealtime);
+    midi.setHandleStart(countRealtime);
+    midi.setHandleStop(countRealtime);
+
+    std::vector<midi_capture_record> records;
+    CaptureTraceSource captureSource(nullptr, 0);
+    ChordBurstGenerator chords(count / 8, 20000, 4, 1, direction);
+    CcSweepGenerator sweep(count, 5000, 1, 2, direction);
+    ClockGenerator clock(count, 120.0f, direction);
+    MergedTraceSource mix;
+    MidiTraceSource *source = nullptr;
+
+    if (trace)
+    {
+        if (!loadCapture(trace, records))
+        {
+            fprintf(stderr, "could not read capture %s\n", trace);
+            return 1;
+        }
+        captureSource = CaptureTraceSource(records.data(), records.size());
+        source = &captureSource;
+    }
+    else if (generator == "chord")
+        source = &chords;
+    else if (generator == "cc")
+        source = &sweep;
+    else if (generator == "clock")
+        source = &clock;
+    else if (generator == "mix")
+    {
+        mix.add(&chords);
+        mix.add(&sweep);
+        mix.add(&clock);
+        source = &mix;
+    }
+    else
+    {
+        usage();
+        return 1;
+    }
+
+    MidiReplay replay(midi);
+    auto now = []()
+    { return (uint64_t)esp_timer_get_time(); };
+
+    auto wallStart = std::chrono::steady_clock::now();
+    replay.begin(source, speed, now());
+    while (true)
+    {
+        bool running = replay.poll(now);
+        host::radio().deliver();
+
+        uint64_t next = std::min(replay.nextDueUs(), host::radio().nextDeliveryUs());
+        if (!running && next == UINT64_MAX)
+            break;
+        host::setClock(next);
+    }
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    Serial.enabled = true;
+    replay.printStats(Serial);
+    host::radio().printStats(Serial);
+    Serial.printf("handler calls: %u\n", receivedMessages);
+    Serial.printf("host cpu: %.3f s, %.0f msg/s\n", wallSeconds,
+                  (replay.getStats().sent + replay.getStats().received) / (wallSeconds > 0 ? wallSeconds : 1));
+    return 0;
+}
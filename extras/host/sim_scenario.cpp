@@ -0,0 +1,166 @@
+// Radio scenario: an esp_now_midi dongle and a set of simulated clients on a lossy, shared channel.
+// Every client streams CCs to the dongle, the dongle sends 24 ppqn clock to all clients.
+// Delay is fitted from a benchmark file, loss is bursty (Gilbert-Elliott), the same seed gives the same run.
+//
+//   sim_scenario --clients 20 --profile ../../benchmarks/tw/40m_0obs_s2_i7_ubuntu.txt --loss 0.05 --seed 1
+#include <Arduino.h> // included implicitly in sketches
+#include <array>
+#include "esp_now_midi.h"
+
+static uint32_t ccReceived = 0;
+static uint32_t clockReceived = 0;
+
+static void countControlChange(byte, byte, byte) { ccReceived++; }
+static void countClock() { clockReceived++; }
+
+static void usage()
+{
+    printf("usage: sim_scenario [--clients n] [--profile benchmark.txt] [--empirical] [--loss p] [--burst frames]\n"
+           "                    [--retries n] [--rate hz] [--bpm bpm] [--seconds s] [--seed n]\n");
+}
+
+int main(int argc, char **argv)
+{
+    int clients = 20;
+    const char *profile = "../../benchmarks/tw/40m_0obs_s2_i7_ubuntu.txt";
+    bool empirical = false;
+    double loss = 0.05;
+    double burst = 4;
+    int retries = 3;
+    double rate = 20;
+    double bpm = 120;
+    double seconds = 10;
+    uint64_t seed = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--clients" && hasValue)
+            clients = atoi(argv[++i]);
+        else if (arg == "--profile" && hasValue)
+            profile = argv[++i];
+        else if (arg == "--empirical")
+            empirical = true;
+        else if (arg == "--loss" && hasValue)
+            loss = atof(argv[++i]);
+        else if (arg == "--burst" && hasValue)
+            burst = atof(argv[++i]);
+        else if (arg == "--retries" && hasValue)
+            retries = atoi(argv[++i]);
+        else if (arg == "--rate" && hasValue)
+            rate = atof(argv[++i]);
+        else if (arg == "--bpm" && hasValue)
+            bpm = atof(argv[++i]);
+        else if (arg == "--seconds" && hasValue)
+            seconds = atof(argv[++i]);
+        else if (arg == "--seed" && hasValue)
+            seed = strtoull(argv[++i], nullptr, 10);
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (clients < 1 || clients > MAX_PEERS)
+    {
+        fprintf(stderr, "--clients must be 1..%d\n", MAX_PEERS);
+        return 1;
+    }
+
+    host::LinkModel link = host::LinkModel::burstLoss(loss, burst);
+    bool fitted = empirical ? host::DelayModel::empiricalBenchmark(profile, link.delay)
+                            : host::DelayModel::fitBenchmark(profile, link.delay);
+    if (!fitted)
+    {
+        fprintf(stderr, "could not read benchmark %s\n", profile);
+        return 1;
+    }
+
+    host::SimRadio &radio = host::radio();
+    radio.seed(seed);
+    radio.phyRateMbps = 1;
+    radio.maxRetries = retries;
+    radio.contentionWindow = 15;
+
+    esp_now_midi midi;
+    Serial.enabled = false;
+    midi.begin(false, false);
+    midi.setHandleControlChange(countControlChange);
+
+    std::vector<std::array<uint8_t, 6>> macs(clients);
+    for (int i = 0; i < clients; i++)
+    {
+        macs[i] = {0x02, 0x00, 0x00, 0x00, 0x01, (uint8_t)i};
+        radio.addNode(macs[i].data(), link, [](const uint8_t *, const uint8_t *data, size_t len)
+                      {
+                          if (len == 1 && data[0] == MIDI_TIME_CLOCK)
+                              countClock();
+                      });
+        midi.addPeer(macs[i].data());
+    }
+
+    // Clients start at random phases so they do not all transmit in the same slot
+    host::Random phases;
+    phases.seed(seed ^ 0x5555);
+    uint64_t ccPeriodUs = (uint64_t)(1e6 / rate);
+    uint64_t clockPeriodUs = (uint64_t)(60e6 / (bpm * 24));
+    uint64_t startUs = host::clockUs(); // begin() has already advanced the clock
+    std::vector<uint64_t> nextCc(clients);
+    for (auto &t : nextCc)
+        t = startUs + phases.next() % ccPeriodUs;
+    uint64_t nextClock = startUs;
+    uint64_t endUs = startUs + (uint64_t)(seconds * 1e6);
+
+    uint32_t ccSent = 0, ccRejected = 0;
+    uint32_t clockSent = 0;
+    uint8_t value = 0;
+
+    while (true)
+    {
+        uint64_t now = host::clockUs();
+        if (now < endUs)
+        {
+            for (int i = 0; i < clients; i++)
+            {
+                if (nextCc[i] > now)
+                    continue;
+                midi_message_packet packet = {(byte)(MIDI_CONTROL_CHANGE | (i & 0x0F)), 1, (byte)(value++ & 0x7F)};
+                if (radio.sendFrom(macs[i].data(), (uint8_t *)&packet, sizeof(packet)) == ESP_OK)
+                    ccSent++;
+                else
+                    ccRejected++;
+                nextCc[i] += ccPeriodUs;
+            }
+            if (nextClock <= now)
+            {
+                midi.sendClock(); // frames rejected by a full queue show up as dropped in the radio stats
+                clockSent += clients;
+                nextClock += clockPeriodUs;
+            }
+        }
+        radio.deliver();
+
+        uint64_t next = radio.nextDeliveryUs();
+        if (now < endUs)
+        {
+            next = std::min(next, nextClock);
+            for (uint64_t t : nextCc)
+                next = std::min(next, t);
+        }
+        if (next == UINT64_MAX)
+            break;
+        host::setClock(std::max(next, now + 1));
+    }
+
+    Serial.enabled = true;
+    Serial.printf("clients: %d, seed: %llu, loss: %.3f (burst %.1f), retries: %d, delay: %s %s\n",
+                  clients, (unsigned long long)seed, loss, burst, retries, empirical ? "empirical" : "log-normal", profile);
+    Serial.printf("client -> dongle cc: sent %u, rejected %u, received %u (%.2f%%)\n",
+                  ccSent, ccRejected, ccReceived, ccSent ? 100.0 * ccReceived / ccSent : 0.0);
+    Serial.printf("dongle -> clients clock: sent %u, received %u (%.2f%%)\n",
+                  clockSent, clockReceived, clockSent ? 100.0 * clockReceived / clockSent : 0.0);
+    Serial.printf("channel utilization: %.1f%%\n", 100.0 * radio.stats.airtimeUs / (host::clockUs() - startUs + 1));
+    radio.printStats(Serial);
+    return 0;
+}
@@ -0,0 +1,196 @@
+// USB-MIDI output with and without UsbMidiOut: the same traffic (chord bursts, a CC stream and
+// 24 ppqn clock) goes through a model of the TinyUSB MIDI FIFO and bulk IN endpoint. Without it every
+// packet is written once and lost when the FIFO is full, with it packets wait for room instead.
+// Reports USB writes and transfers (as the model endpoint counts them) per second, packets per
+// transfer, latency until the host has the packet and drops.
+//
+//   usb_out_bench [--seconds s] [--chord notes] [--cc hz] [--transfer us]
+#include <Arduino.h> // included implicitly in sketches
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include "UsbMidiOut.h"
+
+// TinyUSB MIDI device class: a packet FIFO in front of the bulk IN endpoint. A write starts a transfer
+// when the endpoint is idle, everything written while it is busy goes out with the next one.
+struct ModelPort
+{
+    uint16_t fifoSize = 16;        // CFG_TUD_MIDI_TX_BUFSIZE 64 bytes
+    uint16_t transferPackets = 16; // 64 byte endpoint
+    uint32_t transferUs = 125;     // until the host has polled and acknowledged the transfer
+
+    uint16_t fifo = 0;
+    uint16_t inFlight = 0;
+    uint64_t doneUs = 0;
+    uint32_t writes = 0;
+    uint32_t transfers = 0;
+    std::deque<uint64_t> *sentUs = nullptr;
+    std::vector<uint32_t> latencyUs;
+
+    bool writePacket(const uint8_t *)
+    {
+        update();
+        if (fifo + inFlight >= fifoSize)
+            return false;
+        writes++;
+        fifo++;
+        start();
+        return true;
+    }
+
+    void update()
+    {
+        if (inFlight && (uint64_t)esp_timer_get_time() >= doneUs)
+        {
+            for (uint16_t i = 0; i < inFlight; i++)
+            {
+                latencyUs.push_back(doneUs - sentUs->front());
+                sentUs->pop_front();
+            }
+            inFlight = 0;
+            start();
+        }
+    }
+
+    void start()
+    {
+        if (inFlight || !fifo)
+            return;
+        inFlight = fifo < transferPackets ? fifo : transferPackets;
+        fifo -= inFlight;
+        doneUs = esp_timer_get_time() + transferUs;
+        transfers++;
+    }
+};
+
+struct Result
+{
+    uint32_t messages = 0;
+    uint32_t dropped = 0;
+    uint32_t writes = 0;
+    uint32_t transfers = 0;
+    std::vector<uint32_t> latencyUs;
+};
+
+static Result run(bool buffered, float seconds, int chordNotes, int ccHz, uint32_t transferUs)
+{
+    std::deque<uint64_t> sentUs;
+    ModelPort port;
+    port.transferUs = transferUs;
+    port.sentUs = &sentUs;
+    UsbMidiOut<ModelPort> out(port);
+
+    Result result;
+    uint64_t start = esp_timer_get_time();
+    uint64_t end = start + (uint64_t)(seconds * 1000000);
+    uint64_t nextChord = start, nextCC = start, nextClock = start;
+    uint32_t ccPeriod = ccHz ? 1000000 / ccHz : UINT32_MAX;
+    uint8_t note = 36, cc = 0;
+
+    auto send = [&](MidiStatus status, byte channel, byte data1, byte data2)
+    {
+        midi_message msg = {channel, status, data1, data2};
+        uint8_t packet[4];
+        UsbMidiOut<ModelPort>::encode(msg, packet);
+        if (buffered ? out.send(msg) : port.writePacket(packet))
+            sentUs.push_back(esp_timer_get_time());
+        else
+            result.dropped++;
+        result.messages++;
+    };
+
+    while ((uint64_t)esp_timer_get_time() < end)
+    {
+        uint64_t now = esp_timer_get_time();
+        if (now >= nextChord) // chord every 50 ms, notes in the same pass like a keyboard scan
+        {
+            for (int i = 0; i < chordNotes; i++)
+                send(MIDI_NOTE_ON, 1, note + i * 4, 100);
+            note = note < 72 ? note + 1 : 36;
+            nextChord += 50000;
+        }
+        if (now >= nextCC)
+        {
+            send(MIDI_CONTROL_CHANGE, 2, 1, cc++ & 0x7F);
+            nextCC += ccPeriod;
+        }
+        if (now >= nextClock) // 24 ppqn at 120 bpm
+        {
+            send(MIDI_TIME_CLOCK, 0, 0, 0);
+            nextClock += 20833;
+        }
+
+        out.poll();
+        port.update();
+        delayMicroseconds(20); // one Client::loop pass
+    }
+    out.flush();
+    for (int i = 0; i < 100 && (out.pending() || port.inFlight || port.fifo); i++)
+    {
+        delayMicroseconds(transferUs);
+        out.flush();
+        port.update();
+    }
+
+    result.writes = port.writes;
+    result.transfers = port.transfers;
+    result.latencyUs = port.latencyUs;
+    return result;
+}
+
+static uint32_t percentile(std::vector<uint32_t> &values, float p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t)(p / 100.0f * (values.size() - 1) + 0.5f);
+    return values[index];
+}
+
+static void print(const char *name, Result &result, float seconds)
+{
+    uint32_t p50 = percentile(result.latencyUs, 50);
+    uint32_t p99 = percentile(result.latencyUs, 99);
+    uint32_t max = percentile(result.latencyUs, 100);
+    printf("%-12s %8.0f %9.0f %8.1f %6u %6u %6u %6u\n", name,
+           result.writes / seconds, result.transfers / seconds,
+           result.transfers ? (float)result.latencyUs.size() / result.transfers : 0.0f,
+           p50, p99, max, result.dropped);
+}
+
+int main(int argc, char **argv)
+{
+    float seconds = 10;
+    int chordNotes = 8;
+    int ccHz = 1000;
+    uint32_t transferUs = 125;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "--seconds")
+            seconds = atof(argv[i + 1]);
+        else if (arg == "--chord")
+            chordNotes = atoi(argv[i + 1]);
+        else if (arg == "--cc")
+            ccHz = atoi(argv[i + 1]);
+        else if (arg == "--transfer")
+            transferUs = atoi(argv[i + 1]);
+        else
+        {
+            printf("usage: usb_out_bench [--seconds s] [--chord notes] [--cc hz] [--transfer us]\n");
+            return 1;
+        }
+    }
+
+    Result direct = run(false, seconds, chordNotes, ccHz, transferUs);
+    Result buffered = run(true, seconds, chordNotes, ccHz, transferUs);
+
+    printf("%u messages in %.0f s, %d note chords every 50 ms, CC at %d Hz, clock, %u us per transfer\n",
+           direct.messages, seconds, chordNotes, ccHz, transferUs);
+    printf("%-12s %8s %9s %8s %6s %6s %6s %6s\n", "", "writes/s", "xfers/s", "pkt/xfer",
+           "p50us", "p99us", "maxus", "drops");
+    print("unbuffered", direct, seconds);
+    print("queued", buffered, seconds);
+    return 0;
+}
@@ -0,0 +1,290 @@
+#!/usr/bin/env python3
+"""
+Benchmark results: import, report and regression gate
+
+A results file is plain text, "key: value" header lines followed by either raw samples
+or a histogram, all times in microseconds:
+
+    format: esp-now-midi-benchmark 1
+    board: lolin esp32-s2-mini
+    transport: esp-now
+    distance: 40m
+    version: 1.0.0
+    metric: rtt
+    iterations: 1000
+    lost: 3
+    samples
+    1834
+    1790
+    ...
+
+    histogram
+    1024 2048 812      <- lower bound (inclusive), upper bound (exclusive), count
+    2048 4096 185
+
+Several runs can follow each other, each starting with its format line and optionally ending
+with "end" (LatencyBenchmark.h streams rtt and one way runs like that over serial).
+The older files in benchmarks/ (millisecond lists after an ad-hoc header) are read as well
+and can be converted with the import command.
+
+    python3 benchmark.py report ../benchmarks/tw/*.txt
+    python3 benchmark.py import ../benchmarks/tw/40m_0obs_s2_i7_ubuntu.txt -o 40m.txt
+    python3 benchmark.py gate run.txt --baseline baseline.txt --max-regression 10
+"""
+
+import argparse
+import math
+import re
+import sys
+
+FORMAT = "esp-now-midi-benchmark 1"
+KEY_FIELDS = ["board", "transport", "distance", "obstacles", "metric", "path"]
+PERCENTILES = [50, 90, 99, 99.9]
+
+
+class Run:
+    def __init__(self, name):
+        self.name = name
+        self.header = {}
+        self.samples = []    # microseconds, in measurement order
+        self.histogram = []  # (lower, upper, count)
+
+    def count(self):
+        if self.histogram:
+            return sum(c for _, _, c in self.histogram)
+        return len(self.samples)
+
+    def iterations(self):
+        return int(self.header.get("iterations", self.count() + self.lost_count()))
+
+    def lost_count(self):
+        if "lost" in self.header:
+            return int(self.header["lost"])
+        if "iterations" in self.header:
+            return max(0, int(self.header["iterations"]) - self.count())
+        return 0
+
+    def loss(self):
+        iterations = self.iterations()
+        return self.lost_count() / iterations if iterations else 0.0
+
+    def key(self):
+        return tuple(self.header.get(field, "") for field in KEY_FIELDS)
+
+    def percentile(self, p):
+        """Nearest rank for samples, linear interpolation inside the bin for histograms"""
+        n = self.count()
+        if n == 0:
+            return float("nan")
+        if self.samples:
+            ordered = sorted(self.samples)
+            rank = max(1, math.ceil(p / 100.0 * n))
+            return ordered[rank - 1]
+        target = p / 100.0 * n
+        seen = 0
+        for lower, upper, count in self.histogram:
+            if count and seen + count >= target:
+                return lower + (upper - lower) * (target - seen) / count
+            seen += count
+        return self.histogram[-1][1]
+
+    def mean(self):
+        n = self.count()
+        if n == 0:
+            return float("nan")
+        if self.samples:
+            return sum(self.samples) / n
+        return sum((lo + hi) / 2.0 * c for lo, hi, c in self.histogram) / n
+
+    def jitter(self):
+        """Standard deviation, from bin centers for histograms"""
+        n = self.count()
+        if n < 2:
+            return 0.0
+        mean = self.mean()
+        if self.samples:
+            return math.sqrt(sum((s - mean) ** 2 for s in self.samples) / (n - 1))
+        return math.sqrt(sum(((lo + hi) / 2.0 - mean) ** 2 * c for lo, hi, c in self.histogram) / (n - 1))
+
+
+def parse_legacy_header(line, header):
+    # e.g. "esp-now-midi distance 0.5m", "usb-midi distance 0.5m", "esp-now-midi distance: 40m"
+    match = re.match(r"(esp-now|usb)-midi distance:?\s*(\S+)", line)
+    if match:
+        header["transport"] = match.group(1)
+        header["distance"] = match.group(2)
+        return
+    if ":" in line:
+        key, value = line.split(":", 1)
+        key = key.strip()
+        if key in ("avg", "TODO"):
+            return  # derived or placeholder
+        header[key] = value.strip()
+
+
+def read(path):
+    """
+    Read all runs of a file
+
+    A file can hold several runs, e.g. a serial log of LatencyBenchmark.h: each run starts
+    with its "format:" line and ends with "end" or the next run, anything around them is ignored.
+
+    Returns:
+        list of Run
+    """
+    with open(path) as f:
+        lines = [line.strip() for line in f if line.strip()]
+
+    if not any(line.startswith("format:") for line in lines):
+        return [read_legacy(path, lines)]
+
+    runs = []
+    run = None
+    section = None
+    for line in lines:
+        if line.startswith("format:"):
+            run = Run(path)
+            runs.append(run)
+            section = None
+        if run is None:
+            continue
+        if line == "end":
+            run = None
+        elif line in ("samples", "histogram"):
+            section = line
+        elif section == "samples":
+            run.samples.append(float(line))
+        elif section == "histogram":
+            lower, upper, count = line.split()
+            run.histogram.append((float(lower), float(upper), int(count)))
+        elif ":" in line:
+            key, value = line.split(":", 1)
+            run.header[key.strip()] = value.strip()
+
+    for run in runs:
+        if run.header.get("format") != FORMAT:
+            raise ValueError("%s: unsupported format %s" % (path, run.header.get("format")))
+        if len(runs) > 1:
+            run.name = "%s:%s" % (path, run.header.get("metric", runs.index(run)))
+    return runs
+
+
+def read_legacy(path, lines):
+    run = Run(path)
+    for line in lines:
+        try:
+            run.samples.append(float(line) * 1000.0)  # ms
+        except ValueError:
+            parse_legacy_header(line, run.header)
+    run.header.setdefault("metric", "rtt")
+    run.header.setdefault("path", "usb+os+pd")  # measured with pd-patches/test_client-echo_rtt.pd
+    return run
+
+
+def read_all(paths):
+    return [run for path in paths for run in read(path)]
+
+
+def write(run, out):
+    out.write("format: %s\n" % FORMAT)
+    for key, value in run.header.items():
+        if key != "format":
+            out.write("%s: %s\n" % (key, value))
+    out.write("lost: %d\n" % run.lost_count())
+    if run.histogram:
+        out.write("histogram\n")
+        for lower, upper, count in run.histogram:
+            out.write("%g %g %d\n" % (lower, upper, count))
+    else:
+        out.write("samples\n")
+        for sample in run.samples:
+            out.write("%g\n" % sample)
+
+
+def report(runs, out):
+    columns = ["run", "board", "transport", "distance", "version", "metric", "n", "loss %", "mean", "jitter"] + \
+        ["p%g" % p for p in PERCENTILES]
+    rows = []
+    for run in runs:
+        rows.append([
+            run.name,
+            run.header.get("board", "-"),
+            run.header.get("transport", "-"),
+            run.header.get("distance", "-"),
+            run.header.get("version", "-"),
+            run.header.get("metric", "-"),
+            str(run.count()),
+            "%.2f" % (run.loss() * 100.0),
+            "%.0f" % run.mean(),
+            "%.0f" % run.jitter(),
+        ] + ["%.0f" % run.percentile(p) for p in PERCENTILES])
+    widths = [max(len(columns[i]), *(len(row[i]) for row in rows)) for i in range(len(columns))]
+    out.write("  ".join(c.ljust(w) for c, w in zip(columns, widths)) + "\n")
+    for row in rows:
+        out.write("  ".join(c.ljust(w) for c, w in zip(row, widths)) + "\n")
+    out.write("times in us\n")
+
+
+def gate(runs, baselines, max_regression, max_loss):
+    """Returns the number of failed runs"""
+    by_key = {baseline.key(): baseline for baseline in baselines}
+    failed = 0
+    for run in runs:
+        baseline = by_key.get(run.key())
+        if baseline is None:
+            print("%s: no baseline for %s" % (run.name, "/".join(run.key())), file=sys.stderr)
+            failed += 1
+            continue
+        p99 = run.percentile(99)
+        limit = baseline.percentile(99) * (1.0 + max_regression / 100.0)
+        ok = p99 <= limit
+        message = "%s: p99 %.0f us, baseline %.0f us, limit %.0f us" % (run.name, p99, baseline.percentile(99), limit)
+        if max_loss is not None and run.loss() * 100.0 > max_loss:
+            ok = False
+            message += ", loss %.2f %% above %.2f %%" % (run.loss() * 100.0, max_loss)
+        print(("PASS " if ok else "FAIL ") + message)
+        failed += 0 if ok else 1
+    return failed
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Report and compare ESP-NOW MIDI benchmark results")
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    report_parser = commands.add_parser("report", help="percentile table of one or more runs")
+    report_parser.add_argument("files", nargs="+")
+
+    import_parser = commands.add_parser("import", help="convert a legacy benchmarks/ file")
+    import_parser.add_argument("file")
+    import_parser.add_argument("-o", "--output", help="defaults to stdout")
+    import_parser.add_argument("--set", action="append", default=[], metavar="KEY=VALUE",
+                               help="add or override a header field, e.g. version=1.0.0")
+
+    gate_parser = commands.add_parser("gate", help="fail when p99 regressed against a baseline")
+    gate_parser.add_argument("files", nargs="+")
+    gate_parser.add_argument("--baseline", action="append", required=True,
+                             help="results file(s), matched by board, transport, distance, obstacles, metric and path")
+    gate_parser.add_argument("--max-regression", type=float, default=10.0, help="allowed p99 increase in percent")
+    gate_parser.add_argument("--max-loss", type=float, help="allowed loss in percent")
+    args = parser.parse_args()
+
+    if args.command == "report":
+        report(read_all(args.files), sys.stdout)
+    elif args.command == "import":
+        run = read(args.file)[0]
+        for assignment in args.set:
+            key, value = assignment.split("=", 1)
+            run.header[key] = value
+        if args.output:
+            with open(args.output, "w") as f:
+                write(run, f)
+        else:
+            write(run, sys.stdout)
+    elif args.command == "gate":
+        failed = gate(read_all(args.files), read_all(args.baseline),
+                      args.max_regression, args.max_loss)
+        sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""
+Host side of MidiCapture.h
+
+Reads a capture dump either directly from the dongle's serial port (requires pyserial)
+or from a file, and prints one line per record or stores the raw dump for later replay.
+
+    python3 midi_capture.py --port /dev/ttyACM0 --save show.emcp
+    python3 midi_capture.py --file show.emcp
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+MAGIC = b"EMCP"
+HEADER = struct.Struct("<4sHHII")  # magic, version, record size, count, dropped
+RECORD = struct.Struct("<IBBBB")   # timestamp, status, data1, data2, meta
+
+PEER_NONE = 0x1F
+LOST = 0xFF
+DIRECTIONS = ["espnow-in", "espnow-out", "usb-in", "usb-out"]
+
+STATUS_NAMES = {
+    0x80: "note-off",
+    0x90: "note-on",
+    0xA0: "poly-aftertouch",
+    0xB0: "cc",
+    0xC0: "program",
+    0xD0: "aftertouch",
+    0xE0: "pitch-bend",
+    0xF0: "sysex",
+    0xF1: "time-code",
+    0xF2: "song-position",
+    0xF3: "song-select",
+    0xF6: "tune-request",
+    0xF8: "clock",
+    0xFA: "start",
+    0xFB: "continue",
+    0xFC: "stop",
+    0xFE: "active-sensing",
+    0xFF: "reset",
+}
+
+
+def parse(blob):
+    """
+    Parse a dump into (header, records)
+
+    Leading bytes before the magic (e.g. debug prints on the same serial port) are skipped.
+    Timestamps are unwrapped to 64 bit, assuming no gap between two records exceeds ~71 minutes.
+
+    Returns:
+        tuple: (dict header, list of dict records)
+    """
+    start = blob.find(MAGIC)
+    if start < 0:
+        raise ValueError("no capture header found")
+    magic, version, record_size, count, dropped = HEADER.unpack_from(blob, start)
+    if record_size != RECORD.size:
+        raise ValueError("unsupported record size %d" % record_size)
+
+    header = {"version": version, "count": count, "dropped": dropped}
+    records = []
+    offset = start + HEADER.size
+    wraps = 0
+    last = None
+    for _ in range(count):
+        if offset + RECORD.size > len(blob):
+            raise ValueError("truncated capture, expected %d records" % count)
+        timestamp, status, data1, data2, meta = RECORD.unpack_from(blob, offset)
+        offset += RECORD.size
+        if meta == LOST:
+            records.append({"lost": True})
+            continue
+        if last is not None and timestamp < last:
+            wraps += 1
+        last = timestamp
+        records.append({
+            "lost": False,
+            "time_us": (wraps << 32) + timestamp,
+            "direction": DIRECTIONS[meta >> 6],
+            "peer": meta & 0x1F,
+            "status": status,
+            "data1": data1,
+            "data2": data2,
+        })
+    return header, records
+
+
+def format_record(record, t0):
+    if record["lost"]:
+        return "lost"
+    status = record["status"]
+    if status >= 0xF0:
+        name = STATUS_NAMES.get(status, "0x%02X" % status)
+        channel = "-"
+    else:
+        name = STATUS_NAMES.get(status & 0xF0, "0x%02X" % status)
+        channel = str((status & 0x0F) + 1)
+    if status == 0xF0:
+        data = "len=%d" % (record["data1"] | (record["data2"] << 7))
+    else:
+        data = "%d %d" % (record["data1"], record["data2"])
+    peer = "all" if record["peer"] == PEER_NONE else str(record["peer"])
+    return "%12.3f ms  %-10s peer=%-3s ch=%-2s %-15s %s" % (
+        (record["time_us"] - t0) / 1000.0, record["direction"], peer, channel, name, data)
+
+
+def read_from_port(port, baudrate, command, timeout):
+    import serial  # pyserial, only needed when reading from the device
+
+    with serial.Serial(port, baudrate, timeout=0.2) as ser:
+        ser.reset_input_buffer()
+        ser.write(command.encode())
+        blob = b""
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            blob += ser.read(4096)
+            start = blob.find(MAGIC)
+            if start >= 0 and len(blob) >= start + HEADER.size:
+                count = HEADER.unpack_from(blob, start)[3]
+                if len(blob) >= start + HEADER.size + count * RECORD.size:
+                    return blob[start:start + HEADER.size + count * RECORD.size]
+        raise TimeoutError("no complete capture received from %s" % port)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Read and decode an ESP-NOW MIDI traffic capture")
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--port", help="serial port of the dongle")
+    source.add_argument("--file", help="previously saved capture dump")
+    parser.add_argument("--baudrate", type=int, default=115200)
+    parser.add_argument("--command", default="c", help="drain command, see CAPTURE_DRAIN_COMMAND")
+    parser.add_argument("--timeout", type=float, default=5.0)
+    parser.add_argument("--save", help="store the raw dump, e.g. for replay")
+    parser.add_argument("--quiet", action="store_true", help="only print the summary")
+    args = parser.parse_args()
+
+    if args.port:
+        blob = read_from_port(args.port, args.baudrate, args.command, args.timeout)
+    else:
+        with open(args.file, "rb") as f:
+            blob = f.read()
+
+    header, records = parse(blob)
+    if args.save:
+        with open(args.save, "wb") as f:
+            f.write(blob[blob.find(MAGIC):])
+
+    valid = [r for r in records if not r["lost"]]
+    if not args.quiet:
+        t0 = valid[0]["time_us"] if valid else 0
+        for record in records:
+            print(format_record(record, t0))
+
+    duration = (valid[-1]["time_us"] - valid[0]["time_us"]) / 1e6 if len(valid) > 1 else 0.0
+    print("records: %d, lost while draining: %d, overwritten before drain: %d, span: %.3f s" % (
+        len(valid), len(records) - len(valid), header["dropped"], duration), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
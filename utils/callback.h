@@ -0,0 +1,86 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+
+namespace enomik
+{
+    template <typename Signature>
+    class Callback;
+
+    // Handler slot without per-call allocation or std::function indirection.
+    // Plain function pointers and captureless lambdas are called directly, handlers that need state
+    // take a context pointer (or bind a member function at compile time). Anything else, e.g. a
+    // capturing lambda, still works through an owned std::function, at the old cost.
+    template <typename R, typename... Args>
+    class Callback<R(Args...)>
+    {
+    public:
+        using Function = R (*)(Args...);
+        using ContextFunction = R (*)(void *context, Args...);
+
+        Callback() = default;
+        Callback(std::nullptr_t) {}
+        Callback(Function function) : _function(function) {}
+        Callback(ContextFunction function, void *context) : _contextFunction(function), _context(context) {}
+
+        template <typename F,
+                  typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Callback>::value &&
+                                                     !std::is_same<typename std::decay<F>::type, std::nullptr_t>::value>::type>
+        Callback(F &&function)
+        {
+            assign(std::forward<F>(function), std::is_convertible<F, Function>());
+        }
+
+        Callback(Callback &&) = default;
+        Callback &operator=(Callback &&) = default;
+
+        // e.g. Callback<void(byte)>::bind<Synth, &Synth::onProgram>(&synth)
+        template <typename T, R (T::*Method)(Args...)>
+        static Callback bind(T *object)
+        {
+            return Callback([](void *context, Args... args) -> R
+                            { return (static_cast<T *>(context)->*Method)(args...); },
+                            object);
+        }
+
+        explicit operator bool() const
+        {
+            return _function || _contextFunction;
+        }
+
+        inline R operator()(Args... args) const
+        {
+            if (_contextFunction)
+                return _contextFunction(_context, args...);
+            return _function(args...);
+        }
+
+    private:
+        Function _function = nullptr;
+        ContextFunction _contextFunction = nullptr;
+        void *_context = nullptr;
+        std::unique_ptr<std::function<R(Args...)>> _owned;
+
+        template <typename F>
+        void assign(F &&function, std::true_type)
+        {
+            _function = function;
+        }
+
+        template <typename F>
+        void assign(F &&function, std::false_type)
+        {
+            _owned.reset(new std::function<R(Args...)>(std::forward<F>(function)));
+            if (!*_owned)
+            {
+                _owned.reset();
+                return;
+            }
+            _context = _owned.get();
+            _contextFunction = [](void *context, Args... args) -> R
+            { return (*static_cast<std::function<R(Args...)> *>(context))(args...); };
+        }
+    };
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <soc/soc.h>
+#include <soc/soc_caps.h>
+#include <soc/gpio_reg.h>
+
+namespace enomik
+{
+    // Level of every GPIO with one or two register reads, bit n is GPIO n
+    static inline uint64_t readGpioInputs()
+    {
+        uint64_t port = REG_READ(GPIO_IN_REG);
+#if SOC_GPIO_PIN_COUNT > 32
+        port |= (uint64_t)REG_READ(GPIO_IN1_REG) << 32;
+#endif
+        return port;
+    }
+}
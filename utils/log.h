@@ -0,0 +1,218 @@
+#pragma once
+
+#include <Arduino.h>
+#include <type_traits>
+#if defined(ESP_PLATFORM)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+// Deferred logging for the message path.
+// ENOMIK_LOGx only stores a binary record (time, level, format pointer, up to 6 integer arguments)
+// in a ring buffer. Formatting and Serial output happen later in Log::flush(), called from an idle
+// priority task and from enomik::Client::loop(). Format strings and string arguments must be
+// literals, they are read when the record is printed.
+// Production builds set ENOMIK_LOG_LEVEL to ENOMIK_LOG_NONE and the macros compile to nothing.
+
+#define ENOMIK_LOG_NONE 0
+#define ENOMIK_LOG_ERROR 1
+#define ENOMIK_LOG_WARN 2
+#define ENOMIK_LOG_INFO 3
+#define ENOMIK_LOG_DEBUG 4
+
+#ifndef ENOMIK_LOG_LEVEL
+#define ENOMIK_LOG_LEVEL ENOMIK_LOG_INFO
+#endif
+#ifndef ENOMIK_LOG_BUFFER_SIZE
+#define ENOMIK_LOG_BUFFER_SIZE 64 // records, 36 bytes each on the esp32
+#endif
+#ifndef ENOMIK_LOG_DEFERRED
+#define ENOMIK_LOG_DEFERRED 1 // 0 prints in place, e.g. to see the last lines before a crash
+#endif
+#ifndef ENOMIK_LOG_FLUSH_PER_LOOP
+#define ENOMIK_LOG_FLUSH_PER_LOOP 4 // records printed by each Client::loop()
+#endif
+#define ENOMIK_LOG_MAX_ARGS 6
+
+#define ENOMIK_LOG_MAC_FORMAT "%02X:%02X:%02X:%02X:%02X:%02X"
+#define ENOMIK_LOG_MAC_ARGS(mac) (mac)[0], (mac)[1], (mac)[2], (mac)[3], (mac)[4], (mac)[5]
+
+#if ENOMIK_LOG_LEVEL >= ENOMIK_LOG_ERROR
+#define ENOMIK_LOGE(format, ...) enomik::Log::write(ENOMIK_LOG_ERROR, format, ##__VA_ARGS__)
+#else
+#define ENOMIK_LOGE(format, ...) ((void)0)
+#endif
+#if ENOMIK_LOG_LEVEL >= ENOMIK_LOG_WARN
+#define ENOMIK_LOGW(format, ...) enomik::Log::write(ENOMIK_LOG_WARN, format, ##__VA_ARGS__)
+#else
+#define ENOMIK_LOGW(format, ...) ((void)0)
+#endif
+#if ENOMIK_LOG_LEVEL >= ENOMIK_LOG_INFO
+#define ENOMIK_LOGI(format, ...) enomik::Log::write(ENOMIK_LOG_INFO, format, ##__VA_ARGS__)
+#else
+#define ENOMIK_LOGI(format, ...) ((void)0)
+#endif
+#if ENOMIK_LOG_LEVEL >= ENOMIK_LOG_DEBUG
+#define ENOMIK_LOGD(format, ...) enomik::Log::write(ENOMIK_LOG_DEBUG, format, ##__VA_ARGS__)
+#else
+#define ENOMIK_LOGD(format, ...) ((void)0)
+#endif
+
+namespace enomik
+{
+    struct LogRecord
+    {
+        uint32_t timeMs;
+        const char *format;
+        uintptr_t args[ENOMIK_LOG_MAX_ARGS];
+        uint8_t level;
+    };
+
+    class Log
+    {
+    public:
+        // Starts the idle priority task that flushes to out, safe to call more than once
+        static void begin(Print &out = Serial)
+        {
+            state().out = &out;
+#if ENOMIK_LOG_DEFERRED && defined(ESP_PLATFORM)
+            static TaskHandle_t task = nullptr;
+            if (!task)
+                xTaskCreate(flushTask, "enomik_log", 4096, nullptr, tskIDLE_PRIORITY, &task);
+#endif
+        }
+
+        template <typename... Args>
+        static void write(uint8_t level, const char *format, Args... args)
+        {
+            static_assert(sizeof...(Args) <= ENOMIK_LOG_MAX_ARGS, "too many log arguments");
+            LogRecord record;
+            record.timeMs = millis();
+            record.format = format;
+            record.level = level;
+            uintptr_t values[ENOMIK_LOG_MAX_ARGS + 1] = {toArg(args)...};
+            memcpy(record.args, values, sizeof(record.args));
+#if ENOMIK_LOG_DEFERRED
+            push(record);
+#else
+            print(*state().out, record);
+#endif
+        }
+
+        // Formats and prints up to maxRecords, returns how many were printed
+        static size_t flush(Print &out, size_t maxRecords = ENOMIK_LOG_BUFFER_SIZE)
+        {
+            State &s = state();
+            portENTER_CRITICAL(&s.lock);
+            if (s.flushing)
+            {
+                portEXIT_CRITICAL(&s.lock);
+                return 0; // the other flusher keeps the order
+            }
+            s.flushing = true;
+            uint32_t dropped = s.dropped;
+            s.dropped = 0;
+            portEXIT_CRITICAL(&s.lock);
+
+            if (dropped)
+                out.printf("[log] %u records dropped\n", (unsigned)dropped);
+
+            size_t printed = 0;
+            LogRecord record;
+            while (printed < maxRecords && pop(record))
+            {
+                print(out, record);
+                printed++;
+            }
+            s.flushing = false;
+            return printed;
+        }
+
+        static size_t flush(size_t maxRecords = ENOMIK_LOG_BUFFER_SIZE)
+        {
+            return flush(*state().out, maxRecords);
+        }
+
+        static void print(Print &out, const LogRecord &record)
+        {
+            static const char levels[] = "-EWID";
+            const uintptr_t *a = record.args;
+            char line[160];
+            snprintf(line, sizeof(line), record.format, a[0], a[1], a[2], a[3], a[4], a[5]);
+            out.printf("[%c %lu] %s\n", levels[record.level < 5 ? record.level : 0],
+                       (unsigned long)record.timeMs, line);
+        }
+
+    private:
+        struct State
+        {
+            LogRecord records[ENOMIK_LOG_BUFFER_SIZE];
+            uint16_t head = 0;
+            uint16_t count = 0;
+            uint32_t dropped = 0;
+            bool flushing = false;
+            Print *out = &Serial;
+            portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+        };
+
+        static State &state()
+        {
+            static State s;
+            return s;
+        }
+
+        template <typename T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, int>::type = 0>
+        static uintptr_t toArg(T value)
+        {
+            return (uintptr_t)value;
+        }
+
+        static uintptr_t toArg(const char *value)
+        {
+            return (uintptr_t)value;
+        }
+
+        static void push(const LogRecord &record)
+        {
+            State &s = state();
+            portENTER_CRITICAL(&s.lock);
+            if (s.count < ENOMIK_LOG_BUFFER_SIZE)
+            {
+                s.records[(s.head + s.count) % ENOMIK_LOG_BUFFER_SIZE] = record;
+                s.count++;
+            }
+            else
+            {
+                s.dropped++;
+            }
+            portEXIT_CRITICAL(&s.lock);
+        }
+
+        static bool pop(LogRecord &record)
+        {
+            State &s = state();
+            bool available = false;
+            portENTER_CRITICAL(&s.lock);
+            if (s.count > 0)
+            {
+                record = s.records[s.head];
+                s.head = (s.head + 1) % ENOMIK_LOG_BUFFER_SIZE;
+                s.count--;
+                available = true;
+            }
+            portEXIT_CRITICAL(&s.lock);
+            return available;
+        }
+
+#if ENOMIK_LOG_DEFERRED && defined(ESP_PLATFORM)
+        static void flushTask(void *)
+        {
+            for (;;)
+            {
+                flush();
+                vTaskDelay(pdMS_TO_TICKS(20));
+            }
+        }
+#endif
+    };
+}
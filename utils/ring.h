@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace enomik
+{
+    // Lock-free ring for one producer (an interrupt) and one consumer (a task).
+    // push() and pop() may run concurrently, each side only writes its own index.
+    template <typename T, uint16_t Size>
+    class SpscRing
+    {
+        static_assert((Size & (Size - 1)) == 0, "SpscRing size must be a power of two");
+
+    public:
+        // Producer, false if full. Always inlined, so it lands in IRAM with the interrupt that calls it
+        inline __attribute__((always_inline)) bool push(const T &item)
+        {
+            uint16_t head = _head;
+            uint16_t next = (head + 1) & (Size - 1);
+            if (next == __atomic_load_n(&_tail, __ATOMIC_ACQUIRE))
+                return false;
+            _items[head] = item;
+            __atomic_store_n(&_head, next, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        // Consumer, false if empty
+        inline bool pop(T &item)
+        {
+            uint16_t tail = _tail;
+            if (tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE))
+                return false;
+            item = _items[tail];
+            __atomic_store_n(&_tail, (uint16_t)((tail + 1) & (Size - 1)), __ATOMIC_RELEASE);
+            return true;
+        }
+
+        inline bool empty() const
+        {
+            return _tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE);
+        }
+
+    private:
+        T _items[Size];
+        volatile uint16_t _head = 0; // written by the producer only
+        volatile uint16_t _tail = 0; // written by the consumer only
+    };
+}